@@ -15,8 +15,6 @@ let package = Package(
             name: "TreeSitterOCaml",
             path: ".",
             sources: [
-                "interface/src/parser.c",
-                "interface/src/scanner.c",
                 "ocaml/src/parser.c",
                 "ocaml/src/scanner.c",
             ],
@@ -0,0 +1,224 @@
+// Microbenchmark for the external scanner in `common/scanner.h`.
+//
+// The scanner is driven through a mock lexer over a synthetic source the same
+// way the parser drives it: the state is deserialized before every call and
+// serialized after every external token. `script/bench-scanner` builds this
+// file against two revisions of the scanner to compare them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Count what the scanner allocates.
+
+static size_t allocations;
+static size_t allocated_bytes;
+
+static void *bench_malloc(size_t size) {
+  allocations++;
+  allocated_bytes += size;
+  return malloc(size);
+}
+
+static void *bench_calloc(size_t count, size_t size) {
+  allocations++;
+  allocated_bytes += count * size;
+  return calloc(count, size);
+}
+
+static void *bench_realloc(void *buffer, size_t size) {
+  allocations++;
+  allocated_bytes += size;
+  return realloc(buffer, size);
+}
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#include "scanner.h"
+#undef malloc
+#undef calloc
+#undef realloc
+
+typedef struct {
+  TSLexer lexer;
+  const char *input;
+  uint32_t length;
+  uint32_t position;
+  uint32_t token_end;
+  bool marked;
+  uint32_t column;
+} MockLexer;
+
+static void mock_advance(TSLexer *lexer, bool skip) {
+  MockLexer *mock = (MockLexer *)lexer;
+  if (mock->position >= mock->length) return;
+  if (mock->input[mock->position] == '\n') {
+    mock->column = 0;
+  } else {
+    mock->column++;
+  }
+  mock->position++;
+  lexer->lookahead =
+      mock->position < mock->length ? (uint8_t)mock->input[mock->position] : 0;
+}
+
+static void mock_mark_end(TSLexer *lexer) {
+  MockLexer *mock = (MockLexer *)lexer;
+  mock->token_end = mock->position;
+  mock->marked = true;
+}
+
+static uint32_t mock_get_column(TSLexer *lexer) {
+  return ((MockLexer *)lexer)->column;
+}
+
+static bool mock_is_at_included_range_start(const TSLexer *lexer) {
+  (void)lexer;
+  return false;
+}
+
+static bool mock_eof(const TSLexer *lexer) {
+  const MockLexer *mock = (const MockLexer *)lexer;
+  return mock->position >= mock->length;
+}
+
+static void mock_reset(MockLexer *mock, uint32_t position, uint32_t column) {
+  mock->position = position;
+  mock->token_end = position;
+  mock->marked = false;
+  mock->column = column;
+  mock->lexer.lookahead =
+      position < mock->length ? (uint8_t)mock->input[position] : 0;
+}
+
+static const char *const chunks[] = {
+    "let greeting name = {html|<p>Hello ${name}!</p>|html}\n",
+    "let query = {sql|SELECT * FROM users WHERE id = $Int{id}|sql}\n",
+    "# 42 \"generated.ml\"\n",
+    "let nested = {a|${ {b|${ {c|deep|c} }|b} }|a}\n",
+    "let sum l = List.fold_left (fun acc x -> acc + x) 0 l\n",
+    "let pipe = {|a | b || c|} ^ {x_y|$$notinterpolated{|x_y}\n",
+    "module M = struct type t = { a : int; b : string } end\n",
+    "(** [f x] is {b bold} \"*)\" and {|*)|} (* nested *) x' '\"' *)\n",
+    "(* Returns the elements of the list that satisfy the predicate, in the\n"
+    "   order in which they appear in the input list, and raises Not_found\n"
+    "   when the predicate never holds. *)\n",
+};
+
+typedef struct {
+  uint64_t calls;
+  uint64_t tokens;
+  uint64_t state_bytes;
+} Counts;
+
+static void run(const char *input, uint32_t length, Counts *counts) {
+  MockLexer mock = {
+      .lexer =
+          {
+              .advance = mock_advance,
+              .mark_end = mock_mark_end,
+              .get_column = mock_get_column,
+              .is_at_included_range_start = mock_is_at_included_range_start,
+              .eof = mock_eof,
+          },
+      .input = input,
+      .length = length,
+  };
+  Scanner *scanner = create(false);
+  char state[TREE_SITTER_SERIALIZATION_BUFFER_SIZE];
+  unsigned state_length = 0;
+  bool valid_symbols[16] = {false};
+
+  uint32_t position = 0;
+  uint32_t line_start = 0;
+  while (position < length) {
+    deserialize(scanner, state, state_length);
+    bool in_quoted_string = state_length > 0;
+    valid_symbols[LEFT_QUOTED_STRING_DELIM] =
+        position > 0 && input[position - 1] == '{';
+    valid_symbols[RIGHT_QUOTED_STRING_DELIM] = in_quoted_string;
+    valid_symbols[START_INTERPOLATION] = in_quoted_string;
+    valid_symbols[LINE_NUMBER_DIRECTIVE] = true;
+    valid_symbols[NULL_CHARACTER] = in_quoted_string;
+    // The comment and quoted string content tokens, for scanners that have
+    // them.
+    valid_symbols[NULL_CHARACTER + 1] = true;
+    valid_symbols[NULL_CHARACTER + 3] = in_quoted_string;
+
+    mock_reset(&mock, position, position - line_start);
+    counts->calls++;
+    uint32_t next = position + 1;
+    if (scan(scanner, &mock.lexer, valid_symbols)) {
+      counts->tokens++;
+      state_length = serialize(scanner, state);
+      counts->state_bytes += state_length;
+      uint32_t token_end = mock.marked ? mock.token_end : mock.position;
+      if (token_end > position) next = token_end;
+    }
+    for (; position < next; position++) {
+      if (input[position] == '\n') line_start = position + 1;
+    }
+  }
+  destroy(scanner);
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  unsigned repetitions = argc > 1 ? (unsigned)atoi(argv[1]) : 20;
+  size_t chunk_count = sizeof(chunks) / sizeof(chunks[0]);
+
+  size_t length = 0;
+  for (size_t i = 0; i < 4096; i++) length += strlen(chunks[i % chunk_count]);
+  char *input = malloc(length + 1);
+  char *end = input;
+  for (size_t i = 0; i < 4096; i++) {
+    const char *chunk = chunks[i % chunk_count];
+    size_t chunk_length = strlen(chunk);
+    memcpy(end, chunk, chunk_length);
+    end += chunk_length;
+  }
+  *end = '\0';
+
+  Scanner *scanner = create(false);
+  size_t create_allocations = allocations;
+  size_t create_bytes = allocated_bytes;
+  destroy(scanner);
+
+  Counts counts = {0};
+  allocations = 0;
+  allocated_bytes = 0;
+  run(input, (uint32_t)length, &counts);  // warm up
+  size_t run_allocations = allocations;
+
+  double best = 0;
+  for (unsigned i = 0; i < repetitions; i++) {
+    Counts run_counts = {0};
+    double start = now();
+    run(input, (uint32_t)length, &run_counts);
+    double elapsed = now() - start;
+    if (i == 0 || elapsed < best) best = elapsed;
+    counts = run_counts;
+  }
+
+  printf("input:        %zu bytes\n", length);
+  printf("scan calls:   %llu\n", (unsigned long long)counts.calls);
+  printf("tokens:       %llu\n", (unsigned long long)counts.tokens);
+  printf("state bytes:  %.2f per token\n",
+         (double)counts.state_bytes / counts.tokens);
+  printf("scan call:    %.2f ns\n", best * 1e9 / counts.calls);
+  printf("token:        %.2f ns\n", best * 1e9 / counts.tokens);
+  printf("input byte:   %.2f ns\n", best * 1e9 / length);
+  printf("create():     %zu allocations, %zu bytes\n", create_allocations,
+         create_bytes);
+  printf("scan():       %zu allocations\n", run_allocations);
+
+  free(input);
+  return 0;
+}
@@ -1,20 +1,32 @@
 {
+  "variables": {
+    "scanner_stats%": "<!(node -p \"process.env.TREE_SITTER_OCAML_SCANNER_STATS ? 1 : 0\")"
+  },
   "targets": [
     {
       "target_name": "tree_sitter_ocaml_binding",
       "include_dirs": [
         "<!(node -e \"require('nan')\")",
+        "<!(node -p \"require('path').dirname(require.resolve('tree-sitter/package.json'))\")/vendor/tree-sitter/lib/include",
         "ocaml/src"
       ],
       "sources": [
         "ocaml/src/parser.c",
         "ocaml/src/scanner.c",
-        "interface/src/parser.c",
-        "interface/src/scanner.c",
-        "bindings/node/binding.cc"
+        "bindings/node/binding.cc",
+        # The addon has a runtime of its own for the parses it runs: the one
+        # vendored by the tree-sitter package it is installed with. Only the
+        # flat encoding of its trees leaves the addon, so that runtime doesn't
+        # have to match node-tree-sitter's.
+        "<!(node -p \"require('path').dirname(require.resolve('tree-sitter/package.json'))\")/vendor/tree-sitter/lib/src/lib.c"
       ],
       "cflags_c": [
         "-std=c99",
+      ],
+      "conditions": [
+        ["scanner_stats==1", {
+          "defines": ["TREE_SITTER_OCAML_SCANNER_STATS"]
+        }]
       ]
     },
   ]
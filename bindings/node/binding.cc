@@ -1,16 +1,551 @@
-#include "tree_sitter/parser.h"
+#include <tree_sitter/api.h>
 #include <node.h>
+#include <node_buffer.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include "nan.h"
 
+#ifdef _WIN32
+#include <stdio.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace v8;
 
 extern "C" TSLanguage * tree_sitter_ocaml();
 extern "C" TSLanguage * tree_sitter_ocaml_interface();
 
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+#include "../../common/scanner_stats.h"
+
+extern "C" void tree_sitter_ocaml_external_scanner_stats(ScannerStats *stats);
+extern "C" void tree_sitter_ocaml_interface_external_scanner_stats(ScannerStats *stats);
+#endif
+
 namespace {
 
 NAN_METHOD(New) {}
 
+// Returns the grammar of one of the `Language` objects exported below, or NULL
+// if `value` is something else.
+const TSLanguage *UnwrapLanguage(Local<Value> value) {
+  if (!value->IsObject()) return NULL;
+  Local<Object> object = Nan::To<Object>(value).ToLocalChecked();
+  if (object->InternalFieldCount() != 1) return NULL;
+  void *language = Nan::GetInternalFieldPointer(object, 0);
+  if (language != tree_sitter_ocaml() && language != tree_sitter_ocaml_interface()) return NULL;
+  return static_cast<const TSLanguage *>(language);
+}
+
+// Scanner statistics
+//
+// With TREE_SITTER_OCAML_SCANNER_STATS defined, the external scanner counts
+// what it does on each thread. The counters of a thread are taken, and reset,
+// as an object.
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+
+const char *const SCANNER_TOKEN_NAMES[SCANNER_STATS_TOKEN_TYPES] = {
+  "_left_quoted_string_delim",
+  "_right_quoted_string_delim",
+  "_start_interpolation",
+  "line_number_directive",
+  "_null",
+  "comment",
+  "_string_fragment",
+  "_quoted_string_fragment",
+  "_implementation_start",
+  "_interface_start",
+  "_error_sentinel",
+};
+
+ScannerStats TakeScannerStats(const TSLanguage *language) {
+  ScannerStats stats;
+  if (language == tree_sitter_ocaml_interface()) {
+    tree_sitter_ocaml_interface_external_scanner_stats(&stats);
+  } else {
+    tree_sitter_ocaml_external_scanner_stats(&stats);
+  }
+  return stats;
+}
+
+Local<Object> ScannerStatsObject(const ScannerStats &stats) {
+  Local<Object> result = Nan::New<Object>();
+  const struct { const char *name; uint64_t value; } counters[] = {
+    {"scanCalls", stats.scan_calls},
+    {"tokens", stats.tokens},
+    {"extrasOnlyCalls", stats.extras_only_calls},
+    {"whitespaceSkipped", stats.whitespace_skipped},
+    {"columnQueries", stats.column_queries},
+    {"serializations", stats.serializations},
+    {"serializedBytes", stats.serialized_bytes},
+    {"deserializations", stats.deserializations},
+    {"deserializedBytes", stats.deserialized_bytes},
+    {"serializeCycles", stats.serialize_cycles},
+    {"deserializeCycles", stats.deserialize_cycles},
+    {"missCycles", stats.miss_cycles},
+  };
+  for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+    Nan::Set(result, Nan::New(counters[i].name).ToLocalChecked(),
+             Nan::New<Number>(static_cast<double>(counters[i].value)));
+  }
+  Local<Object> token_counts = Nan::New<Object>();
+  Local<Object> token_cycles = Nan::New<Object>();
+  for (size_t i = 0; i < SCANNER_STATS_TOKEN_TYPES; i++) {
+    Local<String> name = Nan::New(SCANNER_TOKEN_NAMES[i]).ToLocalChecked();
+    Nan::Set(token_counts, name, Nan::New<Number>(static_cast<double>(stats.token_counts[i])));
+    Nan::Set(token_cycles, name, Nan::New<Number>(static_cast<double>(stats.token_cycles[i])));
+  }
+  Nan::Set(result, Nan::New("tokenCounts").ToLocalChecked(), token_counts);
+  Nan::Set(result, Nan::New("tokenCycles").ToLocalChecked(), token_cycles);
+  return result;
+}
+
+#endif
+
+// Flat trees
+//
+// A tree is encoded as columns with an entry per node, in pre-order: the kind
+// id of the node, its start and end byte, and the index of its parent, -1 for
+// the root. The columns are handed over to typed arrays without copying.
+
+template <typename T>
+struct Column {
+  T *data;
+  size_t length;
+  size_t capacity;
+
+  Column() : data(NULL), length(0), capacity(0) {}
+  ~Column() { free(data); }
+
+  void Push(T value) {
+    if (length == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      data = static_cast<T *>(realloc(data, capacity * sizeof(T)));
+      if (!data) abort();
+    }
+    data[length++] = value;
+  }
+
+  template <typename Array>
+  Local<Array> Release() {
+    size_t count = length;
+    Local<Object> buffer =
+      Nan::NewBuffer(reinterpret_cast<char *>(data), static_cast<uint32_t>(count * sizeof(T))).ToLocalChecked();
+    data = NULL;
+    length = capacity = 0;
+    return Array::New(buffer.As<Uint8Array>()->Buffer(), 0, count);
+  }
+};
+
+struct FlatTree {
+  Column<uint16_t> kinds;
+  Column<uint32_t> start_bytes;
+  Column<uint32_t> end_bytes;
+  Column<int32_t> parents;
+  bool has_error;
+
+  FlatTree() : has_error(false) {}
+
+  void Encode(const TSTree *tree) {
+    TSNode root = ts_tree_root_node(tree);
+    has_error = ts_node_has_error(root);
+    TSTreeCursor cursor = ts_tree_cursor_new(root);
+    // The parents of the ancestors of the current node.
+    Column<int32_t> ancestors;
+    int32_t parent = -1;
+    for (;;) {
+      TSNode node = ts_tree_cursor_current_node(&cursor);
+      int32_t index = static_cast<int32_t>(kinds.length);
+      kinds.Push(ts_node_symbol(node));
+      start_bytes.Push(ts_node_start_byte(node));
+      end_bytes.Push(ts_node_end_byte(node));
+      parents.Push(parent);
+      if (ts_tree_cursor_goto_first_child(&cursor)) {
+        ancestors.Push(parent);
+        parent = index;
+        continue;
+      }
+      while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+        if (!ts_tree_cursor_goto_parent(&cursor)) {
+          ts_tree_cursor_delete(&cursor);
+          return;
+        }
+        parent = ancestors.data[--ancestors.length];
+      }
+    }
+  }
+
+  Local<Object> Release() {
+    Local<Object> result = Nan::New<Object>();
+    Nan::Set(result, Nan::New("kinds").ToLocalChecked(), kinds.Release<Uint16Array>());
+    Nan::Set(result, Nan::New("startBytes").ToLocalChecked(), start_bytes.Release<Uint32Array>());
+    Nan::Set(result, Nan::New("endBytes").ToLocalChecked(), end_bytes.Release<Uint32Array>());
+    Nan::Set(result, Nan::New("parents").ToLocalChecked(), parents.Release<Int32Array>());
+    Nan::Set(result, Nan::New("hasError").ToLocalChecked(), Nan::New<Boolean>(has_error));
+    return result;
+  }
+};
+
+// Mapped files
+//
+// A file is parsed straight from a read-only memory map, which the parser
+// reads a chunk at a time through a TSInput, without copying it. The pages
+// the lexer has left well behind are handed back to the kernel as it goes,
+// and read again from the page cache if error recovery goes back that far, so
+// a parse holds little more than its tree in memory. On Windows, the file is
+// read into memory instead.
+
+const uint32_t MAPPED_CHUNK_SIZE = 64 * 1024;
+const uint32_t MAPPED_KEEP_BEHIND = 4 * 1024 * 1024;
+
+class MappedFile {
+ public:
+  MappedFile() : data_(NULL), length_(0), released_(0) {}
+  ~MappedFile() { Close(); }
+
+  // Maps the file at `path`. Returns an error message, or an empty string.
+  std::string Open(const char *path) {
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (!file) return std::string(path) + ": " + strerror(errno);
+    std::string error;
+    if (fseek(file, 0, SEEK_END) == 0) {
+      long length = ftell(file);
+      rewind(file);
+      if (length > 0) {
+        data_ = static_cast<char *>(malloc(length));
+        if (!data_) abort();
+        length_ = fread(data_, 1, length, file);
+      }
+    }
+    if (ferror(file)) error = std::string(path) + ": " + strerror(errno);
+    fclose(file);
+    return error;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return std::string(path) + ": " + strerror(errno);
+    struct stat info;
+    std::string error;
+    if (fstat(fd, &info) != 0) {
+      error = strerror(errno);
+    } else if (static_cast<uint64_t>(info.st_size) > UINT32_MAX) {
+      error = "The file is larger than 4GB";
+    } else if (info.st_size > 0) {
+      void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        error = strerror(errno);
+      } else {
+        data_ = static_cast<char *>(data);
+        length_ = info.st_size;
+        madvise(data_, length_, MADV_SEQUENTIAL);
+      }
+    }
+    close(fd);
+    return error.empty() ? error : std::string(path) + ": " + error;
+#endif
+  }
+
+  void Close() {
+    if (!data_) return;
+#ifdef _WIN32
+    free(data_);
+#else
+    munmap(data_, length_);
+#endif
+    data_ = NULL;
+    length_ = released_ = 0;
+  }
+
+  TSInput Input() {
+    TSInput input = {this, Read, TSInputEncodingUTF8};
+    return input;
+  }
+
+ private:
+  static const char *Read(void *payload, uint32_t byte, TSPoint, uint32_t *bytes_read) {
+    MappedFile *file = static_cast<MappedFile *>(payload);
+    if (byte >= file->length_) {
+      *bytes_read = 0;
+      return "";
+    }
+#ifndef _WIN32
+    if (byte >= file->released_ + MAPPED_KEEP_BEHIND + MAPPED_CHUNK_SIZE) {
+      // A multiple of the chunk size, and so of the page size.
+      size_t end = (byte - MAPPED_KEEP_BEHIND) / MAPPED_CHUNK_SIZE * MAPPED_CHUNK_SIZE;
+      madvise(file->data_ + file->released_, end - file->released_, MADV_DONTNEED);
+      file->released_ = end;
+    }
+#endif
+    size_t left = file->length_ - byte;
+    *bytes_read = left < MAPPED_CHUNK_SIZE ? static_cast<uint32_t>(left) : MAPPED_CHUNK_SIZE;
+    return file->data_ + byte;
+  }
+
+  char *data_;
+  size_t length_;
+  // The pages below this offset have been handed back.
+  size_t released_;
+};
+
+// Parsing
+//
+// Sources are parsed on the libuv thread pool. Every thread of the pool keeps
+// a parser per grammar. The source `Buffer` is read in place, and is kept
+// alive until the parse is done. A source given as a path is mapped on the
+// thread that parses it, and a batch of sources is parsed on a single thread.
+
+struct ThreadParsers {
+  TSParser *ocaml;
+  TSParser *interface;
+
+  ThreadParsers() : ocaml(NULL), interface(NULL) {}
+  ~ThreadParsers() {
+    if (ocaml) ts_parser_delete(ocaml);
+    if (interface) ts_parser_delete(interface);
+  }
+
+  TSParser *For(const TSLanguage *language) {
+    TSParser **parser = language == tree_sitter_ocaml() ? &ocaml : &interface;
+    if (!*parser) {
+      *parser = ts_parser_new();
+      ts_parser_set_language(*parser, language);
+    }
+    return *parser;
+  }
+};
+
+thread_local ThreadParsers thread_parsers;
+
+// The result of a parse, kept on the thread pool until it is handed over on
+// the main thread: the flat encoding of the tree, which is deleted as soon as
+// it is encoded.
+class ParseResult {
+ public:
+  ParseResult() {}
+
+  void Take(TSTree *tree) {
+    flat_tree_.Encode(tree);
+    ts_tree_delete(tree);
+  }
+
+  Local<Value> Release() {
+    Local<Object> result = flat_tree_.Release();
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+    Nan::Set(result, Nan::New("scannerStats").ToLocalChecked(), ScannerStatsObject(scanner_stats));
+#endif
+    return result;
+  }
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+  ScannerStats scanner_stats;
+#endif
+
+ private:
+  ParseResult(const ParseResult &);
+  ParseResult &operator=(const ParseResult &);
+
+  FlatTree flat_tree_;
+};
+
+class ParseWorker : public Nan::AsyncWorker {
+ public:
+  ParseWorker(Nan::Callback *callback, const TSLanguage *language, Local<Object> source)
+    : Nan::AsyncWorker(callback, "tree-sitter-ocaml:parse"),
+      language_(language),
+      data_(node::Buffer::Data(source)),
+      length_(node::Buffer::Length(source)) {
+    SaveToPersistent("source", source);
+  }
+
+  ParseWorker(Nan::Callback *callback, const TSLanguage *language, const std::string &path)
+    : Nan::AsyncWorker(callback, "tree-sitter-ocaml:parse"),
+      language_(language),
+      data_(NULL),
+      length_(0),
+      path_(path) {}
+
+  void Execute() {
+    if (length_ > UINT32_MAX) {
+      SetErrorMessage("The source is larger than 4GB");
+      return;
+    }
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+    // Drop what earlier work on this thread left in the counters.
+    TakeScannerStats(language_);
+#endif
+    TSTree *tree;
+    if (path_.empty()) {
+      tree = ts_parser_parse_string(thread_parsers.For(language_), NULL, data_, static_cast<uint32_t>(length_));
+    } else {
+      MappedFile file;
+      std::string error = file.Open(path_.c_str());
+      if (!error.empty()) {
+        SetErrorMessage(error.c_str());
+        return;
+      }
+      // The tree doesn't refer to the source, so the file can be unmapped
+      // as soon as it is parsed.
+      tree = ts_parser_parse(thread_parsers.For(language_), NULL, file.Input());
+    }
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+    result_.scanner_stats = TakeScannerStats(language_);
+#endif
+    if (!tree) {
+      SetErrorMessage("Parsing failed");
+      return;
+    }
+    result_.Take(tree);
+  }
+
+  void HandleOKCallback() {
+    Nan::HandleScope scope;
+    Local<Value> argv[] = {Nan::Null(), result_.Release()};
+    callback->Call(2, argv, async_resource);
+  }
+
+ private:
+  const TSLanguage *language_;
+  const char *data_;
+  size_t length_;
+  std::string path_;
+  ParseResult result_;
+};
+
+// Parses a batch of sources one after the other on a single thread of the
+// pool, which takes one task of the pool and one callback for the batch
+// rather than one for every source.
+class BatchParseWorker : public Nan::AsyncWorker {
+ public:
+  BatchParseWorker(Nan::Callback *callback, const TSLanguage *language, Local<Array> sources)
+    : Nan::AsyncWorker(callback, "tree-sitter-ocaml:parseBatch"),
+      language_(language),
+      count_(sources->Length()),
+      sources_(new Source[count_]),
+      results_(new ParseResult[count_]) {
+    for (size_t i = 0; i < count_; i++) {
+      Local<Value> source = Nan::Get(sources, static_cast<uint32_t>(i)).ToLocalChecked();
+      sources_[i].data = node::Buffer::Data(source);
+      sources_[i].length = node::Buffer::Length(source);
+    }
+    SaveToPersistent("sources", sources);
+  }
+
+  ~BatchParseWorker() {
+    delete[] sources_;
+    delete[] results_;
+  }
+
+  void Execute() {
+    TSParser *parser = thread_parsers.For(language_);
+    for (size_t i = 0; i < count_; i++) {
+      if (sources_[i].length > UINT32_MAX) {
+        SetErrorMessage("The source is larger than 4GB");
+        return;
+      }
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+      TakeScannerStats(language_);
+#endif
+      TSTree *tree = ts_parser_parse_string(parser, NULL, sources_[i].data, static_cast<uint32_t>(sources_[i].length));
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+      results_[i].scanner_stats = TakeScannerStats(language_);
+#endif
+      if (!tree) {
+        SetErrorMessage("Parsing failed");
+        return;
+      }
+      results_[i].Take(tree);
+    }
+  }
+
+  void HandleOKCallback() {
+    Nan::HandleScope scope;
+    Local<Array> results = Nan::New<Array>(static_cast<uint32_t>(count_));
+    for (size_t i = 0; i < count_; i++) {
+      Nan::Set(results, static_cast<uint32_t>(i), results_[i].Release());
+    }
+    Local<Value> argv[] = {Nan::Null(), results};
+    callback->Call(2, argv, async_resource);
+  }
+
+ private:
+  struct Source {
+    const char *data;
+    size_t length;
+  };
+
+  const TSLanguage *language_;
+  size_t count_;
+  Source *sources_;
+  ParseResult *results_;
+};
+
+// parse(language, buffer, callback)
+NAN_METHOD(Parse) {
+  const TSLanguage *language = UnwrapLanguage(info[0]);
+  if (!language) return Nan::ThrowTypeError("Expected an OCaml language");
+  if (!node::Buffer::HasInstance(info[1])) return Nan::ThrowTypeError("Expected a Buffer");
+  if (!info[2]->IsFunction()) return Nan::ThrowTypeError("Expected a callback");
+  Local<Object> source = Nan::To<Object>(info[1]).ToLocalChecked();
+  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+  Nan::AsyncQueueWorker(new ParseWorker(callback, language, source));
+}
+
+// parseBatch(language, buffers, callback)
+NAN_METHOD(ParseBatch) {
+  const TSLanguage *language = UnwrapLanguage(info[0]);
+  if (!language) return Nan::ThrowTypeError("Expected an OCaml language");
+  if (!info[1]->IsArray()) return Nan::ThrowTypeError("Expected an array of Buffers");
+  if (!info[2]->IsFunction()) return Nan::ThrowTypeError("Expected a callback");
+  Local<Array> sources = info[1].As<Array>();
+  for (uint32_t i = 0; i < sources->Length(); i++) {
+    if (!node::Buffer::HasInstance(Nan::Get(sources, i).ToLocalChecked())) {
+      return Nan::ThrowTypeError("Expected an array of Buffers");
+    }
+  }
+  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+  Nan::AsyncQueueWorker(new BatchParseWorker(callback, language, sources));
+}
+
+// parseFile(language, path, callback)
+NAN_METHOD(ParseFile) {
+  const TSLanguage *language = UnwrapLanguage(info[0]);
+  if (!language) return Nan::ThrowTypeError("Expected an OCaml language");
+  if (!info[1]->IsString()) return Nan::ThrowTypeError("Expected a path");
+  if (!info[2]->IsFunction()) return Nan::ThrowTypeError("Expected a callback");
+  Nan::Utf8String path(info[1]);
+  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+  Nan::AsyncQueueWorker(new ParseWorker(callback, language, std::string(*path, path.length())));
+}
+
+// nodeKinds(language): the names of the kind ids used by flat trees.
+NAN_METHOD(NodeKinds) {
+  const TSLanguage *language = UnwrapLanguage(info[0]);
+  if (!language) return Nan::ThrowTypeError("Expected an OCaml language");
+  uint32_t count = ts_language_symbol_count(language);
+  Local<Array> kinds = Nan::New<Array>(count);
+  for (uint32_t i = 0; i < count; i++) {
+    Nan::Set(kinds, i, Nan::New(ts_language_symbol_name(language, i)).ToLocalChecked());
+  }
+  info.GetReturnValue().Set(kinds);
+}
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+// scannerStats(language): the counters of the scanner on the main thread,
+// which parses for the synchronous `Parser` of tree-sitter.
+NAN_METHOD(ScannerStatsMethod) {
+  const TSLanguage *language = UnwrapLanguage(info[0]);
+  if (!language) return Nan::ThrowTypeError("Expected an OCaml language");
+  info.GetReturnValue().Set(ScannerStatsObject(TakeScannerStats(language)));
+}
+#endif
+
 void Init(Local<Object> exports, Local<Object> module) {
   Local<FunctionTemplate> ocaml_tpl = Nan::New<FunctionTemplate>(New);
   ocaml_tpl->SetClassName(Nan::New("Language").ToLocalChecked());
@@ -30,6 +565,14 @@ void Init(Local<Object> exports, Local<Object> module) {
 
   Nan::Set(exports, Nan::New("ocaml").ToLocalChecked(), ocaml_instance);
   Nan::Set(exports, Nan::New("interface").ToLocalChecked(), iface_instance);
+
+  Nan::SetMethod(exports, "parse", Parse);
+  Nan::SetMethod(exports, "parseBatch", ParseBatch);
+  Nan::SetMethod(exports, "parseFile", ParseFile);
+  Nan::SetMethod(exports, "nodeKinds", NodeKinds);
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+  Nan::SetMethod(exports, "scannerStats", ScannerStatsMethod);
+#endif
 }
 
 NODE_MODULE(tree_sitter_ocaml_binding, Init)
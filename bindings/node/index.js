@@ -16,5 +16,97 @@ try {
 
 try {
   module.exports.ocaml.nodeTypeInfo = require("../../ocaml/src/node-types.json");
-  module.exports.interface.nodeTypeInfo = require("../../interface/src/node-types.json");
+  module.exports.interface.nodeTypeInfo = module.exports.ocaml.nodeTypeInfo;
 } catch (_) {}
+
+// The queries of each grammar, compiled the first time they are used and
+// shared by all the users of the module.
+const queryFiles = {
+  highlightsQuery: "highlights.scm",
+  injectionsQuery: "injections.scm",
+  localsQuery: "locals.scm",
+  tagsQuery: "tags.scm",
+};
+
+for (const language of [module.exports.ocaml, module.exports.interface]) {
+  for (const [property, file] of Object.entries(queryFiles)) {
+    let query;
+    Object.defineProperty(language, property, {
+      enumerable: true,
+      get() {
+        if (!query) {
+          const Parser = require("tree-sitter");
+          const source = require("fs").readFileSync(
+            require("path").join(__dirname, "..", "..", "queries", file),
+            "utf8"
+          );
+          query = new Parser.Query(language, source);
+        }
+        return query;
+      },
+    });
+  }
+}
+
+// Asynchronous parsing. Sources are parsed on the libuv thread pool, reading
+// `Buffer`s in place; strings are copied into a `Buffer` first. A buffer must
+// not be modified until its parse is done.
+//
+// The result is the tree encoded as typed arrays with an entry per node in
+// pre-order: `kinds`, whose names are in the `nodeKinds` of the language,
+// `startBytes`, `endBytes` and `parents`, the index of the parent of each node
+// or -1, with `hasError` for the whole tree. The parses run in the runtime
+// compiled into this module, which is not the one of node-tree-sitter, so no
+// tree object is handed out: the encoding is all that leaves the parse.
+const binding = module.exports;
+
+function toBuffer(source) {
+  return Buffer.isBuffer(source) ? source : Buffer.from(source);
+}
+
+function parseAsync(language, source) {
+  return new Promise((resolve, reject) => {
+    binding.parse(language, toBuffer(source), (error, result) => {
+      if (error) reject(error);
+      else resolve(result);
+    });
+  });
+}
+
+// Parses all the sources in a single task of the thread pool, one after the
+// other, and resolves to their results in order.
+function parseBatch(language, sources) {
+  const buffers = Array.from(sources, toBuffer);
+  return new Promise((resolve, reject) => {
+    binding.parseBatch(language, buffers, (error, results) => {
+      if (error) reject(error);
+      else resolve(results);
+    });
+  });
+}
+
+// Parses the file at `path` straight from a memory map, without reading it
+// into a `Buffer`, which keeps very large files out of memory.
+function parseFile(language, path) {
+  return new Promise((resolve, reject) => {
+    binding.parseFile(language, String(path), (error, result) => {
+      if (error) reject(error);
+      else resolve(result);
+    });
+  });
+}
+
+module.exports.parseAsync = parseAsync;
+module.exports.parseBatch = parseBatch;
+module.exports.parseFile = parseFile;
+
+for (const language of [module.exports.ocaml, module.exports.interface]) {
+  let kinds;
+  Object.defineProperty(language, "nodeKinds", {
+    enumerable: true,
+    get() {
+      if (!kinds) kinds = binding.nodeKinds(language);
+      return kinds;
+    },
+  });
+}
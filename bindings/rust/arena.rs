@@ -0,0 +1,449 @@
+//! An arena for the allocations of tree-sitter, for parsing many small files.
+//!
+//! Parsing a file makes tens of thousands of small allocations for the
+//! subtrees, the parse stack and the scanner, and freeing its tree undoes
+//! them one by one. [`install`] routes them through `ts_set_allocator`, and
+//! within [`scope`] those of the current thread are carved out of the thread's
+//! arena, a few large chunks that are reset wholesale when the scope ends.
+//!
+//! The arena is only reset if everything allocated in it was freed by then,
+//! so trees are parsed, used and dropped within the scope, as are the parsers
+//! that made them: a parser keeps some of the subtrees of its last parse for
+//! the next one. A tree that is kept past its scope stays valid, but the arena
+//! then leaves its chunks to it, to be freed with it, and starts over with new
+//! ones.
+//!
+//! ```
+//! use tree_sitter_ocaml::arena;
+//!
+//! // Before tree-sitter allocates anything.
+//! unsafe { arena::install() };
+//!
+//! for code in ["let x = 0", "let f x = x + 1"] {
+//!     let errors = arena::scope(|| {
+//!         let mut parser = tree_sitter::Parser::new();
+//!         parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//!         let tree = parser.parse(code, None).unwrap();
+//!         tree.root_node().has_error()
+//!     });
+//!     assert!(!errors);
+//! }
+//! let stats = arena::take_stats();
+//! assert!(stats.arena_allocations > 0);
+//! assert_eq!(stats.detached, 0);
+//! ```
+
+use std::alloc::{self, Layout};
+use std::cell::{Cell, RefCell};
+use std::ffi::c_void;
+use std::ptr;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::Once;
+
+extern "C" {
+    fn malloc(size: usize) -> *mut c_void;
+    fn calloc(count: usize, size: usize) -> *mut c_void;
+    fn realloc(pointer: *mut c_void, size: usize) -> *mut c_void;
+    fn free(pointer: *mut c_void);
+}
+
+/// The size of the chunks taken from the system allocator, unless a block
+/// needs a larger one.
+const CHUNK_SIZE: usize = 256 * 1024;
+
+/// The most bytes of chunks an arena keeps when it is reset.
+const KEEP_BYTES: usize = 16 * 1024 * 1024;
+
+/// The alignment of the blocks, that of `malloc` on 64-bit platforms.
+const ALIGN: usize = 16;
+
+/// The room for the [`Header`] in front of every block, arena or not.
+const HEADER_SIZE: usize = 16;
+
+struct Header {
+    /// The generation of the arena the block is in, or null if the block is
+    /// from the system allocator.
+    generation: *const Generation,
+    /// The size that was asked for.
+    size: usize,
+}
+
+/// Set in [`Generation::live`] once the arena has moved on to another
+/// generation.
+const DETACHED: usize = 1 << (usize::BITS - 1);
+
+/// The chunks of an arena between two resets.
+struct Generation {
+    /// The blocks that weren't freed yet, from any thread.
+    live: AtomicUsize,
+    /// Only used by the thread of the arena, or by the thread that frees the
+    /// last block once the generation is detached.
+    chunks: Vec<(*mut u8, usize)>,
+}
+
+impl Drop for Generation {
+    fn drop(&mut self) {
+        for &(start, size) in &self.chunks {
+            unsafe { alloc::dealloc(start, chunk_layout(size)) };
+        }
+    }
+}
+
+fn chunk_layout(size: usize) -> Layout {
+    Layout::from_size_align(size, ALIGN).unwrap()
+}
+
+/// Frees a block of `generation`, and the generation itself if it was the
+/// last block of a detached one.
+unsafe fn release(generation: *const Generation) {
+    if (*generation).live.fetch_sub(1, Ordering::AcqRel) == DETACHED + 1 {
+        drop(Box::from_raw(generation as *mut Generation));
+    }
+}
+
+/// Leaves `generation` to the blocks that are still in use, or frees it if
+/// there are none.
+unsafe fn detach(generation: *mut Generation) {
+    if (*generation).live.fetch_or(DETACHED, Ordering::AcqRel) == 0 {
+        drop(Box::from_raw(generation));
+    }
+}
+
+struct Arena {
+    generation: *mut Generation,
+    /// The chunk being filled, and the offset of its free space.
+    chunk: usize,
+    offset: usize,
+    /// The nesting of [`scope`]s.
+    depth: usize,
+}
+
+impl Arena {
+    /// Carves a block of `size` bytes out of the arena, if in a scope.
+    unsafe fn allocate(&mut self, size: usize) -> Option<(*mut u8, *const Generation)> {
+        if self.depth == 0 {
+            return None;
+        }
+        let needed = round_up(HEADER_SIZE.checked_add(size)?);
+        if self.generation.is_null() {
+            self.generation = Box::into_raw(Box::new(Generation {
+                live: AtomicUsize::new(0),
+                chunks: Vec::new(),
+            }));
+        }
+        let generation = &mut *self.generation;
+        loop {
+            if let Some(&(start, chunk_size)) = generation.chunks.get(self.chunk) {
+                if needed <= chunk_size - self.offset {
+                    let block = start.add(self.offset);
+                    self.offset += needed;
+                    generation.live.fetch_add(1, Ordering::Relaxed);
+                    return Some((block, generation));
+                }
+                if self.chunk + 1 < generation.chunks.len() {
+                    self.chunk += 1;
+                    self.offset = 0;
+                    continue;
+                }
+            }
+            let chunk_size = needed.max(CHUNK_SIZE);
+            let start = alloc::alloc(chunk_layout(chunk_size));
+            if start.is_null() {
+                alloc::handle_alloc_error(chunk_layout(chunk_size));
+            }
+            count(|stats| {
+                stats.chunks += 1;
+                stats.chunk_bytes += chunk_size;
+            });
+            generation.chunks.push((start, chunk_size));
+            self.chunk = generation.chunks.len() - 1;
+            self.offset = 0;
+        }
+    }
+
+    /// Resizes `block` in place if it is the last one carved out of the
+    /// current chunk and the chunk has room for it.
+    unsafe fn resize(
+        &mut self,
+        block: *mut u8,
+        generation: *const Generation,
+        size: usize,
+    ) -> bool {
+        if self.depth == 0 || generation != self.generation as *const _ {
+            return false;
+        }
+        let (start, chunk_size) = (&(*generation).chunks)[self.chunk];
+        if block < start || block >= start.add(self.offset) {
+            return false;
+        }
+        let header = &mut *(block as *mut Header);
+        let block_offset = block as usize - start as usize;
+        if block_offset + round_up(HEADER_SIZE + header.size) != self.offset {
+            return false;
+        }
+        match HEADER_SIZE.checked_add(size).map(round_up) {
+            Some(needed) if needed <= chunk_size - block_offset => {
+                self.offset = block_offset + needed;
+                header.size = size;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Resets the arena at the end of the outermost scope.
+    unsafe fn reset(&mut self) {
+        if self.generation.is_null() {
+            return;
+        }
+        let generation = &mut *self.generation;
+        if generation.live.load(Ordering::Acquire) == 0 {
+            let mut kept = 0;
+            generation.chunks.retain(|&(start, size)| {
+                kept += size;
+                if kept <= KEEP_BYTES {
+                    return true;
+                }
+                alloc::dealloc(start, chunk_layout(size));
+                false
+            });
+        } else {
+            count(|stats| stats.detached += 1);
+            detach(self.generation);
+            self.generation = ptr::null_mut();
+        }
+        self.chunk = 0;
+        self.offset = 0;
+    }
+}
+
+impl Drop for Arena {
+    fn drop(&mut self) {
+        if !self.generation.is_null() {
+            unsafe { detach(self.generation) };
+        }
+    }
+}
+
+fn round_up(size: usize) -> usize {
+    (size + ALIGN - 1) & !(ALIGN - 1)
+}
+
+/// The allocations of a thread, see [`take_stats`].
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Stats {
+    /// The calls to `malloc`, `calloc` and `realloc`.
+    pub allocations: usize,
+    /// The bytes they asked for.
+    pub bytes: usize,
+    pub frees: usize,
+    /// The allocations served by the arena, out of `allocations`.
+    pub arena_allocations: usize,
+    /// The chunks the arena took from the system allocator, and their bytes.
+    pub chunks: usize,
+    pub chunk_bytes: usize,
+    /// The scopes at the end of which the arena couldn't be reset, because
+    /// some of its blocks were still in use.
+    pub detached: usize,
+}
+
+thread_local! {
+    static ARENA: RefCell<Arena> = const {
+        RefCell::new(Arena {
+            generation: ptr::null_mut(),
+            chunk: 0,
+            offset: 0,
+            depth: 0,
+        })
+    };
+    static STATS: Cell<Stats> = const {
+        Cell::new(Stats {
+            allocations: 0,
+            bytes: 0,
+            frees: 0,
+            arena_allocations: 0,
+            chunks: 0,
+            chunk_bytes: 0,
+            detached: 0,
+        })
+    };
+}
+
+fn count(update: impl FnOnce(&mut Stats)) {
+    let _ = STATS.try_with(|cell| {
+        let mut stats = cell.get();
+        update(&mut stats);
+        cell.set(stats);
+    });
+}
+
+/// Returns the allocations of tree-sitter on the current thread since the
+/// last call, and starts counting again.
+pub fn take_stats() -> Stats {
+    STATS.with(|cell| cell.replace(Stats::default()))
+}
+
+unsafe fn allocate(size: usize, zeroed: bool) -> *mut c_void {
+    let block = ARENA
+        .try_with(|arena| arena.borrow_mut().allocate(size))
+        .ok()
+        .flatten();
+    count(|stats| {
+        stats.allocations += 1;
+        stats.bytes += size;
+        stats.arena_allocations += block.is_some() as usize;
+    });
+    let (block, generation) = match block {
+        Some((block, generation)) => {
+            if zeroed {
+                ptr::write_bytes(block.add(HEADER_SIZE), 0, size);
+            }
+            (block, generation)
+        }
+        None => {
+            let total = match HEADER_SIZE.checked_add(size) {
+                Some(total) => total,
+                None => return ptr::null_mut(),
+            };
+            let block = if zeroed {
+                calloc(1, total)
+            } else {
+                malloc(total)
+            };
+            if block.is_null() {
+                return ptr::null_mut();
+            }
+            (block as *mut u8, ptr::null())
+        }
+    };
+    (block as *mut Header).write(Header { generation, size });
+    block.add(HEADER_SIZE) as *mut c_void
+}
+
+unsafe extern "C" fn arena_malloc(size: usize) -> *mut c_void {
+    allocate(size, false)
+}
+
+unsafe extern "C" fn arena_calloc(count: usize, size: usize) -> *mut c_void {
+    match count.checked_mul(size) {
+        Some(size) => allocate(size, true),
+        None => ptr::null_mut(),
+    }
+}
+
+unsafe extern "C" fn arena_realloc(pointer: *mut c_void, size: usize) -> *mut c_void {
+    if pointer.is_null() {
+        return allocate(size, false);
+    }
+    let block = (pointer as *mut u8).sub(HEADER_SIZE);
+    let Header {
+        generation,
+        size: old_size,
+    } = (block as *const Header).read();
+
+    if generation.is_null() {
+        // Blocks of the system allocator stay there.
+        count(|stats| {
+            stats.allocations += 1;
+            stats.bytes += size;
+        });
+        let total = match HEADER_SIZE.checked_add(size) {
+            Some(total) => total,
+            None => return ptr::null_mut(),
+        };
+        let block = realloc(block as *mut c_void, total) as *mut u8;
+        if block.is_null() {
+            return ptr::null_mut();
+        }
+        (*(block as *mut Header)).size = size;
+        return block.add(HEADER_SIZE) as *mut c_void;
+    }
+
+    let resized = ARENA
+        .try_with(|arena| arena.borrow_mut().resize(block, generation, size))
+        .unwrap_or(false);
+    if resized {
+        count(|stats| {
+            stats.allocations += 1;
+            stats.bytes += size;
+            stats.arena_allocations += 1;
+        });
+        return pointer;
+    }
+    let moved = allocate(size, false);
+    if !moved.is_null() {
+        ptr::copy_nonoverlapping(pointer as *const u8, moved as *mut u8, old_size.min(size));
+        release(generation);
+    }
+    moved
+}
+
+unsafe extern "C" fn arena_free(pointer: *mut c_void) {
+    if pointer.is_null() {
+        return;
+    }
+    count(|stats| stats.frees += 1);
+    let block = (pointer as *mut u8).sub(HEADER_SIZE);
+    let generation = (*(block as *const Header)).generation;
+    if generation.is_null() {
+        free(block as *mut c_void);
+    } else {
+        release(generation);
+    }
+}
+
+static INSTALLED: AtomicBool = AtomicBool::new(false);
+
+/// Hands the allocator of this module to tree-sitter, for the whole process.
+/// Outside of a [`scope`], blocks still come from the system allocator.
+///
+/// # Safety
+///
+/// Must be called before tree-sitter allocates anything, that is before any
+/// parser, tree, query or query cursor is created, as blocks allocated before
+/// can't be freed after. Nothing else may call `ts_set_allocator`.
+pub unsafe fn install() {
+    static INSTALL: Once = Once::new();
+    INSTALL.call_once(|| {
+        tree_sitter::ffi::ts_set_allocator(
+            Some(arena_malloc),
+            Some(arena_calloc),
+            Some(arena_realloc),
+            Some(arena_free),
+        );
+        INSTALLED.store(true, Ordering::Release);
+    });
+}
+
+pub fn is_installed() -> bool {
+    INSTALLED.load(Ordering::Acquire)
+}
+
+/// Runs `f` with the allocations of tree-sitter on the current thread going
+/// to the thread's arena, and resets the arena when it returns if they were
+/// all freed. Scopes can be nested, the outermost one resets the arena.
+///
+/// # Panics
+///
+/// If [`install`] wasn't called.
+pub fn scope<T>(f: impl FnOnce() -> T) -> T {
+    assert!(is_installed(), "arena::install wasn't called");
+
+    struct Exit;
+
+    impl Drop for Exit {
+        fn drop(&mut self) {
+            ARENA.with(|arena| {
+                let mut arena = arena.borrow_mut();
+                arena.depth -= 1;
+                if arena.depth == 0 {
+                    unsafe { arena.reset() };
+                }
+            });
+        }
+    }
+
+    ARENA.with(|arena| arena.borrow_mut().depth += 1);
+    let _exit = Exit;
+    f()
+}
@@ -0,0 +1,640 @@
+//! Parsing many files on all cores.
+//!
+//! Files are parsed with the OCaml or the OCaml interface grammar depending on
+//! their extension. Every worker thread keeps one parser per grammar for all
+//! the files it parses, and has its own queue of files. The files are dealt
+//! out largest first, and a worker that runs out of files steals the smallest
+//! ones left in the queues of the others, so a single huge file only holds up
+//! the worker parsing it.
+//!
+//! Outside of the workers, [`ParserPool`] lends parsers to any thread, so that
+//! they and their allocations are reused from one file to the next.
+//!
+//! Some files, like the ones in `script/known_failures.txt`, take far longer
+//! to recover from their errors than a clean file of the same size takes to
+//! parse. A [`Budget`] bounds the time and the number of nodes of every parse.
+//! A file over budget gets the items [`skim`] finds instead of a tree, and
+//! with [`Options::time_recovery`] the time spent recovering from errors is
+//! measured and put down to the lookahead symbol the error was detected at.
+//!
+//! ```no_run
+//! use tree_sitter_ocaml::batch;
+//!
+//! let paths = batch::discover(&["src".into()]).unwrap();
+//! batch::parse_files(paths, &batch::Options::default(), |result| {
+//!     println!("{}: {} errors", result.path.display(), result.error_nodes);
+//! });
+//! ```
+
+use std::collections::{HashMap, VecDeque};
+use std::fs;
+use std::io;
+use std::ops::{Deref, DerefMut, Range};
+use std::path::{Path, PathBuf};
+use std::sync::mpsc;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+use tree_sitter::{Language, LogType, Parser, Tree};
+
+/// Returns the grammar for a file: the OCaml interface grammar for `.mli`
+/// files and the OCaml grammar for `.ml` files.
+pub fn language_for_path(path: &Path) -> Option<Language> {
+    match path.extension()?.to_str()? {
+        "ml" => Some(crate::language_ocaml()),
+        "mli" => Some(crate::language_ocaml_interface()),
+        _ => None,
+    }
+}
+
+/// Finds the `.ml` and `.mli` files under `roots`, which can also be files
+/// themselves. Directories starting with `.` and `_build` are skipped.
+pub fn discover(roots: &[PathBuf]) -> io::Result<Vec<PathBuf>> {
+    let mut paths = Vec::new();
+    for root in roots {
+        if root.is_dir() {
+            discover_dir(root, &mut paths)?;
+        } else {
+            paths.push(root.clone());
+        }
+    }
+    Ok(paths)
+}
+
+fn discover_dir(dir: &Path, paths: &mut Vec<PathBuf>) -> io::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        let path = entry.path();
+        if file_type.is_dir() {
+            let name = entry.file_name();
+            let name = name.to_string_lossy();
+            if !name.starts_with('.') && name != "_build" {
+                discover_dir(&path, paths)?;
+            }
+        } else if file_type.is_file() && language_for_path(&path).is_some() {
+            paths.push(path);
+        }
+    }
+    Ok(())
+}
+
+#[derive(Clone, Debug)]
+pub struct Options {
+    /// The number of worker threads, all cores by default.
+    pub threads: usize,
+    /// The limits on the parse of every file, none by default.
+    pub budget: Budget,
+    /// Whether to measure the time spent recovering from errors. This logs
+    /// every action of the parser, which makes parsing several times slower
+    /// and counts against the time budget.
+    pub time_recovery: bool,
+    /// Whether every file is parsed in the [arena](crate::arena) of its
+    /// worker, with parsers of its own, instead of with the parsers of the
+    /// worker. Needs [`arena::install`](crate::arena::install).
+    #[cfg(feature = "arena")]
+    pub arena: bool,
+}
+
+impl Default for Options {
+    fn default() -> Self {
+        Options {
+            threads: thread::available_parallelism().map_or(1, |n| n.get()),
+            budget: Budget::default(),
+            time_recovery: false,
+            #[cfg(feature = "arena")]
+            arena: false,
+        }
+    }
+}
+
+/// The limits on the parse of a file, see [`parse_within`].
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Budget {
+    /// The longest the parse may take.
+    pub time: Option<Duration>,
+    /// The most nodes the tree may have, anonymous ones included.
+    pub nodes: Option<usize>,
+}
+
+/// The limit of a [`Budget`] that a parse went over.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Limit {
+    Time,
+    Nodes,
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum Status {
+    /// The tree has no errors.
+    Ok,
+    /// The tree has error or missing nodes.
+    Errors,
+    /// The parse went over its budget. The result has the items of the file
+    /// instead of the counts of its tree.
+    OverBudget(Limit),
+    /// The file couldn't be read or parsed.
+    Failed(String),
+}
+
+#[derive(Clone, Debug)]
+pub struct FileResult {
+    pub path: PathBuf,
+    pub status: Status,
+    pub bytes: usize,
+    /// The time spent parsing, without reading the file.
+    pub duration: Duration,
+    pub error_nodes: usize,
+    pub missing_nodes: usize,
+    /// The index of the worker that parsed the file.
+    pub worker: usize,
+    /// The time spent recovering from errors, with
+    /// [`Options::time_recovery`].
+    pub recovery: Duration,
+    /// The same time split by the lookahead symbol each error was detected
+    /// at, longest first.
+    pub recovery_by_lookahead: Vec<(String, Duration)>,
+    /// The top-level items of a file over budget, see [`skim`].
+    pub items: Vec<Range<usize>>,
+}
+
+/// Counts the error and missing nodes of a tree.
+pub fn count_errors(tree: &Tree) -> (usize, usize) {
+    let (mut errors, mut missing) = (0, 0);
+    if !tree.root_node().has_error() {
+        return (0, 0);
+    }
+    let mut cursor = tree.walk();
+    loop {
+        let node = cursor.node();
+        if node.is_error() {
+            errors += 1;
+        } else if node.is_missing() {
+            missing += 1;
+        }
+        // Only subtrees with errors in them are worth entering.
+        if (node.has_error() && cursor.goto_first_child()) || cursor.goto_next_sibling() {
+            continue;
+        }
+        loop {
+            if !cursor.goto_parent() {
+                return (errors, missing);
+            }
+            if cursor.goto_next_sibling() {
+                break;
+            }
+        }
+    }
+}
+
+/// Parses `text` with `parser`, giving up when the parse takes longer than
+/// `budget.time` or the tree has more than `budget.nodes` nodes. The time is
+/// enforced with the timeout of the parser, and the nodes are counted once the
+/// tree is built, up to the limit. Either way the parser is left ready for the
+/// next parse.
+pub fn parse_within(parser: &mut Parser, text: &[u8], budget: &Budget) -> Result<Tree, Limit> {
+    // A timeout of 0 means none.
+    let timeout = budget
+        .time
+        .map_or(0, |time| (time.as_micros() as u64).max(1));
+    parser.set_timeout_micros(timeout);
+    let tree = parser.parse(text, None);
+    parser.set_timeout_micros(0);
+    let tree = match tree {
+        Some(tree) => tree,
+        None => {
+            // Otherwise the next parse would resume this one.
+            parser.reset();
+            return Err(Limit::Time);
+        }
+    };
+    match budget.nodes {
+        Some(nodes) if has_more_nodes(&tree, nodes) => Err(Limit::Nodes),
+        _ => Ok(tree),
+    }
+}
+
+/// Whether a tree has more than `limit` nodes, anonymous ones included.
+fn has_more_nodes(tree: &Tree, limit: usize) -> bool {
+    let mut cursor = tree.walk();
+    let mut count = 1;
+    loop {
+        if count > limit {
+            return true;
+        }
+        if cursor.goto_first_child() || cursor.goto_next_sibling() {
+            count += 1;
+            continue;
+        }
+        loop {
+            if !cursor.goto_parent() {
+                return false;
+            }
+            if cursor.goto_next_sibling() {
+                count += 1;
+                break;
+            }
+        }
+    }
+}
+
+/// The keywords that start the top-level items [`skim`] looks for.
+const ITEM_KEYWORDS: &[&[u8]] = &[
+    b"class",
+    b"exception",
+    b"external",
+    b"include",
+    b"let",
+    b"module",
+    b"open",
+    b"type",
+    b"val",
+];
+
+/// Finds the top-level items of a file without parsing it: an item starts on
+/// a line that starts with one of the keywords of structure and signature
+/// items, and ends where the next one starts. Lines like that inside comments
+/// and strings split items where they shouldn't, which is the price of
+/// looking at every byte only once.
+pub fn skim(text: &[u8]) -> Vec<Range<usize>> {
+    let mut starts = Vec::new();
+    let mut line = 0;
+    while line < text.len() {
+        let rest = &text[line..];
+        let is_item = ITEM_KEYWORDS.iter().any(|keyword| {
+            rest.starts_with(keyword)
+                && rest.get(keyword.len()).map_or(true, |&c| {
+                    !(c.is_ascii_alphanumeric() || c == b'_' || c == b'\'')
+                })
+        });
+        if is_item {
+            starts.push(line);
+        }
+        line = match rest.iter().position(|&c| c == b'\n') {
+            Some(end) => line + end + 1,
+            None => text.len(),
+        };
+    }
+    let ends = starts.iter().skip(1).copied().chain(Some(text.len()));
+    starts
+        .iter()
+        .zip(ends)
+        .map(|(&start, end)| start..end)
+        .collect()
+}
+
+/// Times the recoveries of a parse from the log of the parser. A recovery
+/// starts when an error is detected and ends at the next regular shift. With
+/// several stack versions, a shift on another version can end it early, so the
+/// times are a lower bound.
+#[derive(Default)]
+struct RecoveryLog {
+    /// The last symbol the lexer returned.
+    lookahead: String,
+    /// The start of the recovery in progress and its lookahead.
+    current: Option<(Instant, String)>,
+    by_lookahead: HashMap<String, Duration>,
+}
+
+impl RecoveryLog {
+    fn log(&mut self, message: &str) {
+        if let Some(rest) = message.strip_prefix("lexed_lookahead sym:") {
+            let symbol = rest
+                .rsplit_once(", size:")
+                .map_or(rest, |(symbol, _)| symbol);
+            self.lookahead.clear();
+            self.lookahead.push_str(symbol);
+        } else if message == "detect_error" {
+            if self.current.is_none() {
+                self.current = Some((Instant::now(), self.lookahead.clone()));
+            }
+        } else if message.starts_with("shift state:") || message == "done" {
+            self.finish();
+        }
+    }
+
+    fn finish(&mut self) {
+        if let Some((start, symbol)) = self.current.take() {
+            *self.by_lookahead.entry(symbol).or_default() += start.elapsed();
+        }
+    }
+
+    /// The times by lookahead, longest first.
+    fn into_times(mut self) -> Vec<(String, Duration)> {
+        self.finish();
+        let mut times: Vec<_> = self.by_lookahead.into_iter().collect();
+        times.sort_by(|a, b| b.1.cmp(&a.1).then_with(|| a.0.cmp(&b.0)));
+        times
+    }
+}
+
+struct Job {
+    path: PathBuf,
+    size: u64,
+}
+
+/// The per-worker queues. A worker takes the largest files from the front of
+/// its own queue and steals from the back of the others.
+struct Queues {
+    queues: Vec<Mutex<VecDeque<Job>>>,
+}
+
+impl Queues {
+    fn new(mut jobs: Vec<Job>, workers: usize) -> Queues {
+        jobs.sort_by(|a, b| b.size.cmp(&a.size));
+        let mut queues: Vec<VecDeque<Job>> = (0..workers).map(|_| VecDeque::new()).collect();
+        for (i, job) in jobs.into_iter().enumerate() {
+            queues[i % workers].push_back(job);
+        }
+        Queues {
+            queues: queues.into_iter().map(Mutex::new).collect(),
+        }
+    }
+
+    fn next(&self, worker: usize) -> Option<Job> {
+        if let Some(job) = self.queues[worker].lock().unwrap().pop_front() {
+            return Some(job);
+        }
+        let count = self.queues.len();
+        (1..count).find_map(|offset| {
+            self.queues[(worker + offset) % count]
+                .lock()
+                .unwrap()
+                .pop_back()
+        })
+    }
+}
+
+/// A worker's parsers, one per grammar, reused for all of its files.
+pub struct Parsers {
+    ocaml: Parser,
+    interface: Parser,
+}
+
+impl Parsers {
+    pub fn new() -> Parsers {
+        let mut ocaml = Parser::new();
+        ocaml.set_language(crate::language_ocaml()).unwrap();
+        let mut interface = Parser::new();
+        interface
+            .set_language(crate::language_ocaml_interface())
+            .unwrap();
+        Parsers { ocaml, interface }
+    }
+
+    /// Returns the parser for the grammar of a file.
+    pub fn for_path(&mut self, path: &Path) -> Option<&mut Parser> {
+        match path.extension()?.to_str()? {
+            "ml" => Some(&mut self.ocaml),
+            "mli" => Some(&mut self.interface),
+            _ => None,
+        }
+    }
+}
+
+impl Default for Parsers {
+    fn default() -> Self {
+        Parsers::new()
+    }
+}
+
+/// Parsers that can be borrowed from any thread, see [`ParserPool::get`].
+///
+/// ```
+/// use tree_sitter_ocaml::batch::ParserPool;
+/// use std::path::Path;
+///
+/// let tree = ParserPool::global()
+///     .parse(Path::new("a.ml"), b"let x = 0")
+///     .unwrap();
+/// assert!(!tree.root_node().has_error());
+/// ```
+pub struct ParserPool {
+    idle: Mutex<Vec<Parsers>>,
+}
+
+impl ParserPool {
+    pub const fn new() -> ParserPool {
+        ParserPool {
+            idle: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// The pool shared by the whole process, which the workers of
+    /// [`map_files`] also use.
+    pub fn global() -> &'static ParserPool {
+        static POOL: ParserPool = ParserPool::new();
+        &POOL
+    }
+
+    /// Takes parsers from the pool, or creates them if none are idle. They go
+    /// back to the pool when the guard is dropped.
+    pub fn get(&self) -> PooledParsers<'_> {
+        let parsers = self.idle.lock().unwrap().pop();
+        PooledParsers {
+            pool: self,
+            parsers: Some(parsers.unwrap_or_else(Parsers::new)),
+        }
+    }
+
+    /// Parses `text` with the grammar for `path`, with parsers from the pool.
+    /// Returns `None` if `path` isn't an `.ml` or `.mli` file.
+    pub fn parse(&self, path: &Path, text: &[u8]) -> Option<Tree> {
+        self.get().for_path(path)?.parse(text, None)
+    }
+
+    /// The number of idle parsers.
+    pub fn idle(&self) -> usize {
+        self.idle.lock().unwrap().len()
+    }
+}
+
+impl Default for ParserPool {
+    fn default() -> Self {
+        ParserPool::new()
+    }
+}
+
+/// Parsers borrowed from a [`ParserPool`].
+pub struct PooledParsers<'a> {
+    pool: &'a ParserPool,
+    parsers: Option<Parsers>,
+}
+
+impl Deref for PooledParsers<'_> {
+    type Target = Parsers;
+
+    fn deref(&self) -> &Parsers {
+        self.parsers.as_ref().unwrap()
+    }
+}
+
+impl DerefMut for PooledParsers<'_> {
+    fn deref_mut(&mut self) -> &mut Parsers {
+        self.parsers.as_mut().unwrap()
+    }
+}
+
+impl Drop for PooledParsers<'_> {
+    fn drop(&mut self) {
+        if let Some(mut parsers) = self.parsers.take() {
+            // A parse may have been cancelled half way through.
+            parsers.ocaml.reset();
+            parsers.interface.reset();
+            if let Ok(mut idle) = self.pool.idle.lock() {
+                idle.push(parsers);
+            }
+        }
+    }
+}
+
+fn parse_file(
+    parsers: &mut Parsers,
+    path: PathBuf,
+    worker: usize,
+    options: &Options,
+) -> FileResult {
+    let mut result = FileResult {
+        path,
+        status: Status::Ok,
+        bytes: 0,
+        duration: Duration::default(),
+        error_nodes: 0,
+        missing_nodes: 0,
+        worker,
+        recovery: Duration::default(),
+        recovery_by_lookahead: Vec::new(),
+        items: Vec::new(),
+    };
+    let parser = match parsers.for_path(&result.path) {
+        Some(parser) => parser,
+        None => {
+            result.status = Status::Failed("not an .ml or .mli file".to_string());
+            return result;
+        }
+    };
+    let text = match fs::read(&result.path) {
+        Ok(text) => text,
+        Err(error) => {
+            result.status = Status::Failed(error.to_string());
+            return result;
+        }
+    };
+    result.bytes = text.len();
+
+    let recovery_log = if options.time_recovery {
+        let log = Arc::new(Mutex::new(RecoveryLog::default()));
+        let logger_log = Arc::clone(&log);
+        parser.set_logger(Some(Box::new(move |log_type, message| {
+            if let LogType::Parse = log_type {
+                logger_log.lock().unwrap().log(message);
+            }
+        })));
+        Some(log)
+    } else {
+        None
+    };
+
+    let start = Instant::now();
+    let tree = parse_within(parser, &text, &options.budget);
+    result.duration = start.elapsed();
+
+    if let Some(log) = recovery_log {
+        // The parsers go back to the pool, without the logger.
+        parser.set_logger(None);
+        let log = std::mem::take(&mut *log.lock().unwrap());
+        result.recovery_by_lookahead = log.into_times();
+        result.recovery = result
+            .recovery_by_lookahead
+            .iter()
+            .map(|(_, time)| *time)
+            .sum();
+    }
+
+    match tree {
+        Ok(tree) => {
+            let (errors, missing) = count_errors(&tree);
+            result.error_nodes = errors;
+            result.missing_nodes = missing;
+            if tree.root_node().has_error() {
+                result.status = Status::Errors;
+            }
+        }
+        Err(limit) => {
+            result.status = Status::OverBudget(limit);
+            result.items = skim(&text);
+        }
+    }
+    result
+}
+
+/// Parses `paths` on `options.threads` threads, calling `on_result` on the
+/// calling thread for every file as soon as it has been parsed.
+pub fn parse_files<F>(paths: Vec<PathBuf>, options: &Options, on_result: F)
+where
+    F: FnMut(FileResult),
+{
+    map_files(
+        paths,
+        options,
+        |parsers, path, worker| parse_file(parsers, path, worker, options),
+        on_result,
+    );
+}
+
+/// Runs `work` on every file of `paths` on `options.threads` threads, and
+/// calls `on_result` on the calling thread with what it returns. `work` gets
+/// the parsers of the worker it runs on, which come from
+/// [`ParserPool::global`], or new parsers for every file with
+/// `Options::arena`, and the index of the worker.
+pub fn map_files<T, W, F>(paths: Vec<PathBuf>, options: &Options, work: W, mut on_result: F)
+where
+    T: Send,
+    W: Fn(&mut Parsers, PathBuf, usize) -> T + Sync,
+    F: FnMut(T),
+{
+    let workers = options.threads.max(1).min(paths.len().max(1));
+    let jobs = paths
+        .into_iter()
+        .map(|path| {
+            let size = fs::metadata(&path).map_or(0, |metadata| metadata.len());
+            Job { path, size }
+        })
+        .collect();
+    let queues = Queues::new(jobs, workers);
+    let (sender, receiver) = mpsc::channel();
+
+    thread::scope(|scope| {
+        for worker in 0..workers {
+            let queues = &queues;
+            let work = &work;
+            let sender = sender.clone();
+            scope.spawn(move || {
+                #[cfg(feature = "arena")]
+                if options.arena {
+                    while let Some(job) = queues.next(worker) {
+                        // Whatever the result keeps from the parsers or their
+                        // trees keeps the arena from being reset.
+                        let result =
+                            crate::arena::scope(|| work(&mut Parsers::new(), job.path, worker));
+                        if sender.send(result).is_err() {
+                            break;
+                        }
+                    }
+                    return;
+                }
+                let mut parsers = ParserPool::global().get();
+                while let Some(job) = queues.next(worker) {
+                    let result = work(&mut parsers, job.path, worker);
+                    if sender.send(result).is_err() {
+                        break;
+                    }
+                }
+            });
+        }
+        drop(sender);
+        for result in receiver {
+            on_result(result);
+        }
+    });
+}
@@ -0,0 +1,208 @@
+//! The system allocator against the arena over the example corpus.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --features arena --bench arena -- --output baseline.json
+//! ```
+//!
+//! `system` parses every file with one parser per grammar, as the workers of
+//! `batch` do, before the allocator of `arena` is installed. `arena` parses
+//! every file in an arena scope, with a parser of its own, and resets the
+//! arena after dropping the tree. The report gives the median throughput of
+//! both over `--repetitions` runs, split by `.ml` and `.mli`, and the calls to
+//! the allocator and the bytes asked for per KB of source, counted with the
+//! allocator installed, outside of a scope and in one. `--synthetic` uses the
+//! generated corpus even when the examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::Grammar;
+use serde_json::{json, Map, Value};
+use std::hint::black_box;
+use std::process;
+use std::time::Instant;
+use tree_sitter::Parser;
+use tree_sitter_ocaml::arena;
+
+struct Options {
+    repetitions: usize,
+    synthetic: bool,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        repetitions: 3,
+        synthetic: false,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--synthetic" => options.synthetic = true,
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options
+}
+
+/// Parses every source with one parser, returning the time it took in
+/// seconds.
+fn parse_shared(grammar: Grammar, sources: &[&[u8]]) -> f64 {
+    let mut parser = Parser::new();
+    parser.set_language(grammar.language()).unwrap();
+    let start = Instant::now();
+    for text in sources {
+        let tree = parser.parse(text, None).unwrap();
+        black_box(tree.root_node().child_count());
+    }
+    start.elapsed().as_secs_f64()
+}
+
+/// Parses every source in an arena scope, returning the time it took in
+/// seconds.
+fn parse_in_arena(grammar: Grammar, sources: &[&[u8]]) -> f64 {
+    let start = Instant::now();
+    for text in sources {
+        arena::scope(|| {
+            let mut parser = Parser::new();
+            parser.set_language(grammar.language()).unwrap();
+            let tree = parser.parse(text, None).unwrap();
+            black_box(tree.root_node().child_count());
+        });
+    }
+    start.elapsed().as_secs_f64()
+}
+
+fn median_mb_per_s(mb: f64, repetitions: usize, mut run: impl FnMut() -> f64) -> f64 {
+    let mut times: Vec<f64> = (0..repetitions).map(|_| run()).collect();
+    mb / common::median(&mut times)
+}
+
+fn allocation_stats(stats: arena::Stats, kb: f64) -> Value {
+    json!({
+        "allocations_per_kb": stats.allocations as f64 / kb,
+        "bytes_per_kb": stats.bytes as f64 / kb,
+        "arena_allocations": stats.arena_allocations,
+        "chunks": stats.chunks,
+        "chunk_bytes": stats.chunk_bytes,
+        "detached": stats.detached,
+    })
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("arena_mb_per_s", true), ("speedup", true)];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+    let sources = |grammar| -> Vec<&[u8]> {
+        corpus
+            .sources(grammar)
+            .map(|source| &source.text[..])
+            .collect()
+    };
+    let size = |sources: &[&[u8]]| sources.iter().map(|text| text.len()).sum::<usize>();
+
+    // The parsers and trees are all gone before the allocator is installed.
+    let mut system = Vec::new();
+    for &grammar in &Grammar::ALL {
+        let sources = sources(grammar);
+        let mb = size(&sources) as f64 / 1e6;
+        system.push(median_mb_per_s(mb, options.repetitions, || {
+            parse_shared(grammar, &sources)
+        }));
+    }
+    unsafe { arena::install() };
+
+    let mut results = Map::new();
+    for (&grammar, system_mb_per_s) in Grammar::ALL.iter().zip(system) {
+        let sources = sources(grammar);
+        let bytes = size(&sources);
+        let (mb, kb) = (bytes as f64 / 1e6, bytes as f64 / 1e3);
+
+        arena::take_stats();
+        parse_shared(grammar, &sources);
+        let system_stats = arena::take_stats();
+        parse_in_arena(grammar, &sources);
+        let arena_stats = arena::take_stats();
+        let arena_mb_per_s = median_mb_per_s(mb, options.repetitions, || {
+            parse_in_arena(grammar, &sources)
+        });
+
+        results.insert(
+            grammar.extension().to_string(),
+            json!({
+                "files": sources.len(),
+                "bytes": bytes,
+                "system_mb_per_s": system_mb_per_s,
+                "arena_mb_per_s": arena_mb_per_s,
+                "speedup": arena_mb_per_s / system_mb_per_s,
+                "system": allocation_stats(system_stats, kb),
+                "arena": allocation_stats(arena_stats, kb),
+            }),
+        );
+    }
+    let report = json!({
+        "corpus": corpus.name,
+        "repetitions": options.repetitions,
+        "results": results,
+    });
+
+    eprintln!(
+        "{:<5} {:>6} {:>10} {:>12} {:>11} {:>8} {:>12} {:>11}",
+        "", "files", "MB", "system MB/s", "arena MB/s", "speedup", "allocs/KB", "chunk MB"
+    );
+    for grammar in &Grammar::ALL {
+        let split = grammar.extension();
+        let result = &report["results"][split];
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<5} {:>6} {:>10.2} {:>12.2} {:>11.2} {:>7.2}x {:>12.1} {:>11.2}",
+            split,
+            result["files"],
+            number("bytes") / 1e6,
+            number("system_mb_per_s"),
+            number("arena_mb_per_s"),
+            number("speedup"),
+            result["system"]["allocations_per_kb"]
+                .as_f64()
+                .unwrap_or(f64::NAN),
+            result["arena"]["chunk_bytes"].as_f64().unwrap_or(f64::NAN) / 1e6,
+        );
+    }
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,181 @@
+//! Cold and warm starts over the example corpus with the tree cache.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --features cache --bench cache -- --output baseline.json
+//! ```
+//!
+//! `cold` parses every file and stores its tree in an empty cache, `warm`
+//! loads every tree from the cache, and `parse` is the parse alone. The report
+//! gives the throughput of each over the sources, split by `.ml` and `.mli`,
+//! and the size of the cached trees. `--synthetic` uses the generated corpus
+//! even when the examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use serde_json::{json, Map, Value};
+use std::fs;
+use std::process;
+use std::time::Instant;
+use tree_sitter::Parser;
+use tree_sitter_ocaml::compact::{self, TreeCache};
+
+struct Options {
+    synthetic: bool,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        synthetic: false,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--synthetic" => options.synthetic = true,
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options
+}
+
+fn compact_grammar(grammar: Grammar) -> compact::Grammar {
+    match grammar {
+        Grammar::Ocaml => compact::Grammar::Ocaml,
+        Grammar::Interface => compact::Grammar::Interface,
+    }
+}
+
+fn bench_grammar(corpus: &Corpus, grammar: Grammar) -> Value {
+    let sources: Vec<_> = corpus.sources(grammar).collect();
+    let bytes: usize = sources.iter().map(|source| source.text.len()).sum();
+    let dir = std::env::temp_dir().join(format!(
+        "tree-sitter-ocaml-cache-{}-{}",
+        std::process::id(),
+        grammar.extension()
+    ));
+    let _ = fs::remove_dir_all(&dir);
+    let cache = TreeCache::new(&dir);
+    let mut parser = Parser::new();
+    parser.set_language(grammar.language()).unwrap();
+
+    let start = Instant::now();
+    for source in &sources {
+        parser.parse(&source.text, None).unwrap();
+    }
+    let parse_time = start.elapsed().as_secs_f64();
+
+    let start = Instant::now();
+    let mut nodes = 0;
+    for source in &sources {
+        let tree = cache
+            .parse(&mut parser, compact_grammar(grammar), &source.text)
+            .unwrap();
+        nodes += tree.len();
+    }
+    let cold_time = start.elapsed().as_secs_f64();
+
+    let start = Instant::now();
+    for source in &sources {
+        cache
+            .get(compact_grammar(grammar), &source.text)
+            .expect("the tree should be cached");
+    }
+    let warm_time = start.elapsed().as_secs_f64();
+
+    let cache_bytes: u64 = fs::read_dir(&dir)
+        .unwrap()
+        .map(|entry| entry.unwrap().metadata().unwrap().len())
+        .sum();
+    fs::remove_dir_all(&dir).unwrap();
+
+    let mb = bytes as f64 / 1e6;
+    json!({
+        "files": sources.len(),
+        "bytes": bytes,
+        "nodes": nodes,
+        "parse_mb_per_s": mb / parse_time,
+        "cold_mb_per_s": mb / cold_time,
+        "warm_mb_per_s": mb / warm_time,
+        "cache_bytes": cache_bytes,
+        "cache_bytes_per_node": cache_bytes as f64 / nodes as f64,
+    })
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[
+    ("cold_mb_per_s", true),
+    ("warm_mb_per_s", true),
+    ("cache_bytes_per_node", false),
+];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+
+    let mut results = Map::new();
+    for &grammar in &Grammar::ALL {
+        results.insert(
+            grammar.extension().to_string(),
+            bench_grammar(&corpus, grammar),
+        );
+    }
+    let report = json!({
+        "corpus": corpus.name,
+        "results": results,
+    });
+
+    eprintln!(
+        "{:<5} {:>6} {:>10} {:>11} {:>10} {:>10} {:>11}",
+        "", "files", "MB", "parse MB/s", "cold MB/s", "warm MB/s", "bytes/node"
+    );
+    for grammar in &Grammar::ALL {
+        let split = grammar.extension();
+        let result = &report["results"][split];
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<5} {:>6} {:>10.2} {:>11.2} {:>10.2} {:>10.2} {:>11.2}",
+            split,
+            result["files"],
+            number("bytes") / 1e6,
+            number("parse_mb_per_s"),
+            number("cold_mb_per_s"),
+            number("warm_mb_per_s"),
+            number("cache_bytes_per_node"),
+        );
+    }
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
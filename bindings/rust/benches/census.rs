@@ -0,0 +1,466 @@
+//! A census of the nodes of the trees of the corpus, by node kind and by the
+//! rule of `ocaml/grammar.js` they come from, to see which rules the memory
+//! of long-lived trees goes to.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --bench census -- --output census.json
+//! # ... change the grammar ...
+//! cargo bench --bench census -- --baseline census.json
+//! ```
+//!
+//! The node API skips the hidden nodes: the `_expression` chains, the helper
+//! nodes that `repeat`, `sep1` and `repeat2` turn into, the tokens of strings
+//! and comments that aren't visible. So the trees are read from
+//! [`Tree::print_dot_graph`] instead, which has all of them. For every kind,
+//! the report gives the number of nodes, their memory, the source bytes they
+//! span with the whitespace before them and the histogram of their depths.
+//! Aliased nodes are counted under their alias.
+//!
+//! The memory is that of the subtrees in tree-sitter 0.20 on 64-bit targets:
+//! a node with children takes a header and a pointer per child, and a leaf
+//! takes nothing when it fits in a pointer, which it doesn't when it spans
+//! lines or 255 bytes. This leaves out a few rarer cases but is close enough
+//! to compare rules.
+//!
+//! The rules are the kinds with the `_repeatN` helpers counted under the rule
+//! they are in, and the anonymous tokens under the rule of their parent. The
+//! `--top` kinds and rules with the most memory are printed, and the report
+//! is written as JSON to `--output`, or to stdout.
+//!
+//! With `--baseline`, the kinds and rules whose memory changed the most since
+//! an earlier report are printed, and the benchmark fails if the nodes or
+//! memory per KB of source got worse by more than `--threshold` percent.
+//! `--synthetic` uses the generated corpus even when the examples are there.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use serde_json::{json, Map, Value};
+use std::collections::{BTreeMap, HashMap};
+use std::fs;
+use std::ops::Range;
+use std::process;
+use tree_sitter::{Language, Parser, Tree};
+
+/// The size of the header of a subtree on the heap, `SubtreeHeapData`.
+const HEADER_BYTES: usize = 80;
+
+/// The size of a pointer to a child.
+const CHILD_BYTES: usize = 8;
+
+/// Leaves at least this long are put on the heap.
+const INLINE_LIMIT: usize = 255;
+
+struct Options {
+    synthetic: bool,
+    top: usize,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        synthetic: false,
+        top: 20,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--synthetic" => options.synthetic = true,
+            "--top" => options.top = value(&arg).parse().unwrap(),
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options
+}
+
+/// A node of a tree, hidden or not, in the order of the dot graph.
+struct Subtree {
+    kind: String,
+    range: Range<usize>,
+    parent: Option<usize>,
+    children: usize,
+}
+
+/// Reads every subtree of `tree` from its dot graph, parents before their
+/// children.
+#[cfg(unix)]
+fn subtrees(tree: &Tree) -> Vec<Subtree> {
+    let path = std::env::temp_dir().join(format!("tree-sitter-ocaml-census-{}.dot", process::id()));
+    let file = fs::File::create(&path).unwrap();
+    tree.print_dot_graph(&file);
+    drop(file);
+    let graph = fs::read_to_string(&path).unwrap();
+    fs::remove_file(&path).unwrap();
+    parse_dot_graph(&graph)
+}
+
+#[cfg(not(unix))]
+fn subtrees(_tree: &Tree) -> Vec<Subtree> {
+    eprintln!("The census needs Tree::print_dot_graph, which is only there on Unix");
+    process::exit(2);
+}
+
+/// Parses the output of `ts_subtree_print_dot_graph`: a statement per node,
+/// `tree_ID [label="KIND", ..., tooltip="range: START - END\n..."]`, whose
+/// tooltip spans lines, and one per edge, `tree_ID -> tree_ID [tooltip=N]`.
+fn parse_dot_graph(graph: &str) -> Vec<Subtree> {
+    let mut subtrees: Vec<Subtree> = Vec::new();
+    let mut ids: HashMap<&str, usize> = HashMap::new();
+    let mut rest = graph;
+    while let Some(start) = rest.find("tree_") {
+        rest = &rest[start..];
+        let id_end = rest.find(' ').unwrap();
+        let id = &rest[..id_end];
+        rest = &rest[id_end + 1..];
+
+        if let Some(edge) = rest.strip_prefix("-> ") {
+            let child = &edge[..edge.find(' ').unwrap()];
+            let (parent, child) = (ids[id], ids[child]);
+            subtrees[parent].children += 1;
+            subtrees[child].parent = Some(parent);
+            rest = &edge[edge.find('\n').unwrap()..];
+            continue;
+        }
+
+        // The label escapes quotes and backslashes.
+        rest = rest.strip_prefix("[label=\"").unwrap();
+        let mut kind = String::new();
+        let mut chars = rest.char_indices();
+        let label_end = loop {
+            match chars.next().unwrap() {
+                (_, '\\') => match chars.next().unwrap().1 {
+                    'n' => kind.push('\n'),
+                    't' => kind.push('\t'),
+                    c => kind.push(c),
+                },
+                (i, '"') => break i,
+                (_, c) => kind.push(c),
+            }
+        };
+        rest = &rest[label_end..];
+        let range = &rest[rest.find("range: ").unwrap() + "range: ".len()..];
+        let mut numbers = range
+            .split(|c: char| !c.is_ascii_digit())
+            .filter(|number| !number.is_empty())
+            .map(|number| number.parse::<usize>().unwrap());
+        let start = numbers.next().unwrap();
+        let end = numbers.next().unwrap();
+        rest = &rest[rest.find("\"]\n").unwrap()..];
+
+        ids.insert(id, subtrees.len());
+        subtrees.push(Subtree {
+            kind,
+            range: start..end,
+            parent: None,
+            children: 0,
+        });
+    }
+    subtrees
+}
+
+/// The memory a subtree takes, its children aside.
+fn memory(subtree: &Subtree, text: &[u8]) -> usize {
+    if subtree.children > 0 {
+        return HEADER_BYTES + CHILD_BYTES * subtree.children;
+    }
+    // The range starts with the whitespace before the leaf.
+    let bytes = &text[subtree.range.clone()];
+    let start = bytes
+        .iter()
+        .position(|c| !c.is_ascii_whitespace())
+        .unwrap_or(bytes.len());
+    let bytes = &bytes[start..];
+    if bytes.len() >= INLINE_LIMIT || bytes.contains(&b'\n') {
+        HEADER_BYTES
+    } else {
+        0
+    }
+}
+
+/// The rule of `ocaml/grammar.js` that made `subtrees[index]`.
+fn rule<'a>(subtrees: &'a [Subtree], index: usize, language: Language) -> &'a str {
+    let subtree = &subtrees[index];
+    if subtree.children == 0 && language.id_for_node_kind(&subtree.kind, true) == 0 {
+        if let Some(parent) = subtree.parent {
+            return rule(subtrees, parent, language);
+        }
+    }
+    match subtree.kind.rfind("_repeat") {
+        Some(i)
+            if subtree.kind[i + "_repeat".len()..]
+                .bytes()
+                .all(|c| c.is_ascii_digit()) =>
+        {
+            &subtree.kind[..i]
+        }
+        _ => &subtree.kind,
+    }
+}
+
+#[derive(Default)]
+struct Count {
+    nodes: usize,
+    memory_bytes: usize,
+    source_bytes: usize,
+    /// The number of nodes at each depth.
+    depths: Vec<usize>,
+}
+
+impl Count {
+    fn add(&mut self, memory: usize, source: usize, depth: usize) {
+        self.nodes += 1;
+        self.memory_bytes += memory;
+        self.source_bytes += source;
+        if self.depths.len() <= depth {
+            self.depths.resize(depth + 1, 0);
+        }
+        self.depths[depth] += 1;
+    }
+
+    /// The depth below which half the nodes are.
+    fn median_depth(&self) -> usize {
+        let mut seen = 0;
+        for (depth, &count) in self.depths.iter().enumerate() {
+            seen += count;
+            if seen * 2 >= self.nodes {
+                return depth;
+            }
+        }
+        0
+    }
+
+    fn to_json(&self) -> Value {
+        json!({
+            "nodes": self.nodes,
+            "memory_bytes": self.memory_bytes,
+            "source_bytes": self.source_bytes,
+            "depths": self.depths,
+        })
+    }
+}
+
+struct Census {
+    result: Value,
+    kinds: BTreeMap<String, Count>,
+    rules: BTreeMap<String, Count>,
+}
+
+fn take_census(corpus: &Corpus, grammar: Grammar) -> Census {
+    let language = grammar.language();
+    let mut parser = Parser::new();
+    parser.set_language(language).unwrap();
+    let mut kinds: BTreeMap<String, Count> = BTreeMap::new();
+    let mut rules: BTreeMap<String, Count> = BTreeMap::new();
+    let mut total = Count::default();
+    let mut files = 0;
+    let mut bytes = 0;
+
+    for source in corpus.sources(grammar) {
+        files += 1;
+        bytes += source.text.len();
+        let tree = parser.parse(&source.text, None).unwrap();
+        let subtrees = subtrees(&tree);
+        let mut depths = Vec::with_capacity(subtrees.len());
+        for (index, subtree) in subtrees.iter().enumerate() {
+            let depth = subtree.parent.map_or(0, |parent| depths[parent] + 1);
+            depths.push(depth);
+            let memory = memory(subtree, &source.text);
+            let source_bytes = subtree.range.len();
+            kinds
+                .entry(subtree.kind.clone())
+                .or_default()
+                .add(memory, source_bytes, depth);
+            rules
+                .entry(rule(&subtrees, index, language).to_string())
+                .or_default()
+                .add(memory, source_bytes, depth);
+            total.add(memory, source_bytes, depth);
+        }
+    }
+
+    let kb = bytes as f64 / 1e3;
+    Census {
+        result: json!({
+            "files": files,
+            "bytes": bytes,
+            "nodes": total.nodes,
+            "memory_bytes": total.memory_bytes,
+            "nodes_per_kb": total.nodes as f64 / kb,
+            "memory_bytes_per_kb": total.memory_bytes as f64 / kb,
+            "max_depth": total.depths.len().saturating_sub(1),
+        }),
+        kinds,
+        rules,
+    }
+}
+
+fn counts_to_json(counts: &BTreeMap<String, Count>) -> Value {
+    Value::Object(
+        counts
+            .iter()
+            .map(|(name, count)| (name.clone(), count.to_json()))
+            .collect(),
+    )
+}
+
+/// Prints the `top` counts with the most memory.
+fn print_top(title: &str, counts: &BTreeMap<String, Count>, total_memory: usize, top: usize) {
+    let mut sorted: Vec<_> = counts.iter().collect();
+    sorted.sort_by_key(|(_, count)| std::cmp::Reverse(count.memory_bytes));
+    eprintln!(
+        "{:<40} {:>10} {:>12} {:>6} {:>12} {:>6} {:>6}",
+        title, "nodes", "memory", "%", "source", "depth", "max"
+    );
+    for (name, count) in sorted.into_iter().take(top) {
+        eprintln!(
+            "{:<40} {:>10} {:>12} {:>5.1}% {:>12} {:>6} {:>6}",
+            format!("{:?}", name),
+            count.nodes,
+            count.memory_bytes,
+            count.memory_bytes as f64 * 100.0 / total_memory.max(1) as f64,
+            count.source_bytes,
+            count.median_depth(),
+            count.depths.len().saturating_sub(1),
+        );
+    }
+}
+
+/// Prints the `top` entries of `counts` whose memory changed the most since
+/// `baseline`, which has the same shape as `counts_to_json`.
+fn print_changes(title: &str, counts: &BTreeMap<String, Count>, baseline: &Value, top: usize) {
+    let old = |name: &str, key: &str| baseline[name][key].as_u64().unwrap_or(0) as i64;
+    let mut names: Vec<&str> = counts.keys().map(String::as_str).collect();
+    if let Some(baseline) = baseline.as_object() {
+        names.extend(
+            baseline
+                .keys()
+                .map(String::as_str)
+                .filter(|name| !counts.contains_key(*name)),
+        );
+    }
+    let new = |name: &str, key: &str| {
+        counts.get(name).map_or(0, |count| match key {
+            "nodes" => count.nodes,
+            _ => count.memory_bytes,
+        }) as i64
+    };
+    let change = |name: &str| new(name, "memory_bytes") - old(name, "memory_bytes");
+    names.sort_by_key(|name| std::cmp::Reverse(change(name).abs()));
+
+    eprintln!(
+        "{:<40} {:>10} {:>10} {:>12} {:>12} {:>12}",
+        title, "nodes", "change", "memory", "baseline", "change"
+    );
+    for name in names.into_iter().take(top) {
+        if change(name) == 0 {
+            break;
+        }
+        eprintln!(
+            "{:<40} {:>10} {:>+10} {:>12} {:>12} {:>+12}",
+            format!("{:?}", name),
+            new(name, "nodes"),
+            new(name, "nodes") - old(name, "nodes"),
+            new(name, "memory_bytes"),
+            old(name, "memory_bytes"),
+            change(name),
+        );
+    }
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("nodes_per_kb", false), ("memory_bytes_per_kb", false)];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+    let baseline: Option<Value> = options.baseline.as_ref().map(|path| {
+        fs::read_to_string(path)
+            .ok()
+            .and_then(|text| serde_json::from_str(&text).ok())
+            .unwrap_or_else(|| {
+                eprintln!("Failed to read the baseline {}", path);
+                process::exit(2);
+            })
+    });
+
+    let mut results = Map::new();
+    let mut kinds = Map::new();
+    let mut rules = Map::new();
+    for &grammar in &Grammar::ALL {
+        let split = grammar.extension();
+        let census = take_census(&corpus, grammar);
+        let total_memory = census.result["memory_bytes"].as_u64().unwrap() as usize;
+
+        eprintln!();
+        eprintln!(
+            "{}: {} files, {} bytes, {} nodes, {} bytes of nodes",
+            split,
+            census.result["files"],
+            census.result["bytes"],
+            census.result["nodes"],
+            total_memory
+        );
+        eprintln!();
+        print_top("kind", &census.kinds, total_memory, options.top);
+        eprintln!();
+        print_top("rule", &census.rules, total_memory, options.top);
+        if let Some(baseline) = &baseline {
+            eprintln!();
+            print_changes(
+                "kind",
+                &census.kinds,
+                &baseline["kinds"][split],
+                options.top,
+            );
+            eprintln!();
+            print_changes(
+                "rule",
+                &census.rules,
+                &baseline["rules"][split],
+                options.top,
+            );
+        }
+
+        results.insert(split.to_string(), census.result);
+        kinds.insert(split.to_string(), counts_to_json(&census.kinds));
+        rules.insert(split.to_string(), counts_to_json(&census.rules));
+    }
+    let report = json!({
+        "corpus": corpus.name,
+        "results": results,
+        "kinds": kinds,
+        "rules": rules,
+    });
+
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,412 @@
+//! Shared setup for the benchmarks: the corpus, a few statistics helpers and
+//! the reports.
+//!
+//! The corpus is made of the example repositories cloned by
+//! `script/fetch-examples`, minus the files in `script/known_failures.txt`.
+//! When they haven't been fetched, a synthetic corpus is generated instead so
+//! the benchmarks can run offline.
+
+#![allow(dead_code)]
+
+use serde_json::Value;
+use std::fs;
+use std::io::{self, Write};
+use std::path::{Path, PathBuf};
+use std::process;
+use tree_sitter::Language;
+
+/// The grammar a source file is parsed with.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Grammar {
+    Ocaml,
+    Interface,
+}
+
+impl Grammar {
+    pub const ALL: [Grammar; 2] = [Grammar::Ocaml, Grammar::Interface];
+
+    pub fn for_path(path: &Path) -> Option<Grammar> {
+        match path.extension()?.to_str()? {
+            "ml" => Some(Grammar::Ocaml),
+            "mli" => Some(Grammar::Interface),
+            _ => None,
+        }
+    }
+
+    pub fn extension(self) -> &'static str {
+        match self {
+            Grammar::Ocaml => "ml",
+            Grammar::Interface => "mli",
+        }
+    }
+
+    pub fn language(self) -> Language {
+        match self {
+            Grammar::Ocaml => tree_sitter_ocaml::language_ocaml(),
+            Grammar::Interface => tree_sitter_ocaml::language_ocaml_interface(),
+        }
+    }
+}
+
+pub struct Source {
+    /// The path relative to the corpus root.
+    pub path: PathBuf,
+    pub grammar: Grammar,
+    pub text: Vec<u8>,
+}
+
+pub struct Corpus {
+    /// `examples` or `synthetic`.
+    pub name: &'static str,
+    pub sources: Vec<Source>,
+}
+
+impl Corpus {
+    pub fn sources(&self, grammar: Grammar) -> impl Iterator<Item = &Source> {
+        self.sources
+            .iter()
+            .filter(move |source| source.grammar == grammar)
+    }
+}
+
+pub fn root_dir() -> PathBuf {
+    PathBuf::from(env!("CARGO_MANIFEST_DIR"))
+}
+
+/// Loads the example repositories, or the synthetic corpus if there are none
+/// or `synthetic` is set.
+pub fn load(synthetic: bool) -> io::Result<Corpus> {
+    if !synthetic {
+        let corpus = load_examples(&root_dir().join("examples"))?;
+        if !corpus.sources.is_empty() {
+            return Ok(corpus);
+        }
+        eprintln!("No example files found, run script/fetch-examples to get them.");
+        eprintln!("Using the synthetic corpus instead.");
+    }
+    Ok(generate())
+}
+
+pub fn load_examples(dir: &Path) -> io::Result<Corpus> {
+    let known_failures =
+        fs::read_to_string(root_dir().join("script/known_failures.txt")).unwrap_or_default();
+    let known_failures: Vec<&Path> = known_failures
+        .split_whitespace()
+        .filter_map(|path| path.strip_prefix("examples/"))
+        .map(Path::new)
+        .collect();
+
+    let mut paths = Vec::new();
+    if dir.is_dir() {
+        find_sources(dir, &mut paths)?;
+    }
+    paths.sort();
+
+    let mut sources = Vec::new();
+    for path in paths {
+        let relative = path.strip_prefix(dir).unwrap().to_path_buf();
+        if known_failures.contains(&relative.as_path()) {
+            continue;
+        }
+        let grammar = Grammar::for_path(&path).unwrap();
+        let text = fs::read(&path)?;
+        sources.push(Source {
+            path: relative,
+            grammar,
+            text,
+        });
+    }
+    Ok(Corpus {
+        name: "examples",
+        sources,
+    })
+}
+
+fn find_sources(dir: &Path, paths: &mut Vec<PathBuf>) -> io::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        let path = entry.path();
+        if file_type.is_dir() {
+            if entry.file_name() != ".git" {
+                find_sources(&path, paths)?;
+            }
+        } else if file_type.is_file() && Grammar::for_path(&path).is_some() {
+            paths.push(path);
+        }
+    }
+    Ok(())
+}
+
+// Synthetic corpus
+//
+// Files are put together from snippets that exercise the scanner and the
+// larger grammar rules, with names varied by a fixed-seed generator so every
+// run sees the same bytes. File sizes are spread over two orders of magnitude
+// so that the latency percentiles mean something.
+
+const IMPLEMENTATION_SNIPPETS: &[&str] = &[
+    "let rec {n} acc = function\n  | [] -> List.rev acc\n  | x :: xs when x > 0 -> {n} (x :: acc) xs\n  | _ :: xs -> {n} acc xs\n\n",
+    "type {n} = {\n  name : string;\n  mutable count : int;\n  children : {n} list option;\n}\n\n",
+    "type {n} =\n  | Leaf of int\n  | Node of {n} * {n}\n  | Labelled of { label : string; value : {n} }\n  [@@deriving show]\n\n",
+    "module {N} = struct\n  type t = int\n  let compare = Int.compare\n  let pp ppf x = Format.fprintf ppf \"@[<2>{n}@ %d@]@.\" x\nend\n\n",
+    "module Make_{n} (X : Map.OrderedType) : sig\n  val find : X.t -> 'a list -> 'a option\nend = struct\n  let find _ _ = None\nend\n\n",
+    "let {n} ?(verbose = false) ~name x =\n  if verbose then Printf.printf \"%s: %-10s %5.2f\\n\" name \"value\" x;\n  x *. 2.0 +. float_of_int (String.length name)\n\n",
+    "(* {n}: nested (* comments *) with \"strings *)\" and {|quoted *)|} *)\nlet {n} = ()\n\n",
+    "(** [{n} x] documents {b something} and a character '\"'. *)\nlet {n} x = x\n\n",
+    "let {n} user = {html|<div class=\"user\">\n  <p>Hello ${user.name}, you have $Int{user.count} messages.</p>\n</div>|html}\n\n",
+    "let {n} = {sql|SELECT id, name FROM users WHERE id = $1 AND name LIKE '%x%'|sql}\n\n",
+    "class {n} init = object (self)\n  val mutable x = init\n  method get = x\n  method set y = x <- y; self#get\nend\n\n",
+    "let {n} () =\n  let open Lwt.Syntax in\n  let* x = Lwt.return 1 in\n  let+ y = Lwt.return (x + 1) in\n  y\n\n",
+    "let {n} = [%expr fun x -> x + 1] [@@inline]\n\n",
+    "let {n} = [| 1; 2; 3 |] |> Array.map (fun x -> x * x) |> Array.fold_left ( + ) 0\n\n",
+    "external {n} : int -> int = \"caml_{n}\" [@@noalloc]\n\n",
+    "exception {N} of string * int\n\nlet () = try raise ({N} (\"{n}\", 1)) with {N} (s, _) -> print_endline s\n\n",
+];
+
+const INTERFACE_SNIPPETS: &[&str] = &[
+    "val {n} : ?verbose:bool -> name:string -> float -> float\n(** [{n}] does something with {b bold} text. *)\n\n",
+    "type {n} = private {\n  name : string;\n  count : int;\n}\n\n",
+    "type 'a {n} =\n  | Leaf of 'a\n  | Node of 'a {n} * 'a {n}\n\n",
+    "module type {N} = sig\n  type t\n  val compare : t -> t -> int\n  val pp : Format.formatter -> t -> unit\nend\n\n",
+    "module Make_{n} (X : Map.OrderedType) : sig\n  type key = X.t\n  val find : key -> 'a list -> 'a option\nend\n\n",
+    "external {n} : int -> int = \"caml_{n}\" [@@noalloc]\n\n",
+    "class {n} : int -> object\n  method get : int\n  method set : int -> int\nend\n\n",
+    "(* {n}: nested (* comments *) and \"strings *)\" *)\nval {n} : unit -> unit\n\n",
+    "exception {N} of string * int\n\n",
+];
+
+/// A fixed-seed xorshift generator.
+pub struct Random(u64);
+
+impl Random {
+    pub fn new(seed: u64) -> Random {
+        Random(seed | 1)
+    }
+
+    pub fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    pub fn below(&mut self, bound: usize) -> usize {
+        (self.next() % bound as u64) as usize
+    }
+}
+
+fn synthetic_file(random: &mut Random, snippets: &[&str], size: usize) -> Vec<u8> {
+    let mut text = String::with_capacity(size + 512);
+    while text.len() < size {
+        let snippet = snippets[random.below(snippets.len())];
+        let name = format!("value_{}", random.below(100_000));
+        let module_name = format!("Module_{}", random.below(100_000));
+        text.push_str(&snippet.replace("{n}", &name).replace("{N}", &module_name));
+    }
+    text.into_bytes()
+}
+
+fn snippets(grammar: Grammar) -> &'static [&'static str] {
+    match grammar {
+        Grammar::Ocaml => IMPLEMENTATION_SNIPPETS,
+        Grammar::Interface => INTERFACE_SNIPPETS,
+    }
+}
+
+pub fn generate() -> Corpus {
+    let mut random = Random::new(0x6f63616d6c);
+    let mut sources = Vec::new();
+    for &(grammar, count) in &[(Grammar::Ocaml, 240), (Grammar::Interface, 120)] {
+        let snippets = snippets(grammar);
+        for i in 0..count {
+            // Mostly small files, with a tail of large ones.
+            let size = match random.below(20) {
+                0 => 64 * 1024 + random.below(192 * 1024),
+                1..=4 => 8 * 1024 + random.below(24 * 1024),
+                _ => 512 + random.below(6 * 1024),
+            };
+            sources.push(Source {
+                path: PathBuf::from(format!("synthetic/file_{}.{}", i, grammar.extension())),
+                grammar,
+                text: synthetic_file(&mut random, snippets, size),
+            });
+        }
+    }
+    Corpus {
+        name: "synthetic",
+        sources,
+    }
+}
+
+/// Writes a synthetic file of about `size` bytes to `path`, a piece at a time
+/// so that it is never all in memory.
+pub fn write_synthetic(path: &Path, grammar: Grammar, size: usize) -> io::Result<()> {
+    let mut random = Random::new(0x6d6170706564);
+    let mut out = io::BufWriter::new(fs::File::create(path)?);
+    let mut written = 0;
+    while written < size {
+        let piece = synthetic_file(&mut random, snippets(grammar), 64 * 1024);
+        out.write_all(&piece)?;
+        written += piece.len();
+    }
+    out.flush()
+}
+
+// Statistics
+
+/// Returns the value below which `fraction` of the sorted `values` fall.
+pub fn percentile(sorted: &[f64], fraction: f64) -> f64 {
+    if sorted.is_empty() {
+        return 0.0;
+    }
+    let index = ((sorted.len() - 1) as f64 * fraction).round() as usize;
+    sorted[index]
+}
+
+pub fn median(values: &mut [f64]) -> f64 {
+    values.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    percentile(values, 0.5)
+}
+
+/// Resets the peak resident set size of the process, where the platform
+/// supports it.
+pub fn reset_peak_rss() {
+    let _ = fs::write("/proc/self/clear_refs", "5");
+}
+
+/// Returns the peak resident set size of the process in bytes, where the
+/// platform reports it.
+pub fn peak_rss() -> Option<u64> {
+    proc_status_kb("VmHWM:").map(|kb| kb * 1024)
+}
+
+/// Returns the current resident set size of the process in bytes, where the
+/// platform reports it.
+pub fn current_rss() -> Option<u64> {
+    proc_status_kb("VmRSS:").map(|kb| kb * 1024)
+}
+
+fn proc_status_kb(key: &str) -> Option<u64> {
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|line| line.starts_with(key))?;
+    line[key.len()..]
+        .trim()
+        .trim_end_matches("kB")
+        .trim()
+        .parse()
+        .ok()
+}
+
+/// Counts the nodes of a tree, anonymous ones included.
+pub fn count_nodes(tree: &tree_sitter::Tree) -> usize {
+    let mut cursor = tree.walk();
+    let mut count = 1;
+    loop {
+        if cursor.goto_first_child() || cursor.goto_next_sibling() {
+            count += 1;
+            continue;
+        }
+        loop {
+            if !cursor.goto_parent() {
+                return count;
+            }
+            if cursor.goto_next_sibling() {
+                count += 1;
+                break;
+            }
+        }
+    }
+}
+
+// Reports
+//
+// Every benchmark writes a JSON report whose `results` map a split of the
+// benchmark to its metrics, and can compare it with an earlier report.
+
+/// Prints how the metrics in `report` compare with `baseline`, returning the
+/// number of them that got worse by more than `threshold` percent. `metrics`
+/// lists the metrics to compare and whether higher is better for them.
+pub fn compare(
+    report: &Value,
+    baseline: &Value,
+    metrics: &[(&str, bool)],
+    threshold: f64,
+) -> usize {
+    if report["corpus"] != baseline["corpus"] {
+        eprintln!(
+            "warning: comparing the {} corpus with a baseline over the {} corpus",
+            report["corpus"], baseline["corpus"]
+        );
+    }
+
+    let splits = match report["results"].as_object() {
+        Some(results) => results.keys().cloned().collect::<Vec<_>>(),
+        None => return 0,
+    };
+
+    let mut regressions = 0;
+    eprintln!();
+    eprintln!(
+        "{:<24} {:<24} {:>14} {:>14} {:>9}",
+        "", "metric", "baseline", "current", "change"
+    );
+    for split in &splits {
+        for &(metric, higher_is_better) in metrics {
+            let (old, new) = match (
+                baseline["results"][split][metric].as_f64(),
+                report["results"][split][metric].as_f64(),
+            ) {
+                (Some(old), Some(new)) if old != 0.0 => (old, new),
+                _ => continue,
+            };
+            let change = (new - old) / old * 100.0;
+            let worse = if higher_is_better { -change } else { change };
+            let flag = if worse > threshold {
+                regressions += 1;
+                "  REGRESSION"
+            } else {
+                ""
+            };
+            eprintln!(
+                "{:<24} {:<24} {:>14.3} {:>14.3} {:>+8.1}%{}",
+                split, metric, old, new, change, flag
+            );
+        }
+    }
+    regressions
+}
+
+/// Writes `report` to `output`, or to stdout, and compares it with the report
+/// at `baseline` if there is one. Exits with status 1 if a metric regressed.
+pub fn finish(
+    report: &Value,
+    output: Option<&str>,
+    baseline: Option<&str>,
+    metrics: &[(&str, bool)],
+    threshold: f64,
+) {
+    let json = serde_json::to_string_pretty(report).unwrap();
+    match output {
+        Some(path) => fs::write(path, json + "\n").unwrap(),
+        None => println!("{}", json),
+    }
+
+    if let Some(path) = baseline {
+        let baseline: Value = fs::read_to_string(path)
+            .ok()
+            .and_then(|text| serde_json::from_str(&text).ok())
+            .unwrap_or_else(|| {
+                eprintln!("Failed to read the baseline {}", path);
+                process::exit(2);
+            });
+        let regressions = compare(report, &baseline, metrics, threshold);
+        if regressions > 0 {
+            eprintln!(
+                "{} metrics regressed by more than {}%",
+                regressions, threshold
+            );
+            process::exit(1);
+        }
+    }
+}
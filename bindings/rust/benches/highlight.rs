@@ -0,0 +1,196 @@
+//! Highlighting the largest implementation in the corpus, from scratch and
+//! after an edit.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --bench highlight -- --output baseline.json
+//! ```
+//!
+//! `update` replaces a byte in the middle of the file and brings the highlights
+//! up to date from the changed ranges, reparse included; `reparse` is the
+//! reparse alone, for comparison. The report gives the median time of each in
+//! milliseconds over `--repetitions` runs. `--synthetic` uses the generated
+//! corpus even when the examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::Grammar;
+use serde_json::json;
+use std::hint::black_box;
+use std::process;
+use std::time::Instant;
+use tree_sitter::{InputEdit, Parser, Point, Tree};
+use tree_sitter_ocaml::highlight::Highlighter;
+
+struct Options {
+    repetitions: usize,
+    synthetic: bool,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        repetitions: 20,
+        synthetic: false,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--synthetic" => options.synthetic = true,
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options
+}
+
+fn position(text: &[u8], byte: usize) -> Point {
+    let row = text[..byte].iter().filter(|&&c| c == b'\n').count();
+    let line_start = text[..byte]
+        .iter()
+        .rposition(|&c| c == b'\n')
+        .map_or(0, |i| i + 1);
+    Point::new(row, byte - line_start)
+}
+
+/// Replaces the first byte of the span in the middle of the file.
+fn span_edit(text: &[u8], highlighter: &Highlighter) -> (Vec<u8>, InputEdit) {
+    let spans = highlighter.spans();
+    let start = spans[spans.len() / 2].range.start;
+    let mut edited = text.to_vec();
+    edited[start] = if edited[start] == b'z' { b'y' } else { b'z' };
+    let edit = InputEdit {
+        start_byte: start,
+        old_end_byte: start + 1,
+        new_end_byte: start + 1,
+        start_position: position(text, start),
+        old_end_position: position(text, start + 1),
+        new_end_position: position(text, start + 1),
+    };
+    (edited, edit)
+}
+
+/// The median time of `run` over `repetitions` runs in milliseconds. Each run
+/// gets a fresh input from `setup`, which isn't timed.
+fn median_ms<T, R>(
+    repetitions: usize,
+    mut setup: impl FnMut() -> T,
+    mut run: impl FnMut(T) -> R,
+) -> f64 {
+    let mut times: Vec<f64> = (0..repetitions)
+        .map(|_| {
+            let input = setup();
+            let start = Instant::now();
+            black_box(run(input));
+            start.elapsed().as_secs_f64() * 1e3
+        })
+        .collect();
+    common::median(&mut times)
+}
+
+fn edited_tree(tree: &Tree, edit: &InputEdit) -> Tree {
+    let mut tree = tree.clone();
+    tree.edit(edit);
+    tree
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("new_ms", false), ("update_ms", false)];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+    let source = corpus
+        .sources(Grammar::Ocaml)
+        .max_by_key(|source| source.text.len())
+        .unwrap();
+    let text = &source.text;
+    let lines = text.iter().filter(|&&c| c == b'\n').count();
+
+    let mut parser = Parser::new();
+    parser.set_language(Grammar::Ocaml.language()).unwrap();
+    let tree = parser.parse(text, None).unwrap();
+    let highlighter = Highlighter::new(&tree, text);
+    let (edited, edit) = span_edit(text, &highlighter);
+    let old_tree = edited_tree(&tree, &edit);
+
+    let repetitions = options.repetitions;
+    let new_ms = median_ms(repetitions, || (), |()| Highlighter::new(&tree, text));
+    let reparse_ms = median_ms(
+        repetitions,
+        || (),
+        |()| parser.parse(&edited, Some(&old_tree)).unwrap(),
+    );
+    let update_ms = median_ms(
+        repetitions,
+        || Highlighter::new(&tree, text),
+        |mut highlighter| {
+            highlighter.edit(&edit);
+            let new_tree = parser.parse(&edited, Some(&old_tree)).unwrap();
+            let diff = highlighter.update(&old_tree, &new_tree, &edited);
+            (highlighter, diff)
+        },
+    );
+
+    let report = json!({
+        "corpus": corpus.name,
+        "repetitions": repetitions,
+        "results": {
+            "highlight": {
+                "path": source.path.display().to_string(),
+                "lines": lines,
+                "spans": highlighter.spans().len(),
+                "injections": highlighter.injections().len(),
+                "new_ms": new_ms,
+                "reparse_ms": reparse_ms,
+                "update_ms": update_ms,
+            },
+        },
+    });
+
+    eprintln!(
+        "{}: {} lines, {} spans, {} injections",
+        source.path.display(),
+        lines,
+        highlighter.spans().len(),
+        highlighter.injections().len()
+    );
+    eprintln!(
+        "new {:.3} ms, reparse {:.3} ms, update {:.3} ms",
+        new_ms, reparse_ms, update_ms
+    );
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,150 @@
+//! Parse throughput and peak resident set size on one very large generated
+//! file, read into memory first or parsed straight from a memory map.
+//!
+//! ```sh
+//! cargo bench --features mmap --bench mapped -- --output baseline.json
+//! # ... change the input layer ...
+//! cargo bench --features mmap --bench mapped -- --baseline baseline.json
+//! ```
+//!
+//! The file is generated from the snippets of the synthetic corpus into
+//! `target/`, `--size` megabytes of it (100 by default), and kept for the next
+//! runs. Every mode parses it once after a reset of the peak resident set
+//! size, and the report gives the throughput, the resident set size before
+//! the parse and its peak during it. `read` reads the file into a `Vec` and
+//! `mapped` uses [`MappedFile`]. The tree is dropped after the peak is taken,
+//! so both peaks include it.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::Grammar;
+use serde_json::{json, Map, Value};
+use std::fs;
+use std::path::Path;
+use std::process;
+use std::time::Instant;
+use tree_sitter::{Parser, Tree};
+use tree_sitter_ocaml::mapped::MappedFile;
+
+struct Options {
+    size_mb: usize,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        size_mb: 100,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--size" => options.size_mb = value(&arg).parse().unwrap(),
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options
+}
+
+/// Parses the file at `path` with `parse`, and measures it.
+fn bench_mode(path: &Path, parse: impl FnOnce(&Path) -> Tree) -> Value {
+    let bytes = fs::metadata(path).unwrap().len();
+    common::reset_peak_rss();
+    let base_rss = common::current_rss();
+    let start = Instant::now();
+    let tree = parse(path);
+    let elapsed = start.elapsed().as_secs_f64();
+    let peak_rss = common::peak_rss();
+    let has_error = tree.root_node().has_error();
+    drop(tree);
+
+    json!({
+        "bytes": bytes,
+        "has_error": has_error,
+        "mb_per_s": bytes as f64 / 1e6 / elapsed,
+        "base_rss_bytes": base_rss,
+        "peak_rss_bytes": peak_rss,
+    })
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("mb_per_s", true), ("peak_rss_bytes", false)];
+
+fn main() {
+    let options = parse_options();
+    let size = options.size_mb * 1024 * 1024;
+    let path = common::root_dir().join(format!("target/mapped-{}mb.ml", options.size_mb));
+    if fs::metadata(&path).map_or(true, |metadata| (metadata.len() as usize) < size) {
+        eprintln!("Generating {}", path.display());
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        common::write_synthetic(&path, Grammar::Ocaml, size).unwrap();
+    }
+
+    let mut parser = Parser::new();
+    parser.set_language(Grammar::Ocaml.language()).unwrap();
+    let mut results = Map::new();
+    results.insert(
+        "read".to_string(),
+        bench_mode(&path, |path| {
+            let text = fs::read(path).unwrap();
+            parser.parse(&text, None).unwrap()
+        }),
+    );
+    results.insert(
+        "mapped".to_string(),
+        bench_mode(&path, |path| {
+            let file = MappedFile::open(path).unwrap();
+            file.parse(&mut parser, None).unwrap()
+        }),
+    );
+    let report = json!({
+        "corpus": "synthetic",
+        "size_mb": options.size_mb,
+        "results": results,
+    });
+
+    eprintln!(
+        "{:<7} {:>9} {:>10} {:>10}",
+        "", "MB/s", "base RSS", "peak RSS"
+    );
+    for mode in &["read", "mapped"] {
+        let result = &report["results"][mode];
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<7} {:>9.2} {:>9.1}M {:>9.1}M",
+            mode,
+            number("mb_per_s"),
+            number("base_rss_bytes") / (1024.0 * 1024.0),
+            number("peak_rss_bytes") / (1024.0 * 1024.0),
+        );
+    }
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
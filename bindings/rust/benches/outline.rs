@@ -0,0 +1,198 @@
+//! The outline grammar against the OCaml grammar over the `.ml` files of the
+//! corpus.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --features outline --bench outline -- --output baseline.json
+//! ```
+//!
+//! The report gives the throughput of both grammars and the size of their
+//! trees, and checks what the outline is for: the definitions found by
+//! `tags.scm` in the outline trees are compared with those in the full trees.
+//! `missing` counts the definitions of the full trees that the outline lacks,
+//! and `files_with_errors` the files whose outline has errors where the full
+//! tree has none. `--synthetic` uses the generated corpus even when the
+//! examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use serde_json::{json, Map, Value};
+use std::collections::HashSet;
+use std::process;
+use std::time::Instant;
+use tree_sitter::{Language, Node, Parser, Query, QueryCursor, Tree};
+
+struct Options {
+    synthetic: bool,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        synthetic: false,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--synthetic" => options.synthetic = true,
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options
+}
+
+/// Parses `sources` with `language`, returning the trees and the time it took
+/// in seconds.
+fn parse_all(language: Language, sources: &[&[u8]]) -> (Vec<Tree>, f64) {
+    let mut parser = Parser::new();
+    parser.set_language(language).unwrap();
+    let start = Instant::now();
+    let trees = sources
+        .iter()
+        .map(|text| parser.parse(text, None).unwrap())
+        .collect();
+    (trees, start.elapsed().as_secs_f64())
+}
+
+fn count_nodes(node: Node) -> usize {
+    let mut cursor = node.walk();
+    let mut count = 1;
+    for child in node.children(&mut cursor) {
+        count += count_nodes(child);
+    }
+    count
+}
+
+/// The definitions of `tree`, by kind, like `definition.function`, and name.
+fn definitions(query: &Query, tree: &Tree, text: &[u8]) -> HashSet<(String, String)> {
+    let names = query.capture_names();
+    let mut cursor = QueryCursor::new();
+    let mut definitions = HashSet::new();
+    for query_match in cursor.matches(query, tree.root_node(), text) {
+        let mut kind = None;
+        let mut name = None;
+        for capture in query_match.captures {
+            let capture_name = &names[capture.index as usize];
+            if capture_name == "name" {
+                name = capture.node.utf8_text(text).ok();
+            } else if capture_name.starts_with("definition.") {
+                kind = Some(capture_name);
+            }
+        }
+        if let (Some(kind), Some(name)) = (kind, name) {
+            definitions.insert((kind.clone(), name.to_string()));
+        }
+    }
+    definitions
+}
+
+fn bench(corpus: &Corpus) -> Value {
+    let sources: Vec<&[u8]> = corpus
+        .sources(Grammar::Ocaml)
+        .map(|source| &source.text[..])
+        .collect();
+    let bytes: usize = sources.iter().map(|text| text.len()).sum();
+
+    let (full_trees, full_time) = parse_all(tree_sitter_ocaml::language_ocaml(), &sources);
+    let (outline_trees, outline_time) =
+        parse_all(tree_sitter_ocaml::language_ocaml_outline(), &sources);
+
+    let mut full_nodes = 0;
+    let mut outline_nodes = 0;
+    let mut found = 0;
+    let mut missing = 0;
+    let mut files_with_errors = 0;
+    for ((full, outline), text) in full_trees.iter().zip(&outline_trees).zip(&sources) {
+        full_nodes += count_nodes(full.root_node());
+        outline_nodes += count_nodes(outline.root_node());
+        if outline.root_node().has_error() && !full.root_node().has_error() {
+            files_with_errors += 1;
+        }
+        let expected = definitions(tree_sitter_ocaml::queries::ocaml_tags(), full, text);
+        let actual = definitions(tree_sitter_ocaml::queries::outline_tags(), outline, text);
+        found += expected.intersection(&actual).count();
+        missing += expected.difference(&actual).count();
+    }
+
+    let mb = bytes as f64 / 1e6;
+    json!({
+        "files": sources.len(),
+        "bytes": bytes,
+        "full_mb_per_s": mb / full_time,
+        "outline_mb_per_s": mb / outline_time,
+        "speedup": full_time / outline_time,
+        "full_nodes": full_nodes,
+        "outline_nodes": outline_nodes,
+        "definitions": found + missing,
+        "missing": missing,
+        "files_with_errors": files_with_errors,
+    })
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("outline_mb_per_s", true), ("speedup", true)];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+
+    let result = bench(&corpus);
+    let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+    eprintln!(
+        "{} files, {:.2}MB: {:.2}MB/s full, {:.2}MB/s outline ({:.1}x)",
+        result["files"],
+        number("bytes") / 1e6,
+        number("full_mb_per_s"),
+        number("outline_mb_per_s"),
+        number("speedup"),
+    );
+    eprintln!(
+        "{} nodes full, {} outline; {} of {} definitions missing, {} files with new errors",
+        result["full_nodes"],
+        result["outline_nodes"],
+        result["missing"],
+        result["definitions"],
+        result["files_with_errors"],
+    );
+
+    let mut results = Map::new();
+    results.insert(Grammar::Ocaml.extension().to_string(), result);
+    let report = json!({
+        "corpus": corpus.name,
+        "results": results,
+    });
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,240 @@
+//! Parse throughput over the example corpus, split by `.ml` and `.mli`.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --bench parse -- --output baseline.json
+//! # ... change the grammar or the scanner ...
+//! cargo bench --bench parse -- --baseline baseline.json
+//! ```
+//!
+//! Every file is parsed `--repetitions` times and its median parse time kept.
+//! The report gives the throughput over the whole split, the p50 and p99 of
+//! the per-file times, the peak resident set size while parsing the split,
+//! nodes per KB of source and, with the `scanner-stats` feature, the calls to
+//! the external scanner. It is written as JSON to `--output`, or to stdout.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+//! `--synthetic` uses the generated corpus even when the examples are there.
+//!
+//! With `--timeout MS`, a parse that takes longer is cut off and the file
+//! counted in `files_over_budget`, with the timeout as its time, so that a
+//! pathological file bounds the percentiles instead of dominating them.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use serde_json::{json, Map, Value};
+use std::process;
+use std::time::{Duration, Instant};
+use tree_sitter::Parser;
+
+struct Options {
+    synthetic: bool,
+    repetitions: usize,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+    timeout: Option<Duration>,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        synthetic: false,
+        repetitions: 5,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+        timeout: None,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--synthetic" => options.synthetic = true,
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            "--timeout" => {
+                options.timeout = Some(Duration::from_millis(value(&arg).parse().unwrap()))
+            }
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options
+}
+
+/// Returns the calls to the external scanner and the tokens it returned since
+/// the last call, if the scanner counts them.
+#[cfg(feature = "scanner-stats")]
+fn take_scanner_stats(grammar: Grammar) -> Option<(u64, u64)> {
+    let stats = match grammar {
+        Grammar::Ocaml => tree_sitter_ocaml::scanner_stats::take_ocaml(),
+        Grammar::Interface => tree_sitter_ocaml::scanner_stats::take_ocaml_interface(),
+    };
+    Some((stats.scan_calls, stats.tokens))
+}
+
+#[cfg(not(feature = "scanner-stats"))]
+fn take_scanner_stats(_: Grammar) -> Option<(u64, u64)> {
+    None
+}
+
+fn bench_grammar(
+    corpus: &Corpus,
+    grammar: Grammar,
+    repetitions: usize,
+    timeout: Option<Duration>,
+) -> Value {
+    let mut parser = Parser::new();
+    parser.set_language(grammar.language()).unwrap();
+    parser.set_timeout_micros(timeout.map_or(0, |timeout| timeout.as_micros() as u64));
+    // A parse that timed out would otherwise be resumed by the next one.
+    let mut parse = |text: &[u8]| {
+        let tree = parser.parse(text, None);
+        if tree.is_none() {
+            parser.reset();
+        }
+        tree
+    };
+    let sources: Vec<_> = corpus.sources(grammar).collect();
+    let bytes: usize = sources.iter().map(|source| source.text.len()).sum();
+
+    common::reset_peak_rss();
+    let base_rss = common::current_rss();
+
+    // A first pass that isn't timed, for the counts.
+    take_scanner_stats(grammar);
+    let mut nodes = 0;
+    let mut files_with_errors = 0;
+    let mut files_over_budget = 0;
+    for source in &sources {
+        let tree = match parse(&source.text) {
+            Some(tree) => tree,
+            None => {
+                files_over_budget += 1;
+                continue;
+            }
+        };
+        nodes += common::count_nodes(&tree);
+        if tree.root_node().has_error() {
+            files_with_errors += 1;
+        }
+    }
+    let scanner_stats = take_scanner_stats(grammar);
+
+    let mut times = vec![Vec::with_capacity(repetitions); sources.len()];
+    for _ in 0..repetitions {
+        for (source, times) in sources.iter().zip(&mut times) {
+            let start = Instant::now();
+            let tree = parse(&source.text);
+            times.push(start.elapsed().as_secs_f64());
+            drop(tree);
+        }
+    }
+    let peak_rss = common::peak_rss();
+
+    let mut file_times: Vec<f64> = times
+        .iter_mut()
+        .map(|times| common::median(times))
+        .collect();
+    let total_time: f64 = file_times.iter().sum();
+    file_times.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    let kb = bytes as f64 / 1024.0;
+
+    json!({
+        "files": sources.len(),
+        "bytes": bytes,
+        "files_with_errors": files_with_errors,
+        "files_over_budget": files_over_budget,
+        "mb_per_s": if total_time > 0.0 { bytes as f64 / 1e6 / total_time } else { 0.0 },
+        "p50_ms": common::percentile(&file_times, 0.5) * 1e3,
+        "p99_ms": common::percentile(&file_times, 0.99) * 1e3,
+        "base_rss_bytes": base_rss,
+        "peak_rss_bytes": peak_rss,
+        "nodes": nodes,
+        "nodes_per_kb": nodes as f64 / kb,
+        "scan_calls": scanner_stats.map(|(calls, _)| calls),
+        "scan_calls_per_kb": scanner_stats.map(|(calls, _)| calls as f64 / kb),
+        "scanner_tokens": scanner_stats.map(|(_, tokens)| tokens),
+    })
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[
+    ("mb_per_s", true),
+    ("p50_ms", false),
+    ("p99_ms", false),
+    ("peak_rss_bytes", false),
+    ("nodes_per_kb", false),
+    ("scan_calls_per_kb", false),
+];
+
+fn print_summary(report: &Value) {
+    eprintln!(
+        "{:<5} {:>6} {:>10} {:>9} {:>9} {:>9} {:>10} {:>9} {:>10}",
+        "", "files", "MB", "MB/s", "p50 ms", "p99 ms", "peak RSS", "nodes/KB", "scans/KB"
+    );
+    for grammar in &Grammar::ALL {
+        let split = grammar.extension();
+        let result = &report["results"][split];
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<5} {:>6} {:>10.2} {:>9.2} {:>9.3} {:>9.3} {:>9.1}M {:>9.1} {:>10.1}",
+            split,
+            result["files"],
+            number("bytes") / 1e6,
+            number("mb_per_s"),
+            number("p50_ms"),
+            number("p99_ms"),
+            number("peak_rss_bytes") / (1024.0 * 1024.0),
+            number("nodes_per_kb"),
+            number("scan_calls_per_kb"),
+        );
+    }
+}
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+
+    let mut results = Map::new();
+    for &grammar in &Grammar::ALL {
+        results.insert(
+            grammar.extension().to_string(),
+            bench_grammar(&corpus, grammar, options.repetitions, options.timeout),
+        );
+    }
+    let report = json!({
+        "corpus": corpus.name,
+        "repetitions": options.repetitions,
+        "timeout_ms": options.timeout.map(|timeout| timeout.as_secs_f64() * 1e3),
+        "scanner_stats": cfg!(feature = "scanner-stats"),
+        "results": results,
+    });
+
+    print_summary(&report);
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,329 @@
+//! The cost of every pattern of the bundled queries over the corpus.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --bench patterns -- --output baseline.json
+//! # ... rewrite a pattern ...
+//! cargo bench --bench patterns -- --baseline baseline.json
+//! ```
+//!
+//! The report has a split per grammar and query, like `ml/tags`, with the
+//! median time to run the whole query over the trees of the corpus, and for
+//! every pattern of the query:
+//!
+//! - `ms`: the median time to run the pattern alone over the same trees;
+//! - `attempts`: the matches of the pattern before its text predicates, like
+//!   `#eq?` and `#match?`, filter them out. They are counted by running the
+//!   pattern with its predicates removed;
+//! - `matches` and `captures`: what the predicates leave.
+//!
+//! The `#strip!` of `tags.scm` isn't run by the query cursor but by
+//! `tree-sitter-tags`, on every doc comment it captures, so its regex is
+//! applied to the `@doc` captures within the time of the pattern and of the
+//! query. A pattern run alone still walks the whole tree, so the times of the
+//! patterns add up to more than that of the query.
+//!
+//! The `--top` slowest patterns of every split are printed with their line in
+//! the query. `--query NAME` only runs one query, and `--synthetic` uses the
+//! generated corpus even when the examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a query got slower by more than `--threshold` percent.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use regex::Regex;
+use serde_json::{json, Map, Value};
+use std::hint::black_box;
+use std::process;
+use std::time::Instant;
+use tree_sitter::{Parser, Query, QueryCursor, QueryPredicateArg, Tree};
+
+struct Options {
+    repetitions: usize,
+    synthetic: bool,
+    query: Option<String>,
+    top: usize,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        repetitions: 3,
+        synthetic: false,
+        query: None,
+        top: 10,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--synthetic" => options.synthetic = true,
+            "--query" => options.query = Some(value(&arg)),
+            "--top" => options.top = value(&arg).parse().unwrap(),
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options
+}
+
+const QUERIES: &[(&str, &str)] = &[
+    ("highlights", tree_sitter_ocaml::HIGHLIGHTS_QUERY),
+    ("injections", tree_sitter_ocaml::INJECTIONS_QUERY),
+    ("locals", tree_sitter_ocaml::LOCALS_QUERY),
+    ("tags", tree_sitter_ocaml::TAGGING_QUERY),
+];
+
+/// A query, or one of its patterns, ready to be run.
+struct Runnable {
+    query: Query,
+    /// The regexes of the `#strip!` predicates, by capture.
+    strips: Vec<(u32, Regex)>,
+}
+
+impl Runnable {
+    fn new(grammar: Grammar, source: &str) -> Runnable {
+        let query = Query::new(grammar.language(), source).expect("invalid query");
+        let mut strips = Vec::new();
+        for pattern in 0..query.pattern_count() {
+            for predicate in query.general_predicates(pattern) {
+                if let (
+                    "strip!",
+                    [QueryPredicateArg::Capture(capture), QueryPredicateArg::String(regex)],
+                ) = (&*predicate.operator, &predicate.args[..])
+                {
+                    strips.push((*capture, Regex::new(regex).unwrap()));
+                }
+            }
+        }
+        Runnable { query, strips }
+    }
+
+    /// Runs the query over `trees`, returning the time it took in seconds and
+    /// the number of matches and captures.
+    fn run(&self, trees: &[(Tree, &[u8])]) -> (f64, usize, usize) {
+        let mut cursor = QueryCursor::new();
+        let mut matches = 0;
+        let mut captures = 0;
+        let start = Instant::now();
+        for (tree, text) in trees {
+            for query_match in cursor.matches(&self.query, tree.root_node(), *text) {
+                matches += 1;
+                captures += query_match.captures.len();
+                for capture in query_match.captures {
+                    for (index, regex) in &self.strips {
+                        if capture.index == *index {
+                            let doc = capture.node.utf8_text(text).unwrap_or("");
+                            black_box(regex.replace_all(doc, ""));
+                        }
+                    }
+                }
+            }
+        }
+        (start.elapsed().as_secs_f64(), matches, captures)
+    }
+
+    /// The median time of `repetitions` runs, in milliseconds, and the
+    /// number of matches and captures.
+    fn measure(&self, trees: &[(Tree, &[u8])], repetitions: usize) -> (f64, usize, usize) {
+        let mut counts = (0, 0);
+        let mut times: Vec<f64> = (0..repetitions)
+            .map(|_| {
+                let (time, matches, captures) = self.run(trees);
+                counts = (matches, captures);
+                time
+            })
+            .collect();
+        (common::median(&mut times) * 1e3, counts.0, counts.1)
+    }
+}
+
+/// `source` without the predicates of its patterns, the parenthesized forms
+/// that start with `#`.
+fn without_predicates(source: &str) -> String {
+    let mut result = String::with_capacity(source.len());
+    let mut chars = source.chars().peekable();
+    // The depth of the predicate being skipped, if any.
+    let mut skipping = 0;
+    while let Some(c) = chars.next() {
+        match c {
+            ';' => {
+                for c in chars.by_ref() {
+                    if c == '\n' {
+                        break;
+                    }
+                }
+                result.push('\n');
+                continue;
+            }
+            '"' => {
+                let mut string = String::from('"');
+                while let Some(c) = chars.next() {
+                    string.push(c);
+                    if c == '\\' {
+                        string.extend(chars.next());
+                    } else if c == '"' {
+                        break;
+                    }
+                }
+                if skipping == 0 {
+                    result.push_str(&string);
+                }
+                continue;
+            }
+            '(' if skipping > 0 => skipping += 1,
+            '(' if chars.peek() == Some(&'#') => skipping = 1,
+            ')' if skipping > 0 => skipping -= 1,
+            _ if skipping == 0 => result.push(c),
+            _ => {}
+        }
+    }
+    result
+}
+
+fn profile(grammar: Grammar, source: &str, trees: &[(Tree, &[u8])], repetitions: usize) -> Value {
+    let whole = Runnable::new(grammar, source);
+    let (ms, matches, captures) = whole.measure(trees, repetitions);
+    let bytes: usize = trees.iter().map(|(_, text)| text.len()).sum();
+
+    let count = whole.query.pattern_count();
+    let patterns: Vec<Value> = (0..count)
+        .map(|index| {
+            let start = whole.query.start_byte_for_pattern(index);
+            let end = if index + 1 < count {
+                whole.query.start_byte_for_pattern(index + 1)
+            } else {
+                source.len()
+            };
+            let pattern = &source[start..end];
+            let alone = Runnable::new(grammar, pattern);
+            let (ms, matches, captures) = alone.measure(trees, repetitions);
+            let attempts = if pattern.contains("(#") {
+                let bare = without_predicates(pattern);
+                Runnable {
+                    query: Query::new(grammar.language(), &bare).expect("invalid pattern"),
+                    strips: Vec::new(),
+                }
+                .run(trees)
+                .1
+            } else {
+                matches
+            };
+            json!({
+                "index": index,
+                "line": source[..start].lines().count() + 1,
+                "pattern": pattern.lines().next().unwrap_or("").trim(),
+                "ms": ms,
+                "attempts": attempts,
+                "matches": matches,
+                "captures": captures,
+            })
+        })
+        .collect();
+
+    json!({
+        "ms": ms,
+        "mb_per_s": bytes as f64 / 1e6 / (ms / 1e3),
+        "matches": matches,
+        "captures": captures,
+        "patterns": patterns,
+    })
+}
+
+fn parse_all(corpus: &Corpus, grammar: Grammar) -> Vec<(Tree, &[u8])> {
+    let mut parser = Parser::new();
+    parser.set_language(grammar.language()).unwrap();
+    corpus
+        .sources(grammar)
+        .map(|source| {
+            let tree = parser.parse(&source.text, None).unwrap();
+            (tree, &source.text[..])
+        })
+        .collect()
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[("ms", false)];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+
+    let mut results = Map::new();
+    for &grammar in &Grammar::ALL {
+        let trees = parse_all(&corpus, grammar);
+        for &(name, source) in QUERIES {
+            if options
+                .query
+                .as_deref()
+                .map_or(false, |query| query != name)
+            {
+                continue;
+            }
+            let split = format!("{}/{}", grammar.extension(), name);
+            let result = profile(grammar, source, &trees, options.repetitions);
+
+            eprintln!();
+            eprintln!(
+                "{}: {:.2}ms, {} matches, {} captures",
+                split, result["ms"], result["matches"], result["captures"]
+            );
+            let mut patterns: Vec<&Value> = result["patterns"].as_array().unwrap().iter().collect();
+            patterns.sort_by(|a, b| b["ms"].as_f64().partial_cmp(&a["ms"].as_f64()).unwrap());
+            eprintln!(
+                "{:>6} {:>9} {:>10} {:>10} {:>10}  pattern",
+                "line", "ms", "attempts", "matches", "captures"
+            );
+            for pattern in patterns.into_iter().take(options.top) {
+                eprintln!(
+                    "{:>6} {:>9.2} {:>10} {:>10} {:>10}  {}",
+                    pattern["line"],
+                    pattern["ms"].as_f64().unwrap(),
+                    pattern["attempts"],
+                    pattern["matches"],
+                    pattern["captures"],
+                    pattern["pattern"].as_str().unwrap(),
+                );
+            }
+            results.insert(split, result);
+        }
+    }
+
+    let report = json!({
+        "corpus": corpus.name,
+        "repetitions": options.repetitions,
+        "results": results,
+    });
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
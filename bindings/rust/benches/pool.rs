@@ -0,0 +1,222 @@
+//! Parsing the corpus with pooled parsers compared with a fresh parser per
+//! file, on one thread and on all cores.
+//!
+//! ```sh
+//! script/fetch-examples
+//! cargo bench --features batch --bench pool -- --output baseline.json
+//! ```
+//!
+//! `fresh` creates a parser for every file, as a caller without a pool would,
+//! while `pooled` borrows one from a [`ParserPool`] that keeps it, and the
+//! memory it allocated, from one file to the next. The `parallel` variants
+//! split the files over all cores. The report gives the median throughput of
+//! each over `--repetitions` runs, split by `.ml` and `.mli`. `--synthetic`
+//! uses the generated corpus even when the examples are there.
+//!
+//! With `--baseline`, the results are compared with an earlier report and the
+//! benchmark fails if a metric got worse by more than `--threshold` percent.
+
+mod common;
+
+use common::{Grammar, Source};
+use serde_json::{json, Map};
+use std::hint::black_box;
+use std::path::Path;
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+use std::time::Instant;
+use tree_sitter::Parser;
+use tree_sitter_ocaml::batch::ParserPool;
+
+struct Options {
+    repetitions: usize,
+    synthetic: bool,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        repetitions: 5,
+        synthetic: false,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--synthetic" => options.synthetic = true,
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options
+}
+
+fn path_for(source: &Source) -> &'static Path {
+    match source.grammar {
+        Grammar::Ocaml => Path::new("a.ml"),
+        Grammar::Interface => Path::new("a.mli"),
+    }
+}
+
+fn parse_fresh(source: &Source) -> usize {
+    let mut parser = Parser::new();
+    parser.set_language(source.grammar.language()).unwrap();
+    let tree = parser.parse(&source.text, None).unwrap();
+    tree.root_node().child_count()
+}
+
+fn parse_pooled(pool: &ParserPool, source: &Source) -> usize {
+    let tree = pool.parse(path_for(source), &source.text).unwrap();
+    tree.root_node().child_count()
+}
+
+/// Parses all of `sources` on one thread.
+fn parse_serial(sources: &[&Source], parse: &dyn Fn(&Source) -> usize) -> usize {
+    sources.iter().map(|source| parse(source)).sum()
+}
+
+/// Parses all of `sources` on every core, with the files handed out one at a
+/// time.
+fn parse_parallel(sources: &[&Source], parse: &(dyn Fn(&Source) -> usize + Sync)) -> usize {
+    let next = AtomicUsize::new(0);
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut children = 0;
+                    while let Some(source) = sources.get(next.fetch_add(1, Ordering::Relaxed)) {
+                        children += parse(source);
+                    }
+                    children
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap())
+            .sum()
+    })
+}
+
+fn median_mb_per_s(mb: f64, repetitions: usize, mut run: impl FnMut() -> usize) -> f64 {
+    let mut times: Vec<f64> = (0..repetitions)
+        .map(|_| {
+            let start = Instant::now();
+            black_box(run());
+            start.elapsed().as_secs_f64()
+        })
+        .collect();
+    mb / common::median(&mut times)
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[
+    ("pooled_mb_per_s", true),
+    ("parallel_pooled_mb_per_s", true),
+];
+
+fn main() {
+    let options = parse_options();
+    let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+        eprintln!("Failed to load the corpus: {}", error);
+        process::exit(2);
+    });
+    let pool = ParserPool::new();
+    let pooled = |source: &Source| parse_pooled(&pool, source);
+
+    let mut results = Map::new();
+    for &grammar in &Grammar::ALL {
+        let sources: Vec<&Source> = corpus.sources(grammar).collect();
+        let bytes: usize = sources.iter().map(|source| source.text.len()).sum();
+        let mb = bytes as f64 / 1e6;
+        let repetitions = options.repetitions;
+
+        // Warm the pool up, so that every variant is measured in its steady
+        // state.
+        parse_parallel(&sources, &pooled);
+        let fresh = median_mb_per_s(mb, repetitions, || parse_serial(&sources, &parse_fresh));
+        let pooled_mb_per_s = median_mb_per_s(mb, repetitions, || parse_serial(&sources, &pooled));
+        let parallel_fresh =
+            median_mb_per_s(mb, repetitions, || parse_parallel(&sources, &parse_fresh));
+        let parallel_pooled =
+            median_mb_per_s(mb, repetitions, || parse_parallel(&sources, &pooled));
+
+        results.insert(
+            grammar.extension().to_string(),
+            json!({
+                "files": sources.len(),
+                "bytes": bytes,
+                "fresh_mb_per_s": fresh,
+                "pooled_mb_per_s": pooled_mb_per_s,
+                "parallel_fresh_mb_per_s": parallel_fresh,
+                "parallel_pooled_mb_per_s": parallel_pooled,
+                "speedup": pooled_mb_per_s / fresh,
+                "parallel_speedup": parallel_pooled / parallel_fresh,
+            }),
+        );
+    }
+    let report = json!({
+        "corpus": corpus.name,
+        "repetitions": options.repetitions,
+        "results": results,
+    });
+
+    eprintln!(
+        "{:<5} {:>6} {:>10} {:>11} {:>12} {:>8} {:>15} {:>16} {:>8}",
+        "",
+        "files",
+        "MB",
+        "fresh MB/s",
+        "pooled MB/s",
+        "speedup",
+        "par fresh MB/s",
+        "par pooled MB/s",
+        "speedup"
+    );
+    for grammar in &Grammar::ALL {
+        let split = grammar.extension();
+        let result = &report["results"][split];
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<5} {:>6} {:>10.2} {:>11.2} {:>12.2} {:>7.2}x {:>15.2} {:>16.2} {:>7.2}x",
+            split,
+            result["files"],
+            number("bytes") / 1e6,
+            number("fresh_mb_per_s"),
+            number("pooled_mb_per_s"),
+            number("speedup"),
+            number("parallel_fresh_mb_per_s"),
+            number("parallel_pooled_mb_per_s"),
+            number("parallel_speedup"),
+        );
+    }
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,208 @@
+//! Startup time spent compiling the queries, with and without sharing them.
+//!
+//! ```sh
+//! cargo bench --bench queries -- --output baseline.json
+//! cargo bench --bench queries -- --threads 16 --baseline baseline.json
+//! ```
+//!
+//! The report has a split per grammar and query with the median time to
+//! compile it, and a `startup` split that simulates `--threads` workers
+//! starting up and each getting all six queries:
+//!
+//! - `shared_ms`: wall time until every worker has the queries from
+//!   [`tree_sitter_ocaml::queries`], which compiles each of them once. This is
+//!   measured first, as the shared queries stay compiled afterwards;
+//! - `shared_warm_ns`: the time to get a query once it is compiled;
+//! - `private_ms`: wall time when every worker compiles its own queries, as
+//!   it had to with the query strings alone;
+//! - `private_cpu_ms`: the compile time summed over the workers, which is what
+//!   sharing saves, less one compilation of each query.
+
+mod common;
+
+use common::Grammar;
+use serde_json::{json, Map};
+use std::process;
+use std::thread;
+use std::time::Instant;
+use tree_sitter::Query;
+use tree_sitter_ocaml::queries;
+
+struct Options {
+    repetitions: usize,
+    threads: usize,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        repetitions: 10,
+        threads: thread::available_parallelism().map_or(1, |n| n.get()),
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--repetitions" => options.repetitions = value(&arg).parse().unwrap(),
+            "--threads" => options.threads = value(&arg).parse().unwrap(),
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options.repetitions = options.repetitions.max(1);
+    options.threads = options.threads.max(1);
+    options
+}
+
+const QUERIES: &[(&str, &str)] = &[
+    ("highlights", tree_sitter_ocaml::HIGHLIGHTS_QUERY),
+    ("locals", tree_sitter_ocaml::LOCALS_QUERY),
+    ("tags", tree_sitter_ocaml::TAGGING_QUERY),
+];
+
+/// Gets all the shared queries, returning their number of patterns so that
+/// the calls aren't optimized away.
+fn get_shared() -> usize {
+    [
+        queries::ocaml_highlights(),
+        queries::ocaml_locals(),
+        queries::ocaml_tags(),
+        queries::interface_highlights(),
+        queries::interface_locals(),
+        queries::interface_tags(),
+    ]
+    .iter()
+    .map(|query| query.pattern_count())
+    .sum()
+}
+
+/// Compiles all the queries, returning their number of patterns.
+fn compile_private() -> usize {
+    let mut patterns = 0;
+    for grammar in &Grammar::ALL {
+        for (_, source) in QUERIES {
+            patterns += Query::new(grammar.language(), source)
+                .unwrap()
+                .pattern_count();
+        }
+    }
+    patterns
+}
+
+/// Runs `work` on `threads` threads at once, returning the wall time and the
+/// sum of the times of the threads, in milliseconds.
+fn run_workers(threads: usize, work: fn() -> usize) -> (f64, f64) {
+    let start = Instant::now();
+    let cpu: f64 = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(move || {
+                    let start = Instant::now();
+                    assert!(work() > 0);
+                    start.elapsed().as_secs_f64()
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap())
+            .sum()
+    });
+    (start.elapsed().as_secs_f64() * 1e3, cpu * 1e3)
+}
+
+/// The metrics that are compared with a baseline, and whether higher is
+/// better for them.
+const COMPARED: &[(&str, bool)] = &[
+    ("compile_ms", false),
+    ("shared_ms", false),
+    ("private_ms", false),
+];
+
+fn main() {
+    let options = parse_options();
+
+    // The shared queries can only be compiled once per process, so this has
+    // to come first.
+    let (shared_ms, shared_cpu_ms) = run_workers(options.threads, get_shared);
+    let warm_calls = 100_000;
+    let start = Instant::now();
+    let mut patterns = 0;
+    for _ in 0..warm_calls {
+        patterns += get_shared();
+    }
+    let shared_warm_ns = start.elapsed().as_secs_f64() * 1e9 / (warm_calls * 6) as f64;
+    assert!(patterns > 0);
+
+    let mut results = Map::new();
+    for &grammar in &Grammar::ALL {
+        for (name, source) in QUERIES {
+            let mut times: Vec<f64> = (0..options.repetitions)
+                .map(|_| {
+                    let start = Instant::now();
+                    let query = Query::new(grammar.language(), source).unwrap();
+                    let time = start.elapsed().as_secs_f64();
+                    drop(query);
+                    time
+                })
+                .collect();
+            results.insert(
+                format!("{}/{}", grammar.extension(), name),
+                json!({ "compile_ms": common::median(&mut times) * 1e3 }),
+            );
+        }
+    }
+
+    let (private_ms, private_cpu_ms) = run_workers(options.threads, compile_private);
+    results.insert(
+        "startup".to_string(),
+        json!({
+            "threads": options.threads,
+            "shared_ms": shared_ms,
+            "shared_cpu_ms": shared_cpu_ms,
+            "shared_warm_ns": shared_warm_ns,
+            "private_ms": private_ms,
+            "private_cpu_ms": private_cpu_ms,
+        }),
+    );
+
+    eprintln!("{:<16} {:>12}", "", "compile ms");
+    for (split, result) in &results {
+        if let Some(time) = result["compile_ms"].as_f64() {
+            eprintln!("{:<16} {:>12.3}", split, time);
+        }
+    }
+    eprintln!(
+        "{} workers: {:.1}ms with shared queries, {:.1}ms ({:.1}ms of CPU) compiling their own",
+        options.threads, shared_ms, private_ms, private_cpu_ms
+    );
+
+    let report = json!({
+        "repetitions": options.repetitions,
+        "results": results,
+    });
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
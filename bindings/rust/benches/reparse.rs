@@ -0,0 +1,623 @@
+//! Incremental reparse latency under realistic edit scripts.
+//!
+//! ```sh
+//! cargo bench --bench reparse -- --output baseline.json
+//! cargo bench --bench reparse -- --baseline baseline.json
+//! cargo bench --bench reparse -- --git-diff examples/dune <old-rev> <new-rev>
+//! ```
+//!
+//! Each edit script is replayed keystroke by keystroke on files from the
+//! corpus: every edit is applied to the old tree with `Tree::edit` and the text
+//! parsed again with the old tree. The scripts are
+//!
+//! - `quoted-string-typing`: typing inside a quoted (or plain) string,
+//! - `unterminated-comment`: opening a `(*` comment before an item, typing in
+//!   it and closing it again,
+//! - `double-semicolon`: inserting `;;` after an item,
+//! - `interpolation-editing`: typing and deleting inside a `${...}`
+//!   interpolation.
+//!
+//! With `--git-diff`, the hunks of `git diff` between two revisions of a
+//! repository are replayed instead, one edit per hunk.
+//!
+//! For every script the report gives the reparse latency, the latency of a
+//! parse from scratch of the same texts, the bytes covered by
+//! `Tree::changed_ranges`, and the share of the nodes of each new tree that
+//! were reused from the old one. Reuse is measured by node id, which is the
+//! address of the subtree, so it is an approximation for the small leaves that
+//! are stored inline. `whole_unit_invalidations` counts the edits whose changed
+//! ranges cover more than half the file. With the `scanner-stats` feature, the
+//! calls to the external scanner, its serializations and deserializations and
+//! the cycles spent in it are also given per reparse.
+
+mod common;
+
+use common::{Corpus, Grammar};
+use serde_json::{json, Map, Value};
+use std::collections::HashSet;
+use std::path::Path;
+use std::process::{self, Command};
+use std::time::Instant;
+use tree_sitter::{InputEdit, Node, Parser, Point, Tree};
+
+struct Options {
+    synthetic: bool,
+    files: usize,
+    git_diff: Option<(String, String, String)>,
+    output: Option<String>,
+    baseline: Option<String>,
+    threshold: f64,
+}
+
+fn parse_options() -> Options {
+    let mut options = Options {
+        synthetic: false,
+        files: 200,
+        git_diff: None,
+        output: None,
+        baseline: None,
+        threshold: 10.0,
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("Missing value for {}", name);
+                process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            // Passed by `cargo bench`.
+            "--bench" => {}
+            "--synthetic" => options.synthetic = true,
+            "--files" => options.files = value(&arg).parse().unwrap(),
+            "--git-diff" => {
+                options.git_diff = Some((value(&arg), value(&arg), value(&arg)));
+            }
+            "--output" => options.output = Some(value(&arg)),
+            "--baseline" => options.baseline = Some(value(&arg)),
+            "--threshold" => options.threshold = value(&arg).parse().unwrap(),
+            _ => {
+                eprintln!("Unknown argument {}", arg);
+                process::exit(2);
+            }
+        }
+    }
+    options
+}
+
+// Edits
+
+/// Replaces `start..old_end` with `text`.
+#[derive(Clone, Debug)]
+struct Edit {
+    start: usize,
+    old_end: usize,
+    text: Vec<u8>,
+}
+
+impl Edit {
+    fn insert(position: usize, text: &str) -> Edit {
+        Edit {
+            start: position,
+            old_end: position,
+            text: text.as_bytes().to_vec(),
+        }
+    }
+
+    fn delete(start: usize, end: usize) -> Edit {
+        Edit {
+            start,
+            old_end: end,
+            text: Vec::new(),
+        }
+    }
+}
+
+fn point_at(text: &[u8], offset: usize) -> Point {
+    let before = &text[..offset];
+    let row = before.iter().filter(|&&byte| byte == b'\n').count();
+    let line_start = before
+        .iter()
+        .rposition(|&byte| byte == b'\n')
+        .map_or(0, |newline| newline + 1);
+    Point::new(row, offset - line_start)
+}
+
+/// Applies `edit` to `text`, returning the matching `InputEdit` for the tree.
+fn apply(text: &mut Vec<u8>, edit: &Edit) -> InputEdit {
+    let start_position = point_at(text, edit.start);
+    let old_end_position = point_at(text, edit.old_end);
+    text.splice(edit.start..edit.old_end, edit.text.iter().cloned());
+    let new_end_byte = edit.start + edit.text.len();
+    InputEdit {
+        start_byte: edit.start,
+        old_end_byte: edit.old_end,
+        new_end_byte,
+        start_position,
+        old_end_position,
+        new_end_position: point_at(text, new_end_byte),
+    }
+}
+
+/// Typing `text` at `position` one character at a time.
+fn typing(position: usize, text: &str) -> Vec<Edit> {
+    text.char_indices()
+        .map(|(offset, c)| Edit::insert(position + offset, c.encode_utf8(&mut [0; 4])))
+        .collect()
+}
+
+/// Deleting the `count` bytes before `position` one at a time.
+fn backspaces(position: usize, count: usize) -> Vec<Edit> {
+    (0..count)
+        .map(|i| Edit::delete(position - i - 1, position - i))
+        .collect()
+}
+
+// Edit scripts
+
+const SCRIPTS: &[&str] = &[
+    "quoted-string-typing",
+    "unterminated-comment",
+    "double-semicolon",
+    "interpolation-editing",
+];
+
+/// Returns the nodes of the given kinds, in order.
+fn find_nodes<'a>(tree: &'a Tree, kinds: &[&str]) -> Vec<Node<'a>> {
+    let mut nodes = Vec::new();
+    let mut cursor = tree.walk();
+    loop {
+        let node = cursor.node();
+        if kinds.contains(&node.kind()) {
+            nodes.push(node);
+        }
+        if cursor.goto_first_child() || cursor.goto_next_sibling() {
+            continue;
+        }
+        loop {
+            if !cursor.goto_parent() {
+                return nodes;
+            }
+            if cursor.goto_next_sibling() {
+                break;
+            }
+        }
+    }
+}
+
+fn middle<T: Copy>(items: &[T]) -> Option<T> {
+    items.get(items.len() / 2).copied()
+}
+
+/// Returns the edits of `script` for a file, or `None` if the file doesn't
+/// have what the script edits.
+fn script_edits(script: &str, tree: &Tree) -> Option<Vec<Edit>> {
+    let root = tree.root_node();
+    let items: Vec<Node> = (0..root.named_child_count())
+        .filter_map(|i| root.named_child(i))
+        .filter(|node| !node.is_extra())
+        .collect();
+
+    match script {
+        "quoted-string-typing" => {
+            let mut strings = find_nodes(tree, &["quoted_string_content"]);
+            if strings.is_empty() {
+                strings = find_nodes(tree, &["string_content"]);
+            }
+            let position = middle(&strings)?.start_byte();
+            Some(typing(position, "typed text "))
+        }
+        "unterminated-comment" => {
+            let position = middle(&items)?.start_byte();
+            let mut edits = typing(position, "(* note");
+            edits.extend(typing(position + 7, " *)\n"));
+            Some(edits)
+        }
+        "double-semicolon" => {
+            let position = middle(&items)?.end_byte();
+            Some(typing(position, ";;"))
+        }
+        "interpolation-editing" => {
+            let contents = find_nodes(tree, &["string_interpolation_content"]);
+            let position = middle(&contents)?.end_byte();
+            let mut edits = typing(position, "_x");
+            edits.extend(backspaces(position + 2, 2));
+            Some(edits)
+        }
+        _ => unreachable!(),
+    }
+}
+
+/// Returns the edits that turn the old revision of a file into the new one,
+/// one for every hunk of `git diff -U0`.
+fn diff_edits(old: &[u8], new: &[u8], diff: &str) -> Vec<Edit> {
+    fn line_starts(text: &[u8]) -> Vec<usize> {
+        let mut starts = vec![0];
+        starts.extend(
+            text.iter()
+                .enumerate()
+                .filter(|(_, &byte)| byte == b'\n')
+                .map(|(i, _)| i + 1),
+        );
+        starts
+    }
+
+    fn range(text: &[u8], starts: &[usize], line: usize, count: usize) -> (usize, usize) {
+        let start = starts
+            .get(line)
+            .copied()
+            .unwrap_or(text.len())
+            .min(text.len());
+        let end = starts
+            .get(line + count)
+            .copied()
+            .unwrap_or(text.len())
+            .min(text.len());
+        (start, end)
+    }
+
+    fn parse_range(range: &str) -> (usize, usize) {
+        let mut parts = range[1..].splitn(2, ',');
+        let line = parts.next().unwrap().parse().unwrap();
+        let count = parts.next().map_or(1, |count| count.parse().unwrap());
+        (line, count)
+    }
+
+    let old_starts = line_starts(old);
+    let new_starts = line_starts(new);
+    let mut edits = Vec::new();
+    let mut shift: isize = 0;
+    for header in diff.lines().filter(|line| line.starts_with("@@ ")) {
+        let mut fields = header.split(' ').skip(1);
+        let (old_line, old_count) = parse_range(fields.next().unwrap());
+        let (new_line, new_count) = parse_range(fields.next().unwrap());
+        // An empty range is given by the line before it.
+        let old_index = if old_count == 0 {
+            old_line
+        } else {
+            old_line - 1
+        };
+        let new_index = if new_count == 0 {
+            new_line
+        } else {
+            new_line - 1
+        };
+
+        let (old_start, old_end) = range(old, &old_starts, old_index, old_count);
+        let (new_start, new_end) = range(new, &new_starts, new_index, new_count);
+        let start = (old_start as isize + shift) as usize;
+        edits.push(Edit {
+            start,
+            old_end: start + (old_end - old_start),
+            text: new[new_start..new_end].to_vec(),
+        });
+        shift += (new_end - new_start) as isize - (old_end - old_start) as isize;
+    }
+    edits
+}
+
+fn git(repository: &str, args: &[&str]) -> Vec<u8> {
+    let output = Command::new("git")
+        .arg("-C")
+        .arg(repository)
+        .args(args)
+        .output()
+        .unwrap_or_else(|error| {
+            eprintln!("Failed to run git: {}", error);
+            process::exit(2);
+        });
+    if !output.status.success() {
+        eprintln!(
+            "git {} failed: {}",
+            args.join(" "),
+            String::from_utf8_lossy(&output.stderr)
+        );
+        process::exit(2);
+    }
+    output.stdout
+}
+
+/// The files changed between two revisions, with their edits.
+fn git_diff_scripts(
+    repository: &str,
+    old_rev: &str,
+    new_rev: &str,
+) -> Vec<(Grammar, Vec<u8>, Vec<Edit>)> {
+    let range = format!("{}..{}", old_rev, new_rev);
+    let names = git(
+        repository,
+        &[
+            "diff",
+            "--name-only",
+            "--diff-filter=M",
+            &range,
+            "--",
+            "*.ml",
+            "*.mli",
+        ],
+    );
+    let mut scripts = Vec::new();
+    for path in String::from_utf8_lossy(&names).lines() {
+        let grammar = match Grammar::for_path(Path::new(path)) {
+            Some(grammar) => grammar,
+            None => continue,
+        };
+        let old = git(repository, &["show", &format!("{}:{}", old_rev, path)]);
+        let new = git(repository, &["show", &format!("{}:{}", new_rev, path)]);
+        let diff = git(
+            repository,
+            &[
+                "diff",
+                "-U0",
+                "--no-color",
+                "--no-ext-diff",
+                &range,
+                "--",
+                path,
+            ],
+        );
+        let edits = diff_edits(&old, &new, &String::from_utf8_lossy(&diff));
+
+        let mut text = old.clone();
+        for edit in &edits {
+            apply(&mut text, edit);
+        }
+        if text != new {
+            eprintln!("Skipping {}: its diff doesn't apply", path);
+            continue;
+        }
+        scripts.push((grammar, old, edits));
+    }
+    scripts
+}
+
+// Measurements
+
+#[derive(Default)]
+struct Samples {
+    files: usize,
+    reparse: Vec<f64>,
+    full_parse: Vec<f64>,
+    changed_bytes: Vec<f64>,
+    changed_fraction: Vec<f64>,
+    reused: Vec<f64>,
+    /// What the external scanner did during the reparses, if it counts.
+    scanner: Option<ScannerTotals>,
+}
+
+#[derive(Clone, Copy, Default)]
+struct ScannerTotals {
+    scan_calls: u64,
+    serializations: u64,
+    deserializations: u64,
+    cycles: u64,
+}
+
+/// Returns the counters of the external scanner on this thread since the last
+/// call, for both languages, if the scanner keeps them.
+#[cfg(feature = "scanner-stats")]
+fn take_scanner_stats() -> Option<ScannerTotals> {
+    use tree_sitter_ocaml::scanner_stats;
+
+    let mut totals = ScannerTotals::default();
+    for stats in &[
+        scanner_stats::take_ocaml(),
+        scanner_stats::take_ocaml_interface(),
+    ] {
+        totals.scan_calls += stats.scan_calls;
+        totals.serializations += stats.serializations;
+        totals.deserializations += stats.deserializations;
+        totals.cycles += stats.total_cycles();
+    }
+    Some(totals)
+}
+
+#[cfg(not(feature = "scanner-stats"))]
+fn take_scanner_stats() -> Option<ScannerTotals> {
+    None
+}
+
+fn node_ids(tree: &Tree) -> HashSet<usize> {
+    let mut ids = HashSet::new();
+    let mut cursor = tree.walk();
+    loop {
+        ids.insert(cursor.node().id());
+        if cursor.goto_first_child() || cursor.goto_next_sibling() {
+            continue;
+        }
+        loop {
+            if !cursor.goto_parent() {
+                return ids;
+            }
+            if cursor.goto_next_sibling() {
+                break;
+            }
+        }
+    }
+}
+
+/// Replays `edits` on `text`, starting from its tree.
+fn replay(parser: &mut Parser, text: &[u8], edits: &[Edit], samples: &mut Samples) {
+    let mut text = text.to_vec();
+    let mut tree = parser.parse(&text, None).unwrap();
+    samples.files += 1;
+
+    for edit in edits {
+        let old_ids = node_ids(&tree);
+        let input_edit = apply(&mut text, edit);
+        tree.edit(&input_edit);
+
+        take_scanner_stats();
+        let start = Instant::now();
+        let new_tree = parser.parse(&text, Some(&tree)).unwrap();
+        samples.reparse.push(start.elapsed().as_secs_f64());
+        if let Some(stats) = take_scanner_stats() {
+            let totals = samples.scanner.get_or_insert_with(ScannerTotals::default);
+            totals.scan_calls += stats.scan_calls;
+            totals.serializations += stats.serializations;
+            totals.deserializations += stats.deserializations;
+            totals.cycles += stats.cycles;
+        }
+
+        let start = Instant::now();
+        drop(parser.parse(&text, None).unwrap());
+        samples.full_parse.push(start.elapsed().as_secs_f64());
+
+        let changed: usize = tree
+            .changed_ranges(&new_tree)
+            .map(|range| range.end_byte - range.start_byte)
+            .sum();
+        samples.changed_bytes.push(changed as f64);
+        samples
+            .changed_fraction
+            .push(changed as f64 / text.len().max(1) as f64);
+
+        let new_ids = node_ids(&new_tree);
+        let reused = new_ids.iter().filter(|id| old_ids.contains(id)).count();
+        samples.reused.push(reused as f64 / new_ids.len() as f64);
+
+        tree = new_tree;
+    }
+}
+
+fn summarize(samples: &mut Samples) -> Value {
+    fn sorted(values: &mut Vec<f64>) -> &[f64] {
+        values.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        values
+    }
+    fn mean(values: &[f64]) -> f64 {
+        values.iter().sum::<f64>() / values.len().max(1) as f64
+    }
+
+    let edits = samples.reparse.len();
+    let reparse = sorted(&mut samples.reparse).to_vec();
+    let full_parse_mean = mean(&samples.full_parse);
+    let changed_bytes = sorted(&mut samples.changed_bytes).to_vec();
+    let changed_fraction = sorted(&mut samples.changed_fraction).to_vec();
+    let whole_unit_invalidations = changed_fraction.iter().filter(|&&f| f > 0.5).count();
+    let per_edit = |count: fn(&ScannerTotals) -> u64| {
+        samples
+            .scanner
+            .as_ref()
+            .map(|totals| count(totals) as f64 / edits.max(1) as f64)
+    };
+
+    json!({
+        "files": samples.files,
+        "edits": edits,
+        "reparse_p50_ms": common::percentile(&reparse, 0.5) * 1e3,
+        "reparse_p99_ms": common::percentile(&reparse, 0.99) * 1e3,
+        "reparse_mean_ms": mean(&reparse) * 1e3,
+        "full_parse_mean_ms": full_parse_mean * 1e3,
+        "speedup": if mean(&reparse) > 0.0 { full_parse_mean / mean(&reparse) } else { 0.0 },
+        "changed_bytes_p50": common::percentile(&changed_bytes, 0.5),
+        "changed_bytes_p99": common::percentile(&changed_bytes, 0.99),
+        "changed_fraction_max": changed_fraction.last().copied().unwrap_or(0.0),
+        "whole_unit_invalidations": whole_unit_invalidations,
+        "reused_ratio_mean": mean(&samples.reused),
+        "scan_calls_per_edit": per_edit(|totals| totals.scan_calls),
+        "serializations_per_edit": per_edit(|totals| totals.serializations),
+        "deserializations_per_edit": per_edit(|totals| totals.deserializations),
+        "scanner_cycles_per_edit": per_edit(|totals| totals.cycles),
+    })
+}
+
+fn parser_for(parsers: &mut [(Grammar, Parser)], grammar: Grammar) -> &mut Parser {
+    &mut parsers.iter_mut().find(|(g, _)| *g == grammar).unwrap().1
+}
+
+/// Picks `count` files spread evenly over the corpus.
+fn pick_files(corpus: &Corpus, count: usize) -> Vec<&common::Source> {
+    let step = (corpus.sources.len() / count.max(1)).max(1);
+    corpus.sources.iter().step_by(step).take(count).collect()
+}
+
+const COMPARED: &[(&str, bool)] = &[
+    ("reparse_p50_ms", false),
+    ("reparse_p99_ms", false),
+    ("changed_bytes_p99", false),
+    ("whole_unit_invalidations", false),
+    ("reused_ratio_mean", true),
+];
+
+fn print_summary(report: &Value) {
+    eprintln!(
+        "{:<24} {:>6} {:>6} {:>10} {:>10} {:>8} {:>12} {:>9} {:>7}",
+        "", "files", "edits", "p50 ms", "p99 ms", "speedup", "changed p99", "invalid", "reused"
+    );
+    for (script, result) in report["results"].as_object().unwrap() {
+        let number = |key: &str| result[key].as_f64().unwrap_or(f64::NAN);
+        eprintln!(
+            "{:<24} {:>6} {:>6} {:>10.3} {:>10.3} {:>7.1}x {:>12.0} {:>9} {:>6.1}%",
+            script,
+            result["files"],
+            result["edits"],
+            number("reparse_p50_ms"),
+            number("reparse_p99_ms"),
+            number("speedup"),
+            number("changed_bytes_p99"),
+            result["whole_unit_invalidations"],
+            number("reused_ratio_mean") * 100.0,
+        );
+    }
+}
+
+fn main() {
+    let options = parse_options();
+    let mut parsers: Vec<(Grammar, Parser)> = Grammar::ALL
+        .iter()
+        .map(|&grammar| {
+            let mut parser = Parser::new();
+            parser.set_language(grammar.language()).unwrap();
+            (grammar, parser)
+        })
+        .collect();
+
+    let mut results = Map::new();
+    let corpus_name;
+    if let Some((repository, old_rev, new_rev)) = &options.git_diff {
+        corpus_name = format!("git-diff {} {}..{}", repository, old_rev, new_rev);
+        let mut samples = Samples::default();
+        for (grammar, text, edits) in git_diff_scripts(repository, old_rev, new_rev) {
+            replay(
+                parser_for(&mut parsers, grammar),
+                &text,
+                &edits,
+                &mut samples,
+            );
+        }
+        results.insert("git-diff".to_string(), summarize(&mut samples));
+    } else {
+        let corpus = common::load(options.synthetic).unwrap_or_else(|error| {
+            eprintln!("Failed to load the corpus: {}", error);
+            process::exit(2);
+        });
+        corpus_name = corpus.name.to_string();
+        let files = pick_files(&corpus, options.files);
+        for script in SCRIPTS {
+            let mut samples = Samples::default();
+            for source in &files {
+                let parser = parser_for(&mut parsers, source.grammar);
+                let tree = parser.parse(&source.text, None).unwrap();
+                if let Some(edits) = script_edits(script, &tree) {
+                    replay(parser, &source.text, &edits, &mut samples);
+                }
+            }
+            results.insert(script.to_string(), summarize(&mut samples));
+        }
+    }
+
+    let report = json!({
+        "corpus": corpus_name,
+        "results": results,
+    });
+    print_summary(&report);
+    common::finish(
+        &report,
+        options.output.as_deref(),
+        options.baseline.as_deref(),
+        COMPARED,
+        options.threshold,
+    );
+}
@@ -0,0 +1,219 @@
+//! Parses all the `.ml` and `.mli` files under the given paths in parallel.
+//!
+//! ```sh
+//! cargo run --release --features batch --bin tree-sitter-ocaml-batch -- \
+//!     [--threads N] [--timeout MS] [--max-nodes N] [--recovery] [--json] \
+//!     [--quiet] PATH...
+//! ```
+//!
+//! Prints a line per file with its status, size, parse time and the number of
+//! error and missing nodes, either tab-separated or as JSON, and a summary at
+//! the end. Exits with status 1 if any file had errors or went over budget.
+//!
+//! A file that takes longer than `--timeout` milliseconds to parse, or whose
+//! tree has more than `--max-nodes` nodes, is reported as `over_budget` with
+//! the number of top-level items found by skimming it. `--recovery` adds the
+//! time spent recovering from errors to every line, and ranks the lookahead
+//! symbols at which errors were detected by their total recovery time.
+//!
+//! With the `arena` feature, `--arena` parses every file in the arena of its
+//! worker thread, see `tree_sitter_ocaml::arena`.
+
+use std::collections::HashMap;
+use std::io::{self, Write};
+use std::path::PathBuf;
+use std::process;
+use std::time::{Duration, Instant};
+use tree_sitter_ocaml::batch::{self, FileResult, Limit, Options, Status};
+
+fn json_string(text: &str) -> String {
+    let mut escaped = String::with_capacity(text.len() + 2);
+    escaped.push('"');
+    for c in text.chars() {
+        match c {
+            '"' => escaped.push_str("\\\""),
+            '\\' => escaped.push_str("\\\\"),
+            c if (c as u32) < 0x20 => escaped.push_str(&format!("\\u{:04x}", c as u32)),
+            c => escaped.push(c),
+        }
+    }
+    escaped.push('"');
+    escaped
+}
+
+fn status_name(status: &Status) -> &'static str {
+    match status {
+        Status::Ok => "ok",
+        Status::Errors => "errors",
+        Status::OverBudget(_) => "over_budget",
+        Status::Failed(_) => "failed",
+    }
+}
+
+fn print_result(
+    out: &mut impl Write,
+    result: &FileResult,
+    json: bool,
+    recovery: bool,
+) -> io::Result<()> {
+    let message = match &result.status {
+        Status::OverBudget(Limit::Time) => {
+            format!("over the time budget, {} items", result.items.len())
+        }
+        Status::OverBudget(Limit::Nodes) => {
+            format!("over the node budget, {} items", result.items.len())
+        }
+        Status::Failed(message) => message.clone(),
+        _ => String::new(),
+    };
+    let recovery_ms = result.recovery.as_secs_f64() * 1e3;
+    if json {
+        writeln!(
+            out,
+            "{{\"path\":{},\"status\":\"{}\",\"bytes\":{},\"ms\":{:.3},\"error_nodes\":{},\"missing_nodes\":{},\"recovery_ms\":{:.3},\"items\":{},\"message\":{}}}",
+            json_string(&result.path.to_string_lossy()),
+            status_name(&result.status),
+            result.bytes,
+            result.duration.as_secs_f64() * 1e3,
+            result.error_nodes,
+            result.missing_nodes,
+            recovery_ms,
+            result.items.len(),
+            json_string(&message),
+        )
+    } else {
+        write!(
+            out,
+            "{}\t{}\t{}\t{:.3}ms\t{}\t{}\t",
+            result.path.display(),
+            status_name(&result.status),
+            result.bytes,
+            result.duration.as_secs_f64() * 1e3,
+            result.error_nodes,
+            result.missing_nodes,
+        )?;
+        if recovery {
+            write!(out, "{:.3}ms\t", recovery_ms)?;
+        }
+        writeln!(out, "{}", message)
+    }
+}
+
+/// Prints the lookahead symbols that errors were detected at, by the total
+/// time spent recovering from them.
+fn print_recovery(by_lookahead: &HashMap<String, (Duration, usize)>) {
+    let mut symbols: Vec<_> = by_lookahead.iter().collect();
+    symbols.sort_by(|a, b| (b.1).0.cmp(&(a.1).0));
+    eprintln!("{:<32} {:>12} {:>7}", "recovery at", "ms", "files");
+    for (symbol, (time, files)) in symbols.into_iter().take(20) {
+        eprintln!(
+            "{:<32} {:>12.3} {:>7}",
+            symbol,
+            time.as_secs_f64() * 1e3,
+            files
+        );
+    }
+}
+
+fn number<T: std::str::FromStr>(args: &mut impl Iterator<Item = String>, name: &str) -> T {
+    args.next()
+        .and_then(|value| value.parse().ok())
+        .unwrap_or_else(|| {
+            eprintln!("{} needs a number", name);
+            process::exit(2);
+        })
+}
+
+fn main() {
+    let mut options = Options::default();
+    let mut json = false;
+    let mut quiet = false;
+    let mut roots = Vec::new();
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--threads" => options.threads = number(&mut args, &arg),
+            "--timeout" => {
+                options.budget.time = Some(Duration::from_millis(number(&mut args, &arg)))
+            }
+            "--max-nodes" => options.budget.nodes = Some(number(&mut args, &arg)),
+            "--recovery" => options.time_recovery = true,
+            #[cfg(feature = "arena")]
+            "--arena" => options.arena = true,
+            "--json" => json = true,
+            "--quiet" => quiet = true,
+            _ => roots.push(PathBuf::from(arg)),
+        }
+    }
+    if roots.is_empty() {
+        eprintln!(
+            "usage: tree-sitter-ocaml-batch [--threads N] [--timeout MS] [--max-nodes N] [--recovery] [--json] [--quiet] PATH..."
+        );
+        process::exit(2);
+    }
+
+    #[cfg(feature = "arena")]
+    if options.arena {
+        // Nothing was parsed yet.
+        unsafe { tree_sitter_ocaml::arena::install() };
+    }
+
+    let paths = batch::discover(&roots).unwrap_or_else(|error| {
+        eprintln!("{}", error);
+        process::exit(2);
+    });
+
+    let start = Instant::now();
+    let stdout = io::stdout();
+    let mut out = io::BufWriter::new(stdout.lock());
+    let (mut files, mut bytes, mut with_errors, mut over_budget, mut failed) = (0, 0, 0, 0, 0);
+    let mut parse_time = Duration::default();
+    let mut recovery_time = Duration::default();
+    let mut recovery_by_lookahead: HashMap<String, (Duration, usize)> = HashMap::new();
+    batch::parse_files(paths, &options, |result| {
+        files += 1;
+        bytes += result.bytes;
+        parse_time += result.duration;
+        recovery_time += result.recovery;
+        for (symbol, time) in &result.recovery_by_lookahead {
+            let entry = recovery_by_lookahead.entry(symbol.clone()).or_default();
+            entry.0 += *time;
+            entry.1 += 1;
+        }
+        match result.status {
+            Status::Ok => {}
+            Status::Errors => with_errors += 1,
+            Status::OverBudget(_) => over_budget += 1,
+            Status::Failed(_) => failed += 1,
+        }
+        if !quiet || result.status != Status::Ok {
+            print_result(&mut out, &result, json, options.time_recovery).unwrap();
+        }
+    });
+    out.flush().unwrap();
+    let elapsed = start.elapsed().as_secs_f64();
+
+    eprintln!(
+        "{} files, {:.1} MB in {:.2}s on {} threads ({:.1} MB/s, {:.1}x parallel speedup), {} with errors, {} over budget, {} failed",
+        files,
+        bytes as f64 / 1e6,
+        elapsed,
+        options.threads,
+        bytes as f64 / 1e6 / elapsed,
+        parse_time.as_secs_f64() / elapsed,
+        with_errors,
+        over_budget,
+        failed,
+    );
+    if options.time_recovery {
+        eprintln!(
+            "{:.2}s of {:.2}s parsing spent recovering from errors",
+            recovery_time.as_secs_f64(),
+            parse_time.as_secs_f64()
+        );
+        print_recovery(&recovery_by_lookahead);
+    }
+    if with_errors > 0 || over_budget > 0 || failed > 0 {
+        process::exit(1);
+    }
+}
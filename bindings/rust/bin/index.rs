@@ -0,0 +1,115 @@
+//! Keeps a symbol index of the `.ml` and `.mli` files under the given paths.
+//!
+//! ```sh
+//! cargo run --release --features index --bin tree-sitter-ocaml-index -- \
+//!     update [--threads N] [--timeout MS] INDEX PATH...
+//! cargo run --release --features index --bin tree-sitter-ocaml-index -- \
+//!     defs INDEX NAME
+//! cargo run --release --features index --bin tree-sitter-ocaml-index -- \
+//!     refs INDEX NAME
+//! ```
+//!
+//! `update` creates the index or brings it up to date, parsing only the files
+//! that changed since the last update. Files that take longer than `--timeout`
+//! milliseconds to parse are indexed without tags, counted as failed and
+//! parsed again by the next update. `defs` and `refs` print the definitions
+//! and references of a name as `path:line:column: kind`.
+
+use std::path::{Path, PathBuf};
+use std::process;
+use std::time::{Duration, Instant};
+use tree_sitter_ocaml::batch::Options;
+use tree_sitter_ocaml::index::{self, Index, Posting};
+
+const USAGE: &str =
+    "usage: tree-sitter-ocaml-index update [--threads N] [--timeout MS] INDEX PATH...
+       tree-sitter-ocaml-index defs INDEX NAME
+       tree-sitter-ocaml-index refs INDEX NAME";
+
+fn usage() -> ! {
+    eprintln!("{}", USAGE);
+    process::exit(2);
+}
+
+fn update(mut args: impl Iterator<Item = String>) {
+    let mut options = Options::default();
+    let mut paths = Vec::new();
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--threads" => {
+                options.threads = args
+                    .next()
+                    .and_then(|threads| threads.parse().ok())
+                    .unwrap_or_else(|| usage())
+            }
+            "--timeout" => {
+                let ms = args
+                    .next()
+                    .and_then(|ms| ms.parse().ok())
+                    .unwrap_or_else(|| usage());
+                options.budget.time = Some(Duration::from_millis(ms))
+            }
+            _ => paths.push(PathBuf::from(arg)),
+        }
+    }
+    if paths.len() < 2 {
+        usage();
+    }
+    let index_path = paths.remove(0);
+
+    let start = Instant::now();
+    let stats = index::update(&index_path, &paths, &options).unwrap_or_else(|error| {
+        eprintln!("{}: {}", index_path.display(), error);
+        process::exit(1);
+    });
+    eprintln!(
+        "{} files ({} parsed, {} unchanged, {} failed), {} names, {} tags in {:.2}s",
+        stats.files,
+        stats.parsed,
+        stats.reused,
+        stats.failed,
+        stats.names,
+        stats.postings,
+        start.elapsed().as_secs_f64(),
+    );
+}
+
+fn print_postings(index: &Index, postings: impl Iterator<Item = Posting>) -> bool {
+    let mut found = false;
+    for posting in postings {
+        found = true;
+        println!(
+            "{}:{}:{}: {}",
+            index.file(posting.file).map_or("?", |file| file.path),
+            posting.row + 1,
+            posting.column + 1,
+            posting.kind(),
+        );
+    }
+    found
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let command = args.next().unwrap_or_else(|| usage());
+    if command == "update" {
+        return update(args);
+    }
+
+    let (index_path, name) = match (args.next(), args.next(), args.next()) {
+        (Some(index_path), Some(name), None) => (index_path, name),
+        _ => usage(),
+    };
+    let index = Index::open(Path::new(&index_path)).unwrap_or_else(|error| {
+        eprintln!("{}: {}", index_path, error);
+        process::exit(2);
+    });
+    let found = match command.as_str() {
+        "defs" => print_postings(&index, index.definitions(&name)),
+        "refs" => print_postings(&index, index.references(&name)),
+        _ => usage(),
+    };
+    if !found {
+        process::exit(1);
+    }
+}
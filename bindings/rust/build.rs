@@ -1,7 +1,6 @@
 fn main() {
     let root_dir = std::path::Path::new(".");
     let ocaml_dir = root_dir.join("ocaml").join("src");
-    let interface_dir = root_dir.join("interface").join("src");
 
     let mut c_config = cc::Build::new();
     c_config.include(&ocaml_dir);
@@ -10,14 +9,50 @@ fn main() {
         .flag_if_supported("-Wno-unused-but-set-variable")
         .flag_if_supported("-Wno-trigraphs");
 
-    for dir in &[ocaml_dir, interface_dir] {
-        let parser_path = dir.join("parser.c");
-        let scanner_path = dir.join("scanner.c");
-        c_config.file(&parser_path);
-        c_config.file(&scanner_path);
-        println!("cargo:rerun-if-changed={}", parser_path.to_str().unwrap());
-        println!("cargo:rerun-if-changed={}", scanner_path.to_str().unwrap());
+    if std::env::var_os("CARGO_FEATURE_SCANNER_STATS").is_some() {
+        c_config.define("TREE_SITTER_OCAML_SCANNER_STATS", None);
     }
+    if std::env::var_os("CARGO_FEATURE_ARENA").is_some() {
+        c_config.define("TREE_SITTER_OCAML_SHARED_ALLOCATOR", None);
+    }
+
+    // The interface language shares the parse table of the OCaml grammar, and
+    // is defined in its scanner.
+    let parser_path = ocaml_dir.join("parser.c");
+    let scanner_path = ocaml_dir.join("scanner.c");
+    c_config.file(&parser_path);
+    c_config.file(&scanner_path);
+    println!("cargo:rerun-if-changed={}", parser_path.to_str().unwrap());
+    println!("cargo:rerun-if-changed={}", scanner_path.to_str().unwrap());
+    println!("cargo:rerun-if-changed=common/scanner.h");
+
+    // The outline grammar has its own parse table and scanner.
+    if std::env::var_os("CARGO_FEATURE_OUTLINE").is_some() {
+        let outline_dir = root_dir.join("outline").join("src");
+        for file in &["parser.c", "scanner.c"] {
+            let path = outline_dir.join(file);
+            c_config.file(&path);
+            println!("cargo:rerun-if-changed={}", path.to_str().unwrap());
+        }
+    }
+
+    // The trees depend on the parser and the scanner, so cached trees are
+    // keyed by a hash of their sources, see `compact`.
+    let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+    for path in &[
+        &parser_path,
+        &scanner_path,
+        &root_dir.join("common/scanner.h"),
+    ] {
+        for byte in std::fs::read(path).unwrap() {
+            hash ^= byte as u64;
+            hash = hash.wrapping_mul(0x0100_0000_01b3);
+        }
+    }
+    println!(
+        "cargo:rustc-env=TREE_SITTER_OCAML_GRAMMAR_HASH={:016x}",
+        hash
+    );
 
     c_config.compile("parser");
 }
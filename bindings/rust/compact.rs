@@ -0,0 +1,597 @@
+//! A compact binary format for trees, and a cache of trees on disk keyed by
+//! the source they were parsed from.
+//!
+//! Parsing is most of the cold start of a tool that looks at every file of a
+//! workspace. [`TreeCache`] keeps the tree of every source it has parsed in a
+//! file named after the hashes of the source and of the grammar, so that a
+//! warm start reads and decodes trees instead of parsing them. A
+//! [`CompactTree`] is walked like a tree-sitter tree, read-only: it has the
+//! kinds, fields and byte ranges of the nodes, but no positions, and can't be
+//! edited or queried.
+//!
+//! ```no_run
+//! use tree_sitter_ocaml::compact::{Grammar, TreeCache};
+//!
+//! let cache = TreeCache::new(".cache/trees");
+//! let mut parser = tree_sitter::Parser::new();
+//! let source = std::fs::read("a.ml").unwrap();
+//! let tree = cache.parse(&mut parser, Grammar::Ocaml, &source).unwrap();
+//! println!("{}", tree.root().kind());
+//! ```
+//!
+//! # Format
+//!
+//! All numbers are little-endian. The file starts with a 40 byte header:
+//!
+//! | offset | size | content                                          |
+//! |--------|------|--------------------------------------------------|
+//! | 0      | 8    | `OCTREE\0\x01`                                   |
+//! | 8      | 8    | grammar hash, see [`grammar_hash`]               |
+//! | 16     | 8    | FNV-1a hash of the source                        |
+//! | 24     | 4    | length of the source                             |
+//! | 28     | 4    | number of nodes                                  |
+//! | 32     | 1    | grammar, 0 for OCaml and 1 for interfaces        |
+//! | 33     | 7    | zero                                             |
+//!
+//! followed by the nodes in pre-order, each as five LEB128 numbers:
+//!
+//! - the kind id shifted left by 2, with bit 1 set for missing nodes and bit 0
+//!   for extra ones;
+//! - the id of the field of the node in its parent, or 0;
+//! - the start byte minus the start byte of the previous node, modulo 2^32,
+//!   which is small since starts rarely go back in pre-order;
+//! - the length in bytes;
+//! - the number of descendants, which is how far the next sibling is.
+//!
+//! The kind and field ids are those of the language, whose names are the types
+//! and fields of `node-types.json`. Most nodes take 5 or 6 bytes.
+
+use crate::hash::{fnv1a, fnv1a_extend};
+use std::fs;
+use std::io;
+use std::ops::Range;
+use std::path::{Path, PathBuf};
+use tree_sitter::{Language, Parser, Tree};
+
+const MAGIC: &[u8; 8] = b"OCTREE\0\x01";
+const HEADER_SIZE: usize = 40;
+
+/// The smallest encoding of a node, one byte per number.
+const MIN_NODE_SIZE: usize = 5;
+
+/// The kind id of `ERROR` nodes.
+const ERROR_KIND: u16 = u16::MAX;
+
+const EXTRA: u8 = 1;
+const MISSING: u8 = 2;
+const HAS_ERROR: u8 = 4;
+
+/// The parent of the root.
+const NONE: u32 = u32::MAX;
+
+/// A hash of everything the trees depend on besides the sources: the crate
+/// version and the sources of the parser and the scanner. Cached trees with
+/// another hash are parsed again.
+pub fn grammar_hash() -> u64 {
+    fnv1a_extend(
+        fnv1a(env!("CARGO_PKG_VERSION").as_bytes()),
+        env!("TREE_SITTER_OCAML_GRAMMAR_HASH").as_bytes(),
+    )
+}
+
+/// The grammar a tree is parsed with.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Grammar {
+    Ocaml,
+    Interface,
+}
+
+impl Grammar {
+    /// The grammar for `.ml` or `.mli` files.
+    pub fn for_path(path: &Path) -> Option<Grammar> {
+        match path.extension()?.to_str()? {
+            "ml" => Some(Grammar::Ocaml),
+            "mli" => Some(Grammar::Interface),
+            _ => None,
+        }
+    }
+
+    pub fn language(self) -> Language {
+        match self {
+            Grammar::Ocaml => crate::language_ocaml(),
+            Grammar::Interface => crate::language_ocaml_interface(),
+        }
+    }
+
+    fn extension(self) -> &'static str {
+        match self {
+            Grammar::Ocaml => "ml",
+            Grammar::Interface => "mli",
+        }
+    }
+}
+
+/// A read-only tree, with a column per property of the nodes, in pre-order.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct CompactTree {
+    grammar: Grammar,
+    kinds: Vec<u16>,
+    fields: Vec<u16>,
+    flags: Vec<u8>,
+    starts: Vec<u32>,
+    ends: Vec<u32>,
+    /// The number of descendants of every node.
+    sizes: Vec<u32>,
+    parents: Vec<u32>,
+}
+
+impl CompactTree {
+    /// Copies the nodes of `tree`, parsed with `grammar`.
+    pub fn new(tree: &Tree, grammar: Grammar) -> CompactTree {
+        let mut compact = CompactTree::with_capacity(grammar, 0);
+        let mut cursor = tree.walk();
+        // The ancestors of the current node.
+        let mut ancestors: Vec<u32> = Vec::new();
+        loop {
+            let node = cursor.node();
+            let index = compact.kinds.len() as u32;
+            let mut flags = 0;
+            if node.is_extra() {
+                flags |= EXTRA;
+            }
+            if node.is_missing() {
+                flags |= MISSING;
+            }
+            compact.push(
+                if node.is_error() {
+                    ERROR_KIND
+                } else {
+                    node.kind_id()
+                },
+                cursor.field_id().unwrap_or(0),
+                flags,
+                node.start_byte() as u32,
+                node.end_byte() as u32,
+                ancestors.last().copied().unwrap_or(NONE),
+            );
+            if cursor.goto_first_child() {
+                ancestors.push(index);
+                continue;
+            }
+            while !cursor.goto_next_sibling() {
+                if !cursor.goto_parent() {
+                    compact.finish();
+                    return compact;
+                }
+                let parent = ancestors.pop().unwrap();
+                compact.sizes[parent as usize] = compact.kinds.len() as u32 - parent - 1;
+            }
+        }
+    }
+
+    fn with_capacity(grammar: Grammar, capacity: usize) -> CompactTree {
+        CompactTree {
+            grammar,
+            kinds: Vec::with_capacity(capacity),
+            fields: Vec::with_capacity(capacity),
+            flags: Vec::with_capacity(capacity),
+            starts: Vec::with_capacity(capacity),
+            ends: Vec::with_capacity(capacity),
+            sizes: Vec::with_capacity(capacity),
+            parents: Vec::with_capacity(capacity),
+        }
+    }
+
+    fn push(&mut self, kind: u16, field: u16, flags: u8, start: u32, end: u32, parent: u32) {
+        self.kinds.push(kind);
+        self.fields.push(field);
+        self.flags.push(flags);
+        self.starts.push(start);
+        self.ends.push(end);
+        self.sizes.push(0);
+        self.parents.push(parent);
+    }
+
+    /// Marks the nodes with errors in them, children before parents.
+    fn finish(&mut self) {
+        for index in (0..self.kinds.len()).rev() {
+            if self.kinds[index] == ERROR_KIND || self.flags[index] & MISSING != 0 {
+                self.flags[index] |= HAS_ERROR;
+            }
+            let parent = self.parents[index];
+            if self.flags[index] & HAS_ERROR != 0 && parent != NONE {
+                self.flags[parent as usize] |= HAS_ERROR;
+            }
+        }
+    }
+
+    /// Encodes the tree, parsed from `source`, in the format above.
+    pub fn encode(&self, source: &[u8]) -> Vec<u8> {
+        let mut bytes = Vec::with_capacity(HEADER_SIZE + self.kinds.len() * 6);
+        bytes.extend_from_slice(MAGIC);
+        bytes.extend_from_slice(&grammar_hash().to_le_bytes());
+        bytes.extend_from_slice(&fnv1a(source).to_le_bytes());
+        bytes.extend_from_slice(&(source.len() as u32).to_le_bytes());
+        bytes.extend_from_slice(&(self.kinds.len() as u32).to_le_bytes());
+        bytes.push(self.grammar as u8);
+        bytes.resize(HEADER_SIZE, 0);
+
+        let mut previous_start = 0;
+        for index in 0..self.kinds.len() {
+            let flags = self.flags[index] & (EXTRA | MISSING);
+            write_number(&mut bytes, (self.kinds[index] as u32) << 2 | flags as u32);
+            write_number(&mut bytes, self.fields[index] as u32);
+            write_number(&mut bytes, self.starts[index].wrapping_sub(previous_start));
+            write_number(&mut bytes, self.ends[index] - self.starts[index]);
+            write_number(&mut bytes, self.sizes[index]);
+            previous_start = self.starts[index];
+        }
+        bytes
+    }
+
+    /// Decodes a tree encoded by [`encode`](CompactTree::encode), checking
+    /// that it was encoded by this version of the grammar from `source`, and
+    /// that its nodes nest.
+    pub fn decode(bytes: &[u8], source: &[u8]) -> io::Result<CompactTree> {
+        if bytes.len() < HEADER_SIZE || &bytes[..8] != MAGIC {
+            return Err(invalid("not an OCaml tree"));
+        }
+        let read_u32 = |offset: usize| {
+            let mut buffer = [0; 4];
+            buffer.copy_from_slice(&bytes[offset..offset + 4]);
+            u32::from_le_bytes(buffer)
+        };
+        let read_u64 = |offset: usize| {
+            let mut buffer = [0; 8];
+            buffer.copy_from_slice(&bytes[offset..offset + 8]);
+            u64::from_le_bytes(buffer)
+        };
+        if read_u64(8) != grammar_hash() {
+            return Err(invalid("the tree was encoded by another grammar"));
+        }
+        let source_length = read_u32(24);
+        if source_length as usize != source.len() || read_u64(16) != fnv1a(source) {
+            return Err(invalid("the tree was parsed from another source"));
+        }
+        let grammar = match bytes[32] {
+            0 => Grammar::Ocaml,
+            1 => Grammar::Interface,
+            _ => return Err(invalid("unknown grammar")),
+        };
+        let count = read_u32(28) as usize;
+        if count == 0 || count > (bytes.len() - HEADER_SIZE) / MIN_NODE_SIZE {
+            return Err(invalid("wrong number of nodes"));
+        }
+
+        let mut tree = CompactTree::with_capacity(grammar, count);
+        let mut reader = Reader {
+            bytes: &bytes[HEADER_SIZE..],
+        };
+        // The ancestors of the current node, with the index after their last
+        // descendant.
+        let mut ancestors: Vec<(u32, u32)> = Vec::new();
+        let mut start = 0u32;
+        for index in 0..count as u32 {
+            let kind = reader.number()?;
+            let field = reader.number()?;
+            start = start.wrapping_add(reader.number()?);
+            let end = start
+                .checked_add(reader.number()?)
+                .filter(|&end| end <= source_length)
+                .ok_or_else(|| invalid("node out of bounds"))?;
+            let size = reader.number()?;
+
+            while ancestors.last().map_or(false, |&(_, after)| after <= index) {
+                ancestors.pop();
+            }
+            let after = index
+                .checked_add(size)
+                .and_then(|last| last.checked_add(1))
+                .ok_or_else(|| invalid("too many descendants"))?;
+            let parent = match ancestors.last() {
+                Some(&(parent, parent_after)) if after <= parent_after => parent,
+                None if index == 0 && after as usize == count => NONE,
+                _ => return Err(invalid("nodes don't nest")),
+            };
+            if kind >> 2 > u16::MAX as u32 || field > u16::MAX as u32 {
+                return Err(invalid("unknown kind or field"));
+            }
+            tree.push(
+                (kind >> 2) as u16,
+                field as u16,
+                (kind & 3) as u8,
+                start,
+                end,
+                parent,
+            );
+            tree.sizes[index as usize] = size;
+            if size > 0 {
+                ancestors.push((index, after));
+            }
+        }
+        if !reader.bytes.is_empty() {
+            return Err(invalid("trailing bytes"));
+        }
+        tree.finish();
+        Ok(tree)
+    }
+
+    pub fn grammar(&self) -> Grammar {
+        self.grammar
+    }
+
+    /// The number of nodes, anonymous ones included.
+    pub fn len(&self) -> usize {
+        self.kinds.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.kinds.is_empty()
+    }
+
+    pub fn root(&self) -> CompactNode<'_> {
+        self.node(0)
+    }
+
+    /// The node at `index` in pre-order.
+    pub fn node(&self, index: u32) -> CompactNode<'_> {
+        assert!((index as usize) < self.kinds.len());
+        CompactNode { tree: self, index }
+    }
+
+    /// All the nodes, in pre-order.
+    pub fn nodes(&self) -> impl Iterator<Item = CompactNode<'_>> {
+        (0..self.kinds.len() as u32).map(move |index| CompactNode { tree: self, index })
+    }
+}
+
+/// A node of a [`CompactTree`], with the methods of a tree-sitter node that
+/// make sense without the source and the parser.
+#[derive(Clone, Copy)]
+pub struct CompactNode<'a> {
+    tree: &'a CompactTree,
+    index: u32,
+}
+
+impl<'a> CompactNode<'a> {
+    fn get<T: Copy>(&self, column: &[T]) -> T {
+        column[self.index as usize]
+    }
+
+    /// The index of the node in pre-order.
+    pub fn index(&self) -> u32 {
+        self.index
+    }
+
+    pub fn kind_id(&self) -> u16 {
+        self.get(&self.tree.kinds)
+    }
+
+    pub fn kind(&self) -> &'static str {
+        match self.kind_id() {
+            ERROR_KIND => "ERROR",
+            id => self
+                .tree
+                .grammar
+                .language()
+                .node_kind_for_id(id)
+                .unwrap_or(""),
+        }
+    }
+
+    pub fn is_named(&self) -> bool {
+        match self.kind_id() {
+            ERROR_KIND => true,
+            id => self.tree.grammar.language().node_kind_is_named(id),
+        }
+    }
+
+    pub fn is_extra(&self) -> bool {
+        self.get(&self.tree.flags) & EXTRA != 0
+    }
+
+    pub fn is_missing(&self) -> bool {
+        self.get(&self.tree.flags) & MISSING != 0
+    }
+
+    pub fn is_error(&self) -> bool {
+        self.kind_id() == ERROR_KIND
+    }
+
+    pub fn has_error(&self) -> bool {
+        self.get(&self.tree.flags) & HAS_ERROR != 0
+    }
+
+    pub fn start_byte(&self) -> usize {
+        self.get(&self.tree.starts) as usize
+    }
+
+    pub fn end_byte(&self) -> usize {
+        self.get(&self.tree.ends) as usize
+    }
+
+    pub fn byte_range(&self) -> Range<usize> {
+        self.start_byte()..self.end_byte()
+    }
+
+    /// The id of the field of the node in its parent.
+    pub fn field_id(&self) -> Option<u16> {
+        match self.get(&self.tree.fields) {
+            0 => None,
+            id => Some(id),
+        }
+    }
+
+    pub fn field_name(&self) -> Option<&'static str> {
+        self.tree
+            .grammar
+            .language()
+            .field_name_for_id(self.field_id()?)
+    }
+
+    /// The number of descendants of the node.
+    pub fn descendant_count(&self) -> usize {
+        self.get(&self.tree.sizes) as usize
+    }
+
+    pub fn parent(&self) -> Option<CompactNode<'a>> {
+        match self.get(&self.tree.parents) {
+            NONE => None,
+            index => Some(self.tree.node(index)),
+        }
+    }
+
+    pub fn child(&self, i: usize) -> Option<CompactNode<'a>> {
+        self.children().nth(i)
+    }
+
+    pub fn child_count(&self) -> usize {
+        self.children().count()
+    }
+
+    pub fn children(&self) -> Children<'a> {
+        Children {
+            tree: self.tree,
+            next: self.index + 1,
+            end: self.index + 1 + self.get(&self.tree.sizes),
+        }
+    }
+
+    pub fn next_sibling(&self) -> Option<CompactNode<'a>> {
+        let parent = self.parent()?;
+        let next = self.index + 1 + self.get(&self.tree.sizes);
+        if next <= parent.index + parent.get(&self.tree.sizes) {
+            Some(self.tree.node(next))
+        } else {
+            None
+        }
+    }
+}
+
+impl PartialEq for CompactNode<'_> {
+    fn eq(&self, other: &Self) -> bool {
+        std::ptr::eq(self.tree, other.tree) && self.index == other.index
+    }
+}
+
+impl std::fmt::Debug for CompactNode<'_> {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        write!(f, "{{{} {:?}}}", self.kind(), self.byte_range())
+    }
+}
+
+/// The children of a [`CompactNode`], skipping from one to the next over its
+/// descendants.
+pub struct Children<'a> {
+    tree: &'a CompactTree,
+    next: u32,
+    end: u32,
+}
+
+impl<'a> Iterator for Children<'a> {
+    type Item = CompactNode<'a>;
+
+    fn next(&mut self) -> Option<CompactNode<'a>> {
+        if self.next >= self.end {
+            return None;
+        }
+        let node = self.tree.node(self.next);
+        self.next += 1 + node.get(&self.tree.sizes);
+        Some(node)
+    }
+}
+
+/// Trees on disk, one file per source, named after the hashes of the grammar
+/// and of the source. The directory only grows: entries of other versions of
+/// the grammar are never read again, and can be deleted at any time.
+pub struct TreeCache {
+    dir: PathBuf,
+}
+
+impl TreeCache {
+    pub fn new(dir: impl Into<PathBuf>) -> TreeCache {
+        TreeCache { dir: dir.into() }
+    }
+
+    fn path(&self, grammar: Grammar, source: &[u8]) -> PathBuf {
+        self.dir.join(format!(
+            "{:016x}-{:016x}-{:x}.{}.tree",
+            grammar_hash(),
+            fnv1a(source),
+            source.len(),
+            grammar.extension()
+        ))
+    }
+
+    /// The tree of `source` if it is in the cache.
+    pub fn get(&self, grammar: Grammar, source: &[u8]) -> Option<CompactTree> {
+        let bytes = fs::read(self.path(grammar, source)).ok()?;
+        CompactTree::decode(&bytes, source)
+            .ok()
+            .filter(|tree| tree.grammar == grammar)
+    }
+
+    /// Stores the tree of `source`. The file is written under another name
+    /// and then renamed, so that readers never see half of it.
+    pub fn put(&self, source: &[u8], tree: &CompactTree) -> io::Result<()> {
+        fs::create_dir_all(&self.dir)?;
+        let path = self.path(tree.grammar, source);
+        let mut temporary = path.clone().into_os_string();
+        temporary.push(format!(".{}.tmp", std::process::id()));
+        fs::write(&temporary, tree.encode(source))?;
+        fs::rename(&temporary, &path)
+    }
+
+    /// Returns the tree of `source` from the cache, or parses it with `parser`
+    /// and stores it. Fails only if the tree can't be stored.
+    pub fn parse(
+        &self,
+        parser: &mut Parser,
+        grammar: Grammar,
+        source: &[u8],
+    ) -> io::Result<CompactTree> {
+        if let Some(tree) = self.get(grammar, source) {
+            return Ok(tree);
+        }
+        parser
+            .set_language(grammar.language())
+            .map_err(|error| io::Error::new(io::ErrorKind::Other, format!("{:?}", error)))?;
+        let tree = parser
+            .parse(source, None)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::Other, "parsing was cancelled"))?;
+        let tree = CompactTree::new(&tree, grammar);
+        self.put(source, &tree)?;
+        Ok(tree)
+    }
+}
+
+fn write_number(bytes: &mut Vec<u8>, mut number: u32) {
+    while number >= 0x80 {
+        bytes.push(number as u8 | 0x80);
+        number >>= 7;
+    }
+    bytes.push(number as u8);
+}
+
+struct Reader<'a> {
+    bytes: &'a [u8],
+}
+
+impl Reader<'_> {
+    /// Reads a LEB128 number of at most 32 bits.
+    fn number(&mut self) -> io::Result<u32> {
+        let mut number = 0u32;
+        for (i, &byte) in self.bytes.iter().enumerate().take(5) {
+            number |= ((byte & 0x7f) as u32) << (7 * i);
+            if byte & 0x80 == 0 {
+                self.bytes = &self.bytes[i + 1..];
+                return Ok(number);
+            }
+        }
+        Err(invalid("bad number"))
+    }
+}
+
+fn invalid(message: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message)
+}
@@ -0,0 +1,311 @@
+//! Highlights a tree, and keeps the highlights up to date after edits.
+//!
+//! The spans are the captures of [`HIGHLIGHTS_QUERY`](crate::HIGHLIGHTS_QUERY)
+//! and the injections those of [`INJECTIONS_QUERY`](crate::INJECTIONS_QUERY).
+//! Where several patterns capture the same node, the first one wins. Spans
+//! nest, like the nodes they come from.
+//!
+//! A [`Highlighter`] keeps the spans of every top-level item. After an edit it
+//! runs the queries again only over the items that the changed ranges of the
+//! tree touch, and returns what changed as a [`HighlightDiff`], so that the
+//! work, and what a client has to redraw, follows the size of the edit rather
+//! than the size of the file.
+//!
+//! ```
+//! use tree_sitter_ocaml::highlight::Highlighter;
+//!
+//! let code = "let f x = x";
+//! let mut parser = tree_sitter::Parser::new();
+//! parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//! let tree = parser.parse(code, None).unwrap();
+//!
+//! let highlighter = Highlighter::new(&tree, code.as_bytes());
+//! let span = highlighter
+//!     .spans()
+//!     .iter()
+//!     .find(|span| span.range.start == 4)
+//!     .unwrap();
+//! assert_eq!(highlighter.highlight_name(span.highlight), "function");
+//! ```
+
+use crate::queries;
+use crate::scopes::{regions, shift_byte, top_level_items};
+use std::cmp::{Ordering, Reverse};
+use std::ops::Range;
+use tree_sitter::{InputEdit, Query, QueryCursor, Tree};
+
+/// A highlighted range.
+#[derive(Clone, Debug, PartialEq, Eq, Hash)]
+pub struct Span {
+    pub range: Range<usize>,
+    /// The index of the highlight, see [`Highlighter::highlight_name`].
+    pub highlight: u32,
+}
+
+/// A range of another language.
+#[derive(Clone, Debug, PartialEq, Eq, Hash)]
+pub struct Injection {
+    pub range: Range<usize>,
+    /// The name of the language, as the query sets it.
+    pub language: String,
+}
+
+/// What an update changed. The ranges are those of the edited text, so a
+/// client moves its spans with the edits and then applies the diff.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct HighlightDiff {
+    pub removed: Vec<Span>,
+    pub added: Vec<Span>,
+    pub removed_injections: Vec<Injection>,
+    pub added_injections: Vec<Injection>,
+}
+
+impl HighlightDiff {
+    pub fn is_empty(&self) -> bool {
+        self.removed.is_empty()
+            && self.added.is_empty()
+            && self.removed_injections.is_empty()
+            && self.added_injections.is_empty()
+    }
+}
+
+/// The highlights of a tree.
+pub struct Highlighter {
+    /// The top-level items of the tree, which are queried again as a whole.
+    items: Vec<Range<usize>>,
+    /// Sorted by start, outer spans first.
+    spans: Vec<Span>,
+    /// Sorted by start.
+    injections: Vec<Injection>,
+    /// The ranges edited since the last update.
+    edited: Vec<Range<usize>>,
+}
+
+impl Highlighter {
+    /// Highlights `tree`, parsed from `source`.
+    pub fn new(tree: &Tree, source: &[u8]) -> Highlighter {
+        let root = tree.root_node();
+        Highlighter {
+            items: top_level_items(root),
+            spans: highlights(tree, source, 0..root.end_byte()),
+            injections: injections(tree, source, 0..root.end_byte()),
+            edited: Vec::new(),
+        }
+    }
+
+    /// The names of the highlights, which are the capture names of the query.
+    pub fn highlight_names() -> &'static [String] {
+        queries::ocaml_highlights().capture_names()
+    }
+
+    pub fn highlight_name(&self, highlight: u32) -> &'static str {
+        &Highlighter::highlight_names()[highlight as usize]
+    }
+
+    pub fn spans(&self) -> &[Span] {
+        &self.spans
+    }
+
+    pub fn injections(&self) -> &[Injection] {
+        &self.injections
+    }
+
+    /// Moves everything after an edit, which has to be applied to the tree as
+    /// well, before [`update`](Highlighter::update).
+    pub fn edit(&mut self, edit: &InputEdit) {
+        let shift = |range: &mut Range<usize>| {
+            range.start = shift_byte(range.start, edit);
+            range.end = shift_byte(range.end, edit);
+        };
+        self.items.iter_mut().for_each(shift);
+        self.edited.iter_mut().for_each(shift);
+        for span in &mut self.spans {
+            shift(&mut span.range);
+        }
+        for injection in &mut self.injections {
+            shift(&mut injection.range);
+        }
+        self.edited.push(edit.start_byte..edit.new_end_byte);
+    }
+
+    /// Brings the highlights up to date with `tree`, the new parse of the
+    /// edited `old_tree`, and returns what changed.
+    pub fn update(&mut self, old_tree: &Tree, tree: &Tree, source: &[u8]) -> HighlightDiff {
+        let items = top_level_items(tree.root_node());
+        let mut changed: Vec<Range<usize>> = self.edited.drain(..).collect();
+        changed.extend(
+            old_tree
+                .changed_ranges(tree)
+                .map(|range| range.start_byte..range.end_byte),
+        );
+
+        let mut diff = HighlightDiff::default();
+        for region in regions(changed, &self.items, &items) {
+            let old = splice(
+                &mut self.spans,
+                |span| span.range.start,
+                &region,
+                highlights(tree, source, region.clone()),
+            );
+            let new = spans_starting_in(&self.spans, |span| span.range.start, &region);
+            difference(&old, new, compare_spans, &mut diff.removed, &mut diff.added);
+
+            let old = splice(
+                &mut self.injections,
+                |injection| injection.range.start,
+                &region,
+                injections(tree, source, region.clone()),
+            );
+            let new =
+                spans_starting_in(&self.injections, |injection| injection.range.start, &region);
+            difference(
+                &old,
+                new,
+                compare_injections,
+                &mut diff.removed_injections,
+                &mut diff.added_injections,
+            );
+        }
+        self.items = items;
+        diff
+    }
+}
+
+fn compare_spans(a: &Span, b: &Span) -> Ordering {
+    (a.range.start, Reverse(a.range.end), a.highlight).cmp(&(
+        b.range.start,
+        Reverse(b.range.end),
+        b.highlight,
+    ))
+}
+
+fn compare_injections(a: &Injection, b: &Injection) -> Ordering {
+    (a.range.start, a.range.end, &a.language).cmp(&(b.range.start, b.range.end, &b.language))
+}
+
+/// Runs the highlights query over `range`, keeping the captures that start in
+/// it. The query is compiled for OCaml, but both languages share their node
+/// types.
+fn highlights(tree: &Tree, source: &[u8], range: Range<usize>) -> Vec<Span> {
+    let query = queries::ocaml_highlights();
+    let mut captures = Vec::new();
+    let mut cursor = QueryCursor::new();
+    cursor.set_byte_range(range.clone());
+    for (query_match, i) in cursor.captures(query, tree.root_node(), source) {
+        let capture = query_match.captures[i];
+        let node = capture.node;
+        if range.contains(&node.start_byte()) {
+            captures.push((
+                node.byte_range(),
+                node.id(),
+                query_match.pattern_index,
+                capture.index,
+            ));
+        }
+    }
+
+    // The first pattern that captures a node wins.
+    captures
+        .sort_by_key(|(range, id, pattern, _)| (range.start, Reverse(range.end), *id, *pattern));
+    captures.dedup_by_key(|(_, id, _, _)| *id);
+    let mut spans: Vec<Span> = captures
+        .into_iter()
+        .map(|(range, _, _, highlight)| Span { range, highlight })
+        .collect();
+    spans.sort_by(compare_spans);
+    spans
+}
+
+/// Runs the injections query over `range`, keeping the injections that start
+/// in it.
+fn injections(tree: &Tree, source: &[u8], range: Range<usize>) -> Vec<Injection> {
+    let query = queries::ocaml_injections();
+    let content = query.capture_index_for_name("injection.content");
+    let language = query.capture_index_for_name("injection.language");
+    let mut injections = Vec::new();
+    let mut cursor = QueryCursor::new();
+    cursor.set_byte_range(range.clone());
+    for query_match in cursor.matches(query, tree.root_node(), source) {
+        let mut content_range = None;
+        let mut name = injection_language(query, query_match.pattern_index);
+        for capture in query_match.captures {
+            if Some(capture.index) == content {
+                content_range = Some(capture.node.byte_range());
+            } else if Some(capture.index) == language {
+                name = capture.node.utf8_text(source).ok().map(String::from);
+            }
+        }
+        if let (Some(content_range), Some(name)) = (content_range, name) {
+            if range.contains(&content_range.start) {
+                injections.push(Injection {
+                    range: content_range,
+                    language: name,
+                });
+            }
+        }
+    }
+    injections.sort_by(compare_injections);
+    injections.dedup();
+    injections
+}
+
+/// The language a pattern sets with `#set! injection.language`.
+pub(crate) fn injection_language(query: &Query, pattern_index: usize) -> Option<String> {
+    query
+        .property_settings(pattern_index)
+        .iter()
+        .find(|property| &*property.key == "injection.language")
+        .and_then(|property| property.value.as_deref().map(String::from))
+}
+
+fn spans_starting_in<'a, T>(
+    items: &'a [T],
+    start: impl Fn(&T) -> usize,
+    range: &Range<usize>,
+) -> &'a [T] {
+    let lo = items.partition_point(|item| start(item) < range.start);
+    let hi = items.partition_point(|item| start(item) < range.end);
+    &items[lo..hi]
+}
+
+/// Replaces what starts in `range` with `new`, and returns what it replaced.
+fn splice<T>(
+    items: &mut Vec<T>,
+    start: impl Fn(&T) -> usize,
+    range: &Range<usize>,
+    new: Vec<T>,
+) -> Vec<T> {
+    let lo = items.partition_point(|item| start(item) < range.start);
+    let hi = items.partition_point(|item| start(item) < range.end);
+    items.splice(lo..hi, new).collect()
+}
+
+/// Adds what is only in `old` to `removed` and what is only in `new` to
+/// `added`. Both are sorted by `compare`.
+fn difference<T: Clone>(
+    old: &[T],
+    new: &[T],
+    compare: fn(&T, &T) -> Ordering,
+    removed: &mut Vec<T>,
+    added: &mut Vec<T>,
+) {
+    let (mut i, mut j) = (0, 0);
+    while i < old.len() && j < new.len() {
+        match compare(&old[i], &new[j]) {
+            Ordering::Less => {
+                removed.push(old[i].clone());
+                i += 1;
+            }
+            Ordering::Greater => {
+                added.push(new[j].clone());
+                j += 1;
+            }
+            Ordering::Equal => {
+                i += 1;
+                j += 1;
+            }
+        }
+    }
+    removed.extend_from_slice(&old[i..]);
+    added.extend_from_slice(&new[j..]);
+}
@@ -0,0 +1,649 @@
+//! A persistent symbol index built with the tagging query.
+//!
+//! [`update`] runs [`TAGGING_QUERY`](crate::TAGGING_QUERY) over the `.ml` and
+//! `.mli` files of a workspace and stores the names it tags in a single file,
+//! which [`Index::open`] maps into memory. A later update only parses the
+//! files whose content changed: files whose size and modification time are
+//! unchanged aren't even read, and the others are read and hashed first. The
+//! tags of unchanged files are carried over from the old index. Files whose
+//! parse goes over the budget are kept without tags and flagged, and are
+//! parsed again by the next update.
+//!
+//! Documentation comments captured as `@doc` aren't indexed.
+//!
+//! # Format
+//!
+//! All numbers are little-endian, and all offsets are from the start of the
+//! file. The file starts with a 64 byte header:
+//!
+//! | offset | size | content                                          |
+//! |--------|------|--------------------------------------------------|
+//! | 0      | 8    | `OCTAGS\0\x02`                                   |
+//! | 8      | 8    | grammar hash, see [`grammar_hash`]               |
+//! | 16     | 16   | number of files, names, postings, string bytes   |
+//! | 32     | 16   | offsets of the files, names, postings, strings   |
+//! | 48     | 16   | zero                                             |
+//!
+//! followed by the tables:
+//!
+//! - files, 40 bytes each: path offset and length into the strings, flags
+//!   and zero (`u32` each), FNV-1a hash of the content, size and modification
+//!   time in nanoseconds since the epoch (`u64` each). Bit 0 of the flags is
+//!   set for files whose parse went over the budget;
+//! - names, 16 bytes each, sorted by name: name offset and length into the
+//!   strings, first posting and number of postings (`u32` each);
+//! - postings, 24 bytes each, sorted by definitions first, then file and
+//!   position: file, flags, start byte, end byte, row and column of the name
+//!   (`u32` each). Bit 0 of the flags is set for definitions, and bits 8 to 15
+//!   hold the index of the kind in [`KINDS`];
+//! - strings, the bytes of all names and paths.
+
+use crate::batch::{self, Parsers};
+use crate::hash::{fnv1a, fnv1a_extend};
+use memmap2::Mmap;
+use std::collections::{BTreeMap, HashMap};
+use std::fs::{self, File};
+use std::io::{self, Write};
+use std::path::{Path, PathBuf};
+use std::time::UNIX_EPOCH;
+use tree_sitter::{Query, QueryCursor, Tree};
+
+const MAGIC: &[u8; 8] = b"OCTAGS\0\x02";
+const HEADER_SIZE: usize = 64;
+const FILE_SIZE: usize = 40;
+const NAME_SIZE: usize = 16;
+const POSTING_SIZE: usize = 24;
+
+/// The kinds of tags, as in the `@definition.<kind>` and `@reference.<kind>`
+/// captures of the tagging query.
+pub const KINDS: &[&str] = &[
+    "module",
+    "interface",
+    "function",
+    "class",
+    "method",
+    "call",
+    "implementation",
+];
+
+/// A hash of everything the tags depend on besides the files: the crate
+/// version, the grammars, the tagging query and the node types of both
+/// grammars. An index with another hash is rebuilt from scratch.
+pub fn grammar_hash() -> u64 {
+    let mut hash = fnv1a_extend(
+        fnv1a(env!("CARGO_PKG_VERSION").as_bytes()),
+        env!("TREE_SITTER_OCAML_GRAMMAR_HASH").as_bytes(),
+    );
+    for part in &[
+        crate::TAGGING_QUERY,
+        crate::OCAML_NODE_TYPES,
+        crate::INTERFACE_NODE_TYPES,
+    ] {
+        hash = fnv1a_extend(hash, part.as_bytes());
+    }
+    hash
+}
+
+fn read_u32(bytes: &[u8], offset: usize) -> u32 {
+    let mut buffer = [0; 4];
+    buffer.copy_from_slice(&bytes[offset..offset + 4]);
+    u32::from_le_bytes(buffer)
+}
+
+fn read_u64(bytes: &[u8], offset: usize) -> u64 {
+    let mut buffer = [0; 8];
+    buffer.copy_from_slice(&bytes[offset..offset + 8]);
+    u64::from_le_bytes(buffer)
+}
+
+fn invalid(message: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message)
+}
+
+/// A tagged occurrence of a name.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+pub struct Posting {
+    /// Sorts definitions first.
+    is_reference: bool,
+    pub file: u32,
+    pub start_byte: u32,
+    pub end_byte: u32,
+    pub row: u32,
+    pub column: u32,
+    kind: u8,
+}
+
+impl Posting {
+    pub fn is_definition(&self) -> bool {
+        !self.is_reference
+    }
+
+    pub fn kind(&self) -> &'static str {
+        KINDS[self.kind as usize]
+    }
+
+    fn flags(&self) -> u32 {
+        (self.kind as u32) << 8 | !self.is_reference as u32
+    }
+
+    fn read(bytes: &[u8]) -> Posting {
+        let flags = read_u32(bytes, 4);
+        Posting {
+            is_reference: flags & 1 == 0,
+            file: read_u32(bytes, 0),
+            start_byte: read_u32(bytes, 8),
+            end_byte: read_u32(bytes, 12),
+            row: read_u32(bytes, 16),
+            column: read_u32(bytes, 20),
+            kind: (flags >> 8) as u8,
+        }
+    }
+}
+
+/// An indexed file.
+#[derive(Clone, Debug)]
+pub struct FileEntry<'a> {
+    pub path: &'a str,
+    pub hash: u64,
+    pub size: u64,
+    pub modified: u64,
+    /// Whether the parse of the file went over the budget. The file has no
+    /// tags then, and is parsed again by the next update.
+    pub failed: bool,
+}
+
+/// An index file mapped into memory.
+pub struct Index {
+    map: Mmap,
+    grammar_hash: u64,
+    file_count: usize,
+    name_count: usize,
+    files: usize,
+    names: usize,
+    postings: usize,
+    strings: usize,
+    strings_length: usize,
+}
+
+impl Index {
+    /// Maps the index at `path` and checks that its tables are in bounds, and
+    /// that every posting refers to a file of the index and a kind of
+    /// [`KINDS`].
+    pub fn open(path: &Path) -> io::Result<Index> {
+        let file = File::open(path)?;
+        let map = unsafe { Mmap::map(&file)? };
+        if map.len() < HEADER_SIZE || &map[..8] != MAGIC {
+            return Err(invalid("not an OCaml tags index"));
+        }
+        let count = |i: usize| read_u32(&map, 16 + 4 * i) as usize;
+        let offset = |i: usize| read_u32(&map, 32 + 4 * i) as usize;
+        let posting_count = count(2);
+        let index = Index {
+            grammar_hash: read_u64(&map, 8),
+            file_count: count(0),
+            name_count: count(1),
+            files: offset(0),
+            names: offset(1),
+            postings: offset(2),
+            strings: offset(3),
+            strings_length: count(3),
+            map,
+        };
+        let fits = |start: usize, length: usize| {
+            start
+                .checked_add(length)
+                .map_or(false, |end| end <= index.map.len())
+        };
+        if !fits(index.files, index.file_count * FILE_SIZE)
+            || !fits(index.names, index.name_count * NAME_SIZE)
+            || !fits(index.postings, posting_count * POSTING_SIZE)
+            || !fits(index.strings, index.strings_length)
+        {
+            return Err(invalid("truncated OCaml tags index"));
+        }
+        for i in 0..index.name_count {
+            let name = index.name_at(i);
+            let start = read_u32(name, 8) as usize;
+            let length = read_u32(name, 12) as usize;
+            if start
+                .checked_add(length)
+                .map_or(true, |end| end > posting_count)
+            {
+                return Err(invalid("corrupt OCaml tags index"));
+            }
+        }
+        for i in 0..posting_count {
+            let offset = index.postings + i * POSTING_SIZE;
+            let posting = &index.map[offset..offset + POSTING_SIZE];
+            if read_u32(posting, 0) as usize >= index.file_count
+                || (read_u32(posting, 4) >> 8) as usize >= KINDS.len()
+            {
+                return Err(invalid("corrupt OCaml tags index"));
+            }
+        }
+        Ok(index)
+    }
+
+    pub fn grammar_hash(&self) -> u64 {
+        self.grammar_hash
+    }
+
+    pub fn file_count(&self) -> usize {
+        self.file_count
+    }
+
+    pub fn name_count(&self) -> usize {
+        self.name_count
+    }
+
+    fn string(&self, offset: u32, length: u32) -> &[u8] {
+        let start = (offset as usize).min(self.strings_length);
+        let end = start
+            .saturating_add(length as usize)
+            .min(self.strings_length);
+        &self.map[self.strings + start..self.strings + end]
+    }
+
+    /// The file with the id `id`, as in [`Posting::file`], or `None` if there
+    /// is none.
+    pub fn file(&self, id: u32) -> Option<FileEntry<'_>> {
+        if id as usize >= self.file_count {
+            return None;
+        }
+        let offset = self.files + id as usize * FILE_SIZE;
+        let entry = &self.map[offset..offset + FILE_SIZE];
+        Some(FileEntry {
+            path: std::str::from_utf8(self.string(read_u32(entry, 0), read_u32(entry, 4)))
+                .unwrap_or(""),
+            hash: read_u64(entry, 16),
+            size: read_u64(entry, 24),
+            modified: read_u64(entry, 32),
+            failed: read_u32(entry, 8) & 1 != 0,
+        })
+    }
+
+    pub fn files(&self) -> impl Iterator<Item = FileEntry<'_>> + '_ {
+        (0..self.file_count as u32).filter_map(move |id| self.file(id))
+    }
+
+    fn name_at(&self, i: usize) -> &[u8] {
+        let offset = self.names + i * NAME_SIZE;
+        &self.map[offset..offset + NAME_SIZE]
+    }
+
+    /// The indexed names, in order.
+    pub fn names(&self) -> impl Iterator<Item = &[u8]> + '_ {
+        (0..self.name_count).map(move |i| {
+            let name = self.name_at(i);
+            self.string(read_u32(name, 0), read_u32(name, 4))
+        })
+    }
+
+    fn postings_at(&self, i: usize) -> impl Iterator<Item = Posting> + '_ {
+        let name = self.name_at(i);
+        let start = self.postings + read_u32(name, 8) as usize * POSTING_SIZE;
+        let count = read_u32(name, 12) as usize;
+        (0..count).map(move |j| {
+            let offset = start + j * POSTING_SIZE;
+            Posting::read(&self.map[offset..offset + POSTING_SIZE])
+        })
+    }
+
+    /// Returns the definitions of `name`, then its references.
+    pub fn lookup(&self, name: &str) -> impl Iterator<Item = Posting> + '_ {
+        let (mut low, mut high) = (0, self.name_count);
+        while low < high {
+            let middle = (low + high) / 2;
+            let entry = self.name_at(middle);
+            let candidate = self.string(read_u32(entry, 0), read_u32(entry, 4));
+            if candidate < name.as_bytes() {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        let found = low < self.name_count && {
+            let entry = self.name_at(low);
+            self.string(read_u32(entry, 0), read_u32(entry, 4)) == name.as_bytes()
+        };
+        let postings: Box<dyn Iterator<Item = Posting>> = if found {
+            Box::new(self.postings_at(low))
+        } else {
+            Box::new(std::iter::empty())
+        };
+        postings
+    }
+
+    pub fn definitions(&self, name: &str) -> impl Iterator<Item = Posting> + '_ {
+        self.lookup(name).take_while(Posting::is_definition)
+    }
+
+    pub fn references(&self, name: &str) -> impl Iterator<Item = Posting> + '_ {
+        self.lookup(name).skip_while(Posting::is_definition)
+    }
+}
+
+// Tagging
+
+fn tags_query(path: &Path) -> &'static Query {
+    match path.extension().and_then(|extension| extension.to_str()) {
+        Some("mli") => crate::queries::interface_tags(),
+        _ => crate::queries::ocaml_tags(),
+    }
+}
+
+/// A tag of a file, before the file gets its id.
+struct Tag {
+    name: Vec<u8>,
+    posting: Posting,
+}
+
+fn tags(query: &Query, tree: &Tree, text: &[u8]) -> Vec<Tag> {
+    let mut roles = Vec::with_capacity(query.capture_names().len());
+    for name in query.capture_names() {
+        let role = if let Some(kind) = name.strip_prefix("definition.") {
+            Some((false, kind))
+        } else if let Some(kind) = name.strip_prefix("reference.") {
+            Some((true, kind))
+        } else {
+            None
+        };
+        roles.push(role.and_then(|(is_reference, kind)| {
+            let kind = KINDS.iter().position(|k| *k == kind)?;
+            Some((is_reference, kind as u8))
+        }));
+    }
+    let name_index = query.capture_index_for_name("name");
+
+    let mut tags = Vec::new();
+    let mut cursor = QueryCursor::new();
+    for query_match in cursor.matches(query, tree.root_node(), text) {
+        let name = query_match
+            .captures
+            .iter()
+            .find(|capture| Some(capture.index) == name_index);
+        let role = query_match
+            .captures
+            .iter()
+            .find_map(|capture| roles[capture.index as usize]);
+        if let (Some(name), Some((is_reference, kind))) = (name, role) {
+            let node = name.node;
+            tags.push(Tag {
+                name: text[node.byte_range()].to_vec(),
+                posting: Posting {
+                    is_reference,
+                    file: 0,
+                    start_byte: node.start_byte() as u32,
+                    end_byte: node.end_byte() as u32,
+                    row: node.start_position().row as u32,
+                    column: node.start_position().column as u32,
+                    kind,
+                },
+            });
+        }
+    }
+    tags
+}
+
+// Updating
+
+/// What an update did.
+#[derive(Clone, Debug, Default)]
+pub struct UpdateStats {
+    pub files: usize,
+    /// Files that were parsed, because they are new or their content changed.
+    pub parsed: usize,
+    /// Files whose tags were taken from the old index.
+    pub reused: usize,
+    /// Files that couldn't be read, or whose parse went over
+    /// [`Options::budget`](batch::Options::budget). The latter are kept in the
+    /// index, see [`FileEntry::failed`].
+    pub failed: usize,
+    pub names: usize,
+    pub postings: usize,
+}
+
+fn modified_nanos(metadata: &fs::Metadata) -> u64 {
+    metadata
+        .modified()
+        .ok()
+        .and_then(|time| time.duration_since(UNIX_EPOCH).ok())
+        .map_or(0, |duration| duration.as_nanos() as u64)
+}
+
+struct NewFile {
+    path: String,
+    hash: u64,
+    size: u64,
+    modified: u64,
+    /// The tags of the file, or `None` to keep the ones in the old index.
+    tags: Option<Vec<Tag>>,
+    failed: bool,
+}
+
+/// Brings the index at `index_path` up to date with the `.ml` and `.mli` files
+/// under `roots`, creating it if needed.
+pub fn update(
+    index_path: &Path,
+    roots: &[PathBuf],
+    options: &batch::Options,
+) -> io::Result<UpdateStats> {
+    let old = match Index::open(index_path) {
+        Ok(index) if index.grammar_hash() == grammar_hash() => Some(index),
+        _ => None,
+    };
+    let mut old_files: HashMap<&str, (u32, FileEntry)> = HashMap::new();
+    if let Some(old) = &old {
+        for (id, entry) in old.files().enumerate() {
+            old_files.insert(entry.path, (id as u32, entry));
+        }
+    }
+
+    let mut paths = batch::discover(roots)?;
+    paths.sort();
+    paths.dedup();
+
+    let mut stats = UpdateStats::default();
+    let mut new_files = Vec::with_capacity(paths.len());
+    let mut changed = Vec::new();
+    for path in paths {
+        let path_string = path.to_string_lossy().into_owned();
+        let metadata = match fs::metadata(&path) {
+            Ok(metadata) => metadata,
+            Err(_) => {
+                stats.failed += 1;
+                continue;
+            }
+        };
+        let (size, modified) = (metadata.len(), modified_nanos(&metadata));
+        match old_files.get(path_string.as_str()) {
+            Some((_, entry))
+                if entry.size == size
+                    && entry.modified == modified
+                    && modified != 0
+                    && !entry.failed =>
+            {
+                new_files.push(NewFile {
+                    path: path_string,
+                    hash: entry.hash,
+                    size,
+                    modified,
+                    tags: None,
+                    failed: false,
+                });
+            }
+            _ => changed.push(path),
+        }
+    }
+
+    // Files that may have changed are read, hashed, and parsed if their hash
+    // differs from the old one.
+    let old_files = &old_files;
+    batch::map_files(
+        changed,
+        options,
+        |parsers: &mut Parsers, path: PathBuf, _| -> Option<NewFile> {
+            let text = fs::read(&path).ok()?;
+            let metadata = fs::metadata(&path).ok()?;
+            let path_string = path.to_string_lossy().into_owned();
+            let hash = fnv1a(&text);
+            let unchanged = old_files
+                .get(path_string.as_str())
+                .map_or(false, |(_, entry)| entry.hash == hash && !entry.failed);
+            let (tags, failed) = if unchanged {
+                (None, false)
+            } else {
+                let parser = parsers.for_path(&path)?;
+                match batch::parse_within(parser, &text, &options.budget) {
+                    Ok(tree) => (Some(self::tags(tags_query(&path), &tree, &text)), false),
+                    Err(_) => (Some(Vec::new()), true),
+                }
+            };
+            Some(NewFile {
+                path: path_string,
+                hash,
+                size: text.len() as u64,
+                modified: modified_nanos(&metadata),
+                tags,
+                failed,
+            })
+        },
+        |file| match file {
+            Some(file) => {
+                if file.failed {
+                    stats.failed += 1;
+                }
+                new_files.push(file);
+            }
+            None => stats.failed += 1,
+        },
+    );
+    new_files.sort_by(|a, b| a.path.cmp(&b.path));
+
+    // Collect the postings by name. The old index is walked once for the
+    // tags of the files that are kept.
+    let mut by_name: BTreeMap<Vec<u8>, Vec<Posting>> = BTreeMap::new();
+    let mut kept: HashMap<u32, u32> = HashMap::new();
+    for (id, file) in new_files.iter_mut().enumerate() {
+        let id = id as u32;
+        match file.tags.take() {
+            Some(tags) => {
+                if !file.failed {
+                    stats.parsed += 1;
+                }
+                for tag in tags {
+                    by_name.entry(tag.name).or_default().push(Posting {
+                        file: id,
+                        ..tag.posting
+                    });
+                }
+            }
+            None => {
+                stats.reused += 1;
+                kept.insert(old_files[file.path.as_str()].0, id);
+            }
+        }
+    }
+    if let Some(old) = &old {
+        if !kept.is_empty() {
+            for (i, name) in old.names().enumerate() {
+                for posting in old.postings_at(i) {
+                    if let Some(&id) = kept.get(&posting.file) {
+                        by_name.entry(name.to_vec()).or_default().push(Posting {
+                            file: id,
+                            ..posting
+                        });
+                    }
+                }
+            }
+        }
+    }
+
+    stats.files = new_files.len();
+    stats.names = by_name.len();
+    stats.postings = by_name.values().map(Vec::len).sum();
+    drop(old);
+    write(index_path, &new_files, by_name)?;
+    Ok(stats)
+}
+
+fn write(
+    index_path: &Path,
+    files: &[NewFile],
+    by_name: BTreeMap<Vec<u8>, Vec<Posting>>,
+) -> io::Result<()> {
+    let posting_count: usize = by_name.values().map(Vec::len).sum();
+    let mut strings = Vec::new();
+    let mut file_table = Vec::with_capacity(files.len() * FILE_SIZE);
+    for file in files {
+        file_table.extend_from_slice(&(strings.len() as u32).to_le_bytes());
+        file_table.extend_from_slice(&(file.path.len() as u32).to_le_bytes());
+        file_table.extend_from_slice(&(file.failed as u32).to_le_bytes());
+        file_table.extend_from_slice(&0u32.to_le_bytes());
+        file_table.extend_from_slice(&file.hash.to_le_bytes());
+        file_table.extend_from_slice(&file.size.to_le_bytes());
+        file_table.extend_from_slice(&file.modified.to_le_bytes());
+        strings.extend_from_slice(file.path.as_bytes());
+    }
+
+    let mut name_table = Vec::with_capacity(by_name.len() * NAME_SIZE);
+    let mut posting_table = Vec::with_capacity(posting_count * POSTING_SIZE);
+    let mut first_posting = 0u32;
+    for (name, mut postings) in by_name {
+        postings.sort();
+        postings.dedup();
+        name_table.extend_from_slice(&(strings.len() as u32).to_le_bytes());
+        name_table.extend_from_slice(&(name.len() as u32).to_le_bytes());
+        name_table.extend_from_slice(&first_posting.to_le_bytes());
+        name_table.extend_from_slice(&(postings.len() as u32).to_le_bytes());
+        strings.extend_from_slice(&name);
+        for posting in &postings {
+            for value in &[
+                posting.file,
+                posting.flags(),
+                posting.start_byte,
+                posting.end_byte,
+                posting.row,
+                posting.column,
+            ] {
+                posting_table.extend_from_slice(&value.to_le_bytes());
+            }
+        }
+        first_posting += postings.len() as u32;
+    }
+
+    let files_offset = HEADER_SIZE;
+    let names_offset = files_offset + file_table.len();
+    let postings_offset = names_offset + name_table.len();
+    let strings_offset = postings_offset + posting_table.len();
+    let mut header = Vec::with_capacity(HEADER_SIZE);
+    header.extend_from_slice(MAGIC);
+    header.extend_from_slice(&grammar_hash().to_le_bytes());
+    for value in &[
+        files.len(),
+        name_table.len() / NAME_SIZE,
+        first_posting as usize,
+        strings.len(),
+        files_offset,
+        names_offset,
+        postings_offset,
+        strings_offset,
+    ] {
+        header.extend_from_slice(&(*value as u32).to_le_bytes());
+    }
+    header.resize(HEADER_SIZE, 0);
+
+    // Write next to the index and move it in place, so that readers that
+    // still map the old index aren't affected.
+    let mut temporary = index_path.as_os_str().to_owned();
+    temporary.push(".tmp");
+    let temporary = PathBuf::from(temporary);
+    let mut file = io::BufWriter::new(File::create(&temporary)?);
+    for part in &[header, file_table, name_table, posting_table, strings] {
+        file.write_all(part)?;
+    }
+    file.into_inner()
+        .map_err(|error| error.into_error())?
+        .sync_all()?;
+    fs::rename(&temporary, index_path)
+}
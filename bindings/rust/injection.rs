@@ -0,0 +1,229 @@
+//! Parses the payloads of [`INJECTIONS_QUERY`](crate::INJECTIONS_QUERY), like
+//! the HTML of `{%html|...|}`, lazily.
+//!
+//! An [`InjectionManager`] only parses the payloads that overlap the range it
+//! is asked about, typically what is on screen, and keeps their trees by the
+//! hash of their text. A payload parsed before, anywhere in the file, is not
+//! parsed again. After an edit, only the payload that was edited is.
+//!
+//! Interpolations like `${user.name}` are part of the OCaml tree, as
+//! `string_interpolation` nodes. They are left out of the payload when it is
+//! parsed, and handed back with its tree as the OCaml nodes that fill the
+//! holes.
+//!
+//! ```
+//! use tree_sitter_ocaml::injection::InjectionManager;
+//!
+//! let code = "let page = {%html|<p>${name}</p>|}";
+//! let mut parser = tree_sitter::Parser::new();
+//! parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//! let tree = parser.parse(code, None).unwrap();
+//!
+//! let mut injections = InjectionManager::new();
+//! // With the HTML grammar of your choice.
+//! # let html = tree_sitter_ocaml::language_ocaml();
+//! injections.add_language("html", html);
+//! let injected = injections.injections(&tree, code.as_bytes(), 0..code.len());
+//! assert_eq!(injected[0].holes[0].kind(), "string_interpolation");
+//! ```
+
+use crate::hash::fnv1a;
+use crate::highlight::injection_language;
+use crate::queries;
+use std::collections::HashMap;
+use std::ops::Range;
+use tree_sitter::{Language, Node, Parser, Point, QueryCursor, Tree};
+
+/// The tree of a payload.
+pub struct InjectedTree<'a> {
+    pub language: &'a str,
+    /// The range of the payload in the OCaml source. The nodes of `tree` are
+    /// relative to its start.
+    pub range: Range<usize>,
+    pub tree: &'a Tree,
+    /// The interpolations in the payload, which its tree leaves out.
+    pub holes: Vec<Node<'a>>,
+}
+
+struct Entry {
+    tree: Tree,
+    /// Whether the tree was handed out since the last
+    /// [`InjectionManager::clear_unused`].
+    used: bool,
+}
+
+/// The trees of the payloads of a file, parsed on demand.
+pub struct InjectionManager {
+    languages: HashMap<String, Language>,
+    parser: Parser,
+    /// By language and hash of the payload.
+    trees: HashMap<(String, u64), Entry>,
+}
+
+impl InjectionManager {
+    pub fn new() -> InjectionManager {
+        InjectionManager {
+            languages: HashMap::new(),
+            parser: Parser::new(),
+            trees: HashMap::new(),
+        }
+    }
+
+    /// Parses the payloads of language `name` with `language`. Payloads of
+    /// languages that weren't added are left alone.
+    pub fn add_language(&mut self, name: &str, language: Language) {
+        self.languages.insert(name.to_string(), language);
+    }
+
+    /// The trees of the payloads of `tree`, parsed from `source`, that
+    /// overlap `range`, parsing those that aren't cached.
+    pub fn injections<'a>(
+        &'a mut self,
+        tree: &'a Tree,
+        source: &[u8],
+        range: Range<usize>,
+    ) -> Vec<InjectedTree<'a>> {
+        let payloads = payloads(tree, source, range);
+        for payload in &payloads {
+            if let Some(&language) = self.languages.get(&payload.language) {
+                let key = (payload.language.clone(), payload.hash);
+                let parser = &mut self.parser;
+                self.trees
+                    .entry(key)
+                    .or_insert_with(|| Entry {
+                        tree: parse(parser, language, source, payload),
+                        used: false,
+                    })
+                    .used = true;
+            }
+        }
+
+        let trees = &self.trees;
+        let languages = &self.languages;
+        payloads
+            .into_iter()
+            .filter_map(|payload| {
+                let (language, _) = languages.get_key_value(&payload.language)?;
+                let entry = trees.get(&(payload.language, payload.hash))?;
+                Some(InjectedTree {
+                    language,
+                    range: payload.range,
+                    tree: &entry.tree,
+                    holes: payload.holes,
+                })
+            })
+            .collect()
+    }
+
+    /// The number of trees in the cache.
+    pub fn cached(&self) -> usize {
+        self.trees.len()
+    }
+
+    /// Drops the trees that weren't handed out since the last call, such as
+    /// those of payloads that were edited or scrolled away from.
+    pub fn clear_unused(&mut self) {
+        self.trees.retain(|_, entry| entry.used);
+        for entry in self.trees.values_mut() {
+            entry.used = false;
+        }
+    }
+}
+
+impl Default for InjectionManager {
+    fn default() -> Self {
+        InjectionManager::new()
+    }
+}
+
+struct Payload<'a> {
+    language: String,
+    range: Range<usize>,
+    holes: Vec<Node<'a>>,
+    hash: u64,
+}
+
+/// Finds the payloads that overlap `range` with the injections query.
+fn payloads<'a>(tree: &'a Tree, source: &[u8], range: Range<usize>) -> Vec<Payload<'a>> {
+    let query = queries::ocaml_injections();
+    let content = query.capture_index_for_name("injection.content");
+    let language = query.capture_index_for_name("injection.language");
+    let mut payloads: Vec<Payload> = Vec::new();
+    let mut cursor = QueryCursor::new();
+    cursor.set_byte_range(range);
+    for query_match in cursor.matches(query, tree.root_node(), source) {
+        let mut node = None;
+        let mut name = injection_language(query, query_match.pattern_index);
+        for capture in query_match.captures {
+            if Some(capture.index) == content {
+                node = Some(capture.node);
+            } else if Some(capture.index) == language {
+                name = capture.node.utf8_text(source).ok().map(String::from);
+            }
+        }
+        if let (Some(node), Some(name)) = (node, name) {
+            if payloads
+                .iter()
+                .any(|payload| payload.range == node.byte_range())
+            {
+                continue;
+            }
+            let mut cursor = node.walk();
+            let holes: Vec<Node> = node
+                .named_children(&mut cursor)
+                .filter(|child| child.kind() == "string_interpolation")
+                .collect();
+            payloads.push(Payload {
+                hash: fnv1a(&source[node.byte_range()]),
+                language: name,
+                range: node.byte_range(),
+                holes,
+            });
+        }
+    }
+    payloads
+}
+
+/// Parses a payload on its own, without its holes.
+fn parse(parser: &mut Parser, language: Language, source: &[u8], payload: &Payload) -> Tree {
+    let text = &source[payload.range.clone()];
+    let offset = payload.range.start;
+    let mut ranges = Vec::new();
+    let mut start = 0;
+    for hole in &payload.holes {
+        let end = hole.start_byte() - offset;
+        if start < end {
+            ranges.push(range(text, start..end));
+        }
+        start = hole.end_byte() - offset;
+    }
+    if !payload.holes.is_empty() && (start < text.len() || ranges.is_empty()) {
+        ranges.push(range(text, start..text.len()));
+    }
+
+    parser.set_language(language).unwrap();
+    // With no ranges, the whole text is parsed. A payload that is all holes
+    // has an empty range instead.
+    parser.set_included_ranges(&ranges).unwrap();
+    let tree = parser.parse(text, None).unwrap();
+    parser.set_included_ranges(&[]).unwrap();
+    tree
+}
+
+fn range(text: &[u8], bytes: Range<usize>) -> tree_sitter::Range {
+    tree_sitter::Range {
+        start_byte: bytes.start,
+        end_byte: bytes.end,
+        start_point: point(text, bytes.start),
+        end_point: point(text, bytes.end),
+    }
+}
+
+fn point(text: &[u8], byte: usize) -> Point {
+    let row = text[..byte].iter().filter(|&&c| c == b'\n').count();
+    let line_start = text[..byte]
+        .iter()
+        .rposition(|&c| c == b'\n')
+        .map_or(0, |i| i + 1);
+    Point::new(row, byte - line_start)
+}
@@ -26,9 +26,30 @@
 
 use tree_sitter::Language;
 
+#[cfg(feature = "arena")]
+pub mod arena;
+#[cfg(feature = "batch")]
+pub mod batch;
+#[cfg(feature = "cache")]
+pub mod compact;
+mod hash;
+pub mod highlight;
+#[cfg(feature = "index")]
+pub mod index;
+pub mod injection;
+#[cfg(feature = "mmap")]
+pub mod mapped;
+pub mod phrases;
+pub mod queries;
+#[cfg(feature = "scanner-stats")]
+pub mod scanner_stats;
+pub mod scopes;
+
 extern "C" {
     fn tree_sitter_ocaml() -> Language;
     fn tree_sitter_ocaml_interface() -> Language;
+    #[cfg(feature = "outline")]
+    fn tree_sitter_ocaml_outline() -> Language;
 }
 
 /// Get the tree-sitter [Language][] for OCaml.
@@ -45,19 +66,38 @@ pub fn language_ocaml_interface() -> Language {
     unsafe { tree_sitter_ocaml_interface() }
 }
 
+/// Get the tree-sitter [Language][] for the outline of OCaml implementations.
+///
+/// The outline grammar parses items, classes and the patterns of bindings like
+/// the OCaml grammar, but takes the expressions they bind as single
+/// `skimmed_expression` nodes, or as a `fun_expression` or
+/// `function_expression` around one. It parses much faster, and is enough for
+/// the definitions of [`TAGGING_QUERY`], though not the references within
+/// bodies.
+///
+/// [Language]: https://docs.rs/tree-sitter/*/tree_sitter/struct.Language.html
+#[cfg(feature = "outline")]
+pub fn language_ocaml_outline() -> Language {
+    unsafe { tree_sitter_ocaml_outline() }
+}
+
 /// The content of the [`node-types.json`][] file for OCaml.
 ///
 /// [`node-types.json`]: https://tree-sitter.github.io/tree-sitter/using-parsers#static-node-types
 pub const OCAML_NODE_TYPES: &'static str = include_str!("../../ocaml/src/node-types.json");
 
-/// The content of the [`node-types.json`][] file for OCaml interfaces.
+/// The content of the [`node-types.json`][] file for OCaml interfaces, which
+/// share the grammar of OCaml.
 ///
 /// [`node-types.json`]: https://tree-sitter.github.io/tree-sitter/using-parsers#static-node-types
-pub const INTERFACE_NODE_TYPES: &'static str = include_str!("../../interface/src/node-types.json");
+pub const INTERFACE_NODE_TYPES: &'static str = OCAML_NODE_TYPES;
 
 /// The syntax highlighting query for OCaml.
 pub const HIGHLIGHTS_QUERY: &'static str = include_str!("../../queries/highlights.scm");
 
+/// The language injection query for OCaml.
+pub const INJECTIONS_QUERY: &'static str = include_str!("../../queries/injections.scm");
+
 /// The local-variable syntax highlighting query for OCaml.
 pub const LOCALS_QUERY: &'static str = include_str!("../../queries/locals.scm");
 
@@ -101,4 +141,538 @@ mod tests {
         let root = tree.root_node();
         assert!(!root.has_error());
     }
+
+    #[cfg(feature = "outline")]
+    #[test]
+    fn test_ocaml_outline() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language_ocaml_outline())
+            .expect("Error loading OCaml outline grammar");
+
+        let code = r#"
+            let x = if a then (b; c) else begin let y = 1 in y end
+            let f = fun x -> x + 1
+            module M = struct
+              let g () = [| x; f x |]
+            end
+        "#;
+
+        let tree = parser.parse(code, None).unwrap();
+        let root = tree.root_node();
+        assert!(!root.has_error());
+
+        let body = |line: &str| {
+            let start = code.find(line).unwrap() + line.len();
+            root.descendant_for_byte_range(start, start).unwrap().kind()
+        };
+        assert_eq!(body("let x = "), "skimmed_expression");
+        assert_eq!(body("let f = fun "), "skimmed_expression");
+        assert_eq!(body("let g () = "), "skimmed_expression");
+
+        let tags = super::queries::outline_tags();
+        let mut cursor = tree_sitter::QueryCursor::new();
+        let definitions: Vec<&str> = cursor
+            .captures(tags, root, code.as_bytes())
+            .filter_map(|(query_match, index)| {
+                let capture = query_match.captures[index];
+                if tags.capture_names()[capture.index as usize] == "name" {
+                    capture.node.utf8_text(code.as_bytes()).ok()
+                } else {
+                    None
+                }
+            })
+            .collect();
+        for name in &["f", "M", "g"] {
+            assert!(definitions.contains(name), "{} isn't defined", name);
+        }
+    }
+
+    #[test]
+    fn test_queries() {
+        use super::queries;
+
+        for query in &[
+            queries::ocaml_highlights(),
+            queries::ocaml_locals(),
+            queries::ocaml_tags(),
+            queries::interface_highlights(),
+            queries::interface_locals(),
+            queries::interface_tags(),
+        ] {
+            assert!(query.pattern_count() > 0);
+        }
+        assert!(std::ptr::eq(queries::ocaml_tags(), queries::ocaml_tags()));
+    }
+
+    #[cfg(feature = "batch")]
+    #[test]
+    fn test_batch() {
+        use super::batch::{self, Status};
+
+        let dir =
+            std::env::temp_dir().join(format!("tree-sitter-ocaml-batch-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        std::fs::write(dir.join("a.ml"), "let x = 0\n").unwrap();
+        std::fs::write(dir.join("a.mli"), "val x : int\n").unwrap();
+        std::fs::write(dir.join("b.ml"), "let = in\n").unwrap();
+
+        let paths = batch::discover(&[dir.clone()]).unwrap();
+        let options = batch::Options {
+            threads: 2,
+            ..Default::default()
+        };
+        let mut results = Vec::new();
+        batch::parse_files(paths, &options, |result| results.push(result));
+        std::fs::remove_dir_all(&dir).unwrap();
+
+        results.sort_by(|a, b| a.path.cmp(&b.path));
+        let statuses: Vec<_> = results.iter().map(|result| result.status.clone()).collect();
+        assert_eq!(statuses, vec![Status::Ok, Status::Ok, Status::Errors]);
+        assert!(results[2].error_nodes + results[2].missing_nodes > 0);
+    }
+
+    #[cfg(feature = "batch")]
+    #[test]
+    fn test_budget() {
+        use super::batch::{self, Budget, Limit};
+        use std::time::Duration;
+
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let code = b"let x = 0\n\ntype t = int\n(* let y *)\nmodule M = struct\n  let z = 1\nend\n";
+        let nodes = Budget {
+            nodes: Some(8),
+            ..Default::default()
+        };
+        assert_eq!(
+            batch::parse_within(&mut parser, code, &nodes).err(),
+            Some(Limit::Nodes)
+        );
+        assert_eq!(batch::skim(code), vec![0..11, 11..36, 36..70]);
+
+        let time = Budget {
+            time: Some(Duration::from_micros(1)),
+            ..Default::default()
+        };
+        let long = code.repeat(10_000);
+        assert_eq!(
+            batch::parse_within(&mut parser, &long, &time).err(),
+            Some(Limit::Time)
+        );
+        let tree = batch::parse_within(&mut parser, code, &Budget::default()).unwrap();
+        assert!(!tree.root_node().has_error());
+    }
+
+    #[cfg(feature = "batch")]
+    #[test]
+    fn test_parser_pool() {
+        use super::batch::ParserPool;
+        use std::path::Path;
+
+        let pool = ParserPool::new();
+        std::thread::scope(|scope| {
+            for _ in 0..4 {
+                scope.spawn(|| {
+                    let tree = pool.parse(Path::new("a.mli"), b"val x : int").unwrap();
+                    assert!(!tree.root_node().has_error());
+                });
+            }
+        });
+        assert!(pool.idle() >= 1 && pool.idle() <= 4);
+        assert!(pool.parse(Path::new("a.txt"), b"").is_none());
+        assert!(pool.idle() >= 1);
+    }
+
+    #[cfg(feature = "index")]
+    #[test]
+    fn test_index() {
+        use super::index::{self, Index};
+
+        let dir =
+            std::env::temp_dir().join(format!("tree-sitter-ocaml-index-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        std::fs::write(dir.join("a.ml"), "let f x = x\n").unwrap();
+        std::fs::write(dir.join("b.ml"), "let g = A.f 1\n").unwrap();
+        let index_path = dir.join("tags.idx");
+        let options = super::batch::Options {
+            threads: 2,
+            ..Default::default()
+        };
+
+        let stats = index::update(&index_path, &[dir.clone()], &options).unwrap();
+        assert_eq!((stats.files, stats.parsed, stats.reused), (2, 2, 0));
+
+        std::fs::write(dir.join("b.ml"), "let h = f 2\n").unwrap();
+        let stats = index::update(&index_path, &[dir.clone()], &options).unwrap();
+        assert_eq!((stats.files, stats.parsed, stats.reused), (2, 1, 1));
+
+        let index = Index::open(&index_path).unwrap();
+        let definitions: Vec<_> = index.definitions("f").collect();
+        let references: Vec<_> = index.references("f").collect();
+        assert_eq!(definitions.len(), 1);
+        assert_eq!(definitions[0].kind(), "function");
+        assert!(index
+            .file(definitions[0].file)
+            .unwrap()
+            .path
+            .ends_with("a.ml"));
+        assert_eq!(references.len(), 1);
+        assert_eq!(references[0].kind(), "call");
+        assert_eq!((references[0].row, references[0].column), (0, 8));
+        assert_eq!(index.definitions("g").count(), 0);
+        assert_eq!(index.definitions("h").count(), 1);
+        assert!(index.file(index.file_count() as u32).is_none());
+        drop(index);
+
+        // A file over the budget is kept, flagged, without tags.
+        std::fs::write(dir.join("c.ml"), "let k = 3\n").unwrap();
+        let options = super::batch::Options {
+            threads: 2,
+            budget: super::batch::Budget {
+                nodes: Some(1),
+                ..Default::default()
+            },
+            ..Default::default()
+        };
+        let stats = index::update(&index_path, &[dir.clone()], &options).unwrap();
+        assert_eq!(
+            (stats.files, stats.parsed, stats.reused, stats.failed),
+            (3, 0, 2, 1)
+        );
+        let index = Index::open(&index_path).unwrap();
+        let failed: Vec<_> = index.files().filter(|file| file.failed).collect();
+        assert_eq!(failed.len(), 1);
+        assert!(failed[0].path.ends_with("c.ml"));
+        assert_eq!(index.definitions("k").count(), 0);
+        drop(index);
+
+        // An index whose postings refer to a file or a kind that doesn't
+        // exist is rejected.
+        let bytes = std::fs::read(&index_path).unwrap();
+        let postings = u32::from_le_bytes([bytes[40], bytes[41], bytes[42], bytes[43]]) as usize;
+        for (field, value) in &[(0, u32::MAX), (4, 0xff01)] {
+            let mut corrupt = bytes.clone();
+            let at = postings + field;
+            corrupt[at..at + 4].copy_from_slice(&value.to_le_bytes());
+            std::fs::write(&index_path, &corrupt).unwrap();
+            let error = Index::open(&index_path).err().unwrap();
+            assert_eq!(error.kind(), std::io::ErrorKind::InvalidData);
+        }
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[cfg(feature = "mmap")]
+    #[test]
+    fn test_mapped() {
+        use super::mapped::MappedFile;
+
+        let dir =
+            std::env::temp_dir().join(format!("tree-sitter-ocaml-mapped-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        // Long enough to be read in several chunks.
+        let code = "let f x = (* comment *) {|quoted|} ^ \"string\"\n".repeat(10_000);
+        std::fs::write(dir.join("a.ml"), &code).unwrap();
+        std::fs::write(dir.join("empty.ml"), "").unwrap();
+
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let file = MappedFile::open(&dir.join("a.ml")).unwrap();
+        let tree = file.parse(&mut parser, None).unwrap();
+        let expected = parser.parse(&code, None).unwrap();
+        assert_eq!(tree.root_node().to_sexp(), expected.root_node().to_sexp());
+        assert!(!tree.root_node().has_error());
+
+        let empty = MappedFile::open(&dir.join("empty.ml")).unwrap();
+        assert!(empty.is_empty());
+        assert_eq!(
+            empty
+                .parse(&mut parser, None)
+                .unwrap()
+                .root_node()
+                .end_byte(),
+            0
+        );
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_phrases() {
+        use super::phrases::{self, PhraseParser};
+
+        let code = concat!(
+            "#use \"topfind\";;\n",
+            "module M = struct let y = 2;; let z = begin 3 end end;;\n",
+            "(* ;; \"*)\" *) \"a;;b\" ^ {id|;;|} |id} ^ {%ext|;;|};;\n",
+            "let c = ';' and d = '\\'' and e : 'a list = [];;\n",
+            "let s = \"x\\\";;y\" ^ {q|a|q|;;|q};;\n",
+            "x + 1\n",
+        );
+        let expected = [
+            "#use \"topfind\";;",
+            "\nmodule M = struct let y = 2;; let z = begin 3 end end;;",
+            "\n(* ;; \"*)\" *) \"a;;b\" ^ {id|;;|} |id} ^ {%ext|;;|};;",
+            "\nlet c = ';' and d = '\\'' and e : 'a list = [];;",
+            "\nlet s = \"x\\\";;y\" ^ {q|a|q|;;|q};;",
+            "\nx + 1\n",
+        ];
+
+        for chunk_size in &[1, 7, code.len()] {
+            let mut parser = PhraseParser::new();
+            let mut found = Vec::new();
+            for chunk in code.as_bytes().chunks(*chunk_size) {
+                parser.push(chunk);
+                found.extend(std::iter::from_fn(|| parser.next_phrase()));
+            }
+            parser.finish();
+            found.extend(std::iter::from_fn(|| parser.next_phrase()));
+            assert!(parser.is_done());
+
+            let texts: Vec<&str> = found
+                .iter()
+                .map(|phrase| std::str::from_utf8(&phrase.text).unwrap())
+                .collect();
+            assert_eq!(texts, expected);
+            for phrase in &found {
+                assert_eq!(
+                    &code.as_bytes()[phrase.start_byte..][..phrase.text.len()],
+                    &phrase.text[..]
+                );
+                assert!(!phrase.tree.root_node().has_error());
+            }
+            assert_eq!(found[5].start_point, tree_sitter::Point::new(4, 33));
+        }
+
+        let found: Vec<_> = phrases::phrases(code.as_bytes())
+            .map(|phrase| phrase.unwrap().text)
+            .collect();
+        assert_eq!(found.len(), expected.len());
+        assert_eq!(phrases::phrases(&b"let x = 1;;\n\n"[..]).count(), 1);
+    }
+
+    #[cfg(feature = "cache")]
+    #[test]
+    fn test_compact() {
+        use super::compact::{CompactNode, CompactTree, Grammar, TreeCache};
+
+        let code = b"let f ?(x = 1) ~y = x + y\ntype t = A | B (* comment *)\nlet = in\n";
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let tree = parser.parse(&code[..], None).unwrap();
+        let compact = CompactTree::new(&tree, Grammar::Ocaml);
+
+        fn check(node: tree_sitter::Node, compact: CompactNode) {
+            assert_eq!(node.kind(), compact.kind());
+            assert_eq!(node.byte_range(), compact.byte_range());
+            assert_eq!(node.is_named(), compact.is_named());
+            assert_eq!(node.is_extra(), compact.is_extra());
+            assert_eq!(node.is_missing(), compact.is_missing());
+            assert_eq!(node.has_error(), compact.has_error());
+            assert_eq!(node.child_count(), compact.child_count());
+            let mut cursor = node.walk();
+            let mut children = compact.children();
+            if cursor.goto_first_child() {
+                loop {
+                    let child = children.next().unwrap();
+                    assert_eq!(cursor.field_id(), child.field_id());
+                    assert_eq!(child.parent(), Some(compact));
+                    check(cursor.node(), child);
+                    if !cursor.goto_next_sibling() {
+                        break;
+                    }
+                }
+            }
+            assert!(children.next().is_none());
+        }
+        check(tree.root_node(), compact.root());
+        assert!(compact.root().has_error());
+
+        let encoded = compact.encode(code);
+        assert_eq!(CompactTree::decode(&encoded, code).unwrap(), compact);
+        assert!(CompactTree::decode(&encoded, b"let x = 0").is_err());
+        assert!(CompactTree::decode(&encoded[..encoded.len() - 1], code).is_err());
+
+        let dir =
+            std::env::temp_dir().join(format!("tree-sitter-ocaml-cache-{}", std::process::id()));
+        let cache = TreeCache::new(&dir);
+        assert!(cache.get(Grammar::Ocaml, code).is_none());
+        let parsed = cache.parse(&mut parser, Grammar::Ocaml, code).unwrap();
+        assert_eq!(cache.get(Grammar::Ocaml, code), Some(parsed));
+        assert!(cache.get(Grammar::Interface, code).is_none());
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_scopes() {
+        use super::scopes::Scopes;
+        use tree_sitter::{InputEdit, Point};
+
+        let mut code = String::from(concat!(
+            "let x = 1\n",
+            "let f x = x + 1\n",
+            "let g () = match x with y -> y\n",
+            "let rec h n = if n = 0 then x else h (n - 1)\n",
+            "let k = let b = 1 in b\n",
+            "let p = let (a, b) = (1, 2) in a + b\n",
+            "let q r = let { x; _ } = r in x\n",
+        ));
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let tree = parser.parse(&code, None).unwrap();
+        let mut scopes = Scopes::new(&tree, code.as_bytes());
+
+        let at = |code: &str, text: &str, offset: usize| code.find(text).unwrap() + offset;
+        let definition = |scopes: &Scopes, byte: usize| {
+            scopes
+                .definition_at(byte)
+                .map(|definition| scopes.definitions()[definition as usize].range.start)
+        };
+        assert_eq!(
+            definition(&scopes, at(&code, "x + 1", 0)),
+            Some(at(&code, "f x", 2))
+        );
+        assert_eq!(definition(&scopes, at(&code, "match x", 6)), Some(4));
+        assert_eq!(
+            definition(&scopes, at(&code, "-> y", 3)),
+            Some(at(&code, "with y", 5))
+        );
+        assert_eq!(definition(&scopes, at(&code, "then x", 5)), Some(4));
+        assert_eq!(
+            definition(&scopes, at(&code, "h (n", 0)),
+            Some(at(&code, "rec h", 4))
+        );
+        assert_eq!(
+            definition(&scopes, at(&code, "(n - 1", 1)),
+            Some(at(&code, "h n", 2))
+        );
+        assert_eq!(
+            definition(&scopes, at(&code, "in b", 3)),
+            Some(at(&code, "let b", 4))
+        );
+        assert_eq!(
+            definition(&scopes, at(&code, "a + b", 0)),
+            Some(at(&code, "(a, b)", 1))
+        );
+        assert_eq!(
+            definition(&scopes, at(&code, "a + b", 4)),
+            Some(at(&code, "(a, b)", 4))
+        );
+        assert_eq!(
+            definition(&scopes, at(&code, "in x", 3)),
+            Some(at(&code, "{ x", 2))
+        );
+        assert_eq!(scopes.uses(scopes.definition_at(4).unwrap()).len(), 2);
+
+        // Shadow `x` between `f` and `g`.
+        let start = at(&code, "let g", 0);
+        code.insert_str(start, "let x = 2\n");
+        let edit = InputEdit {
+            start_byte: start,
+            old_end_byte: start,
+            new_end_byte: start + 10,
+            start_position: Point::new(2, 0),
+            old_end_position: Point::new(2, 0),
+            new_end_position: Point::new(3, 0),
+        };
+        let mut old_tree = tree;
+        old_tree.edit(&edit);
+        scopes.edit(&edit);
+        let tree = parser.parse(&code, Some(&old_tree)).unwrap();
+        scopes.update(&old_tree, &tree, code.as_bytes());
+
+        assert_eq!(
+            definition(&scopes, at(&code, "match x", 6)),
+            Some(start + 4)
+        );
+        assert_eq!(definition(&scopes, at(&code, "then x", 5)), Some(start + 4));
+        assert_eq!(
+            definition(&scopes, at(&code, "x + 1", 0)),
+            Some(at(&code, "f x", 2))
+        );
+        assert!(scopes.uses(scopes.definition_at(4).unwrap()).is_empty());
+        assert_eq!(
+            scopes.uses(scopes.definition_at(start + 4).unwrap()).len(),
+            2
+        );
+    }
+
+    #[test]
+    fn test_highlighter() {
+        use super::highlight::Highlighter;
+        use tree_sitter::{InputEdit, Point};
+
+        let mut code = String::from("let x = 1\nlet f y = y\n");
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let tree = parser.parse(&code, None).unwrap();
+        let mut highlighter = Highlighter::new(&tree, code.as_bytes());
+
+        code.replace_range(8..9, "\"a\"");
+        let edit = InputEdit {
+            start_byte: 8,
+            old_end_byte: 9,
+            new_end_byte: 11,
+            start_position: Point::new(0, 8),
+            old_end_position: Point::new(0, 9),
+            new_end_position: Point::new(0, 11),
+        };
+        let mut old_tree = tree;
+        old_tree.edit(&edit);
+        highlighter.edit(&edit);
+        let tree = parser.parse(&code, Some(&old_tree)).unwrap();
+        let diff = highlighter.update(&old_tree, &tree, code.as_bytes());
+
+        let names = |spans: &[super::highlight::Span]| {
+            spans
+                .iter()
+                .map(|span| {
+                    (
+                        span.range.clone(),
+                        highlighter.highlight_name(span.highlight),
+                    )
+                })
+                .collect::<Vec<_>>()
+        };
+        assert_eq!(names(&diff.removed), vec![(8..9, "number")]);
+        assert_eq!(names(&diff.added), vec![(8..11, "string")]);
+        assert!(diff.removed_injections.is_empty() && diff.added_injections.is_empty());
+        assert_eq!(
+            highlighter.spans(),
+            Highlighter::new(&tree, code.as_bytes()).spans()
+        );
+    }
+
+    #[test]
+    fn test_injections() {
+        use super::injection::InjectionManager;
+
+        let code = "let a = {%html|<p>${x}</p>|}\n\
+                    let b = {%html|<p>${x}</p>|}\n\
+                    let c = {%html|<br>|}\n";
+        let mut parser = tree_sitter::Parser::new();
+        parser.set_language(super::language_ocaml()).unwrap();
+        let tree = parser.parse(code, None).unwrap();
+        let mut injections = InjectionManager::new();
+        injections.add_language("html", super::language_ocaml());
+
+        let injected = injections.injections(&tree, code.as_bytes(), 0..10);
+        assert_eq!(injected.len(), 1);
+        assert_eq!(injected[0].language, "html");
+        assert_eq!(injected[0].range, 15..26);
+        assert_eq!(
+            injected[0].holes[0].utf8_text(code.as_bytes()).unwrap(),
+            "${x}"
+        );
+        assert_eq!(injections.cached(), 1);
+
+        let injected = injections.injections(&tree, code.as_bytes(), 0..code.len());
+        assert_eq!(injected.len(), 3);
+        assert!(injected[2].holes.is_empty());
+        assert_eq!(injections.cached(), 2);
+
+        injections.clear_unused();
+        injections.injections(&tree, code.as_bytes(), 0..10);
+        injections.clear_unused();
+        assert_eq!(injections.cached(), 1);
+    }
 }
@@ -0,0 +1,112 @@
+//! Parsing files straight from a memory map.
+//!
+//! Reading a file into a `Vec` before parsing it keeps a copy of the source on
+//! the heap for as long as the parse lasts, on top of the tree. A
+//! [`MappedFile`] maps the file read-only instead, and the parser reads it in
+//! chunks through its input callback, without copying it. The lexer moves
+//! forward through the file, so the pages it has left well behind are handed
+//! back to the kernel as it goes. If error recovery goes back further than
+//! that, the pages are simply read again from the page cache. The peak
+//! resident set of a parse is then about the size of the tree, however large
+//! the file.
+//!
+//! ```no_run
+//! use tree_sitter_ocaml::mapped::MappedFile;
+//! use std::path::Path;
+//!
+//! let file = MappedFile::open(Path::new("stubs.ml")).unwrap();
+//! let mut parser = tree_sitter::Parser::new();
+//! parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//! let tree = file.parse(&mut parser, None).unwrap();
+//! ```
+
+use memmap2::Mmap;
+use std::fs::File;
+use std::io;
+use std::path::Path;
+use tree_sitter::{Parser, Tree};
+
+/// The most bytes handed to the parser by one read.
+const CHUNK_SIZE: usize = 64 * 1024;
+
+/// How far behind the lexer the pages are kept, in bytes.
+const KEEP_BEHIND: usize = 4 * 1024 * 1024;
+
+/// A source file mapped into memory.
+pub struct MappedFile {
+    /// Empty files can't be mapped.
+    map: Option<Mmap>,
+}
+
+impl MappedFile {
+    pub fn open(path: &Path) -> io::Result<MappedFile> {
+        let file = File::open(path)?;
+        if file.metadata()?.len() == 0 {
+            return Ok(MappedFile { map: None });
+        }
+        let map = unsafe { Mmap::map(&file)? };
+        if map.len() > u32::MAX as usize {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "the file is larger than 4GB",
+            ));
+        }
+        #[cfg(unix)]
+        map.advise(memmap2::Advice::Sequential)?;
+        Ok(MappedFile { map: Some(map) })
+    }
+
+    /// The contents of the file. Reading them all keeps them all resident.
+    pub fn bytes(&self) -> &[u8] {
+        self.map.as_deref().unwrap_or(&[])
+    }
+
+    pub fn len(&self) -> usize {
+        self.bytes().len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.bytes().is_empty()
+    }
+
+    /// Parses the file with `parser`, reading it a chunk at a time. As with
+    /// [`Parser::parse`], `old_tree` is the previous tree of the file, edited
+    /// to match it.
+    pub fn parse(&self, parser: &mut Parser, old_tree: Option<&Tree>) -> Option<Tree> {
+        let bytes = self.bytes();
+        // The pages below this offset have been handed back.
+        let mut released = 0;
+        parser.parse_with(
+            &mut |byte: usize, _| {
+                if byte >= bytes.len() {
+                    return &[][..];
+                }
+                if byte >= released + KEEP_BEHIND + CHUNK_SIZE {
+                    let end = (byte - KEEP_BEHIND) / CHUNK_SIZE * CHUNK_SIZE;
+                    self.release(released..end);
+                    released = end;
+                }
+                &bytes[byte..bytes.len().min(byte + CHUNK_SIZE)]
+            },
+            old_tree,
+        )
+    }
+
+    /// Hands the pages of `range` back to the kernel. They are read again if
+    /// they are used again.
+    fn release(&self, range: std::ops::Range<usize>) {
+        #[cfg(unix)]
+        if let Some(map) = &self.map {
+            // The map is read-only, so dropping its pages loses nothing.
+            let _ = unsafe {
+                map.unchecked_advise_range(
+                    memmap2::UncheckedAdvice::DontNeed,
+                    range.start,
+                    range.len(),
+                )
+            };
+        }
+        #[cfg(not(unix))]
+        let _ = range;
+    }
+}
@@ -0,0 +1,390 @@
+//! Parsing an unbounded stream of toplevel phrases, like a REPL session log or
+//! an expect-test transcript, one phrase at a time.
+//!
+//! A [`PhraseParser`] is fed the input in chunks. It looks for the `;;` that
+//! end the phrases as the chunks come in, and parses each phrase on its own as
+//! soon as its `;;` is seen, then drops its text from the input it keeps. The
+//! memory it takes is then about the size of the largest phrase, however long
+//! the stream.
+//!
+//! ```
+//! use tree_sitter_ocaml::phrases::PhraseParser;
+//!
+//! let mut phrases = PhraseParser::new();
+//! phrases.push(b"let x = 1;;\nx + ");
+//! assert_eq!(phrases.next_phrase().unwrap().text, b"let x = 1;;");
+//! assert!(phrases.next_phrase().is_none());
+//! phrases.push(b"1;;\n");
+//! assert_eq!(phrases.next_phrase().unwrap().text, b"\nx + 1;;");
+//! phrases.finish();
+//! assert!(phrases.next_phrase().is_none());
+//! ```
+//!
+//! A `;;` ends a phrase when it is outside of comments, strings and the
+//! `struct` and `sig` that may contain `;;` themselves, as in the OCaml
+//! toplevel. The text between two phrases, like the output of the toplevel,
+//! is parsed with the next one.
+
+use std::io::{self, Read};
+use std::ops::Range;
+use tree_sitter::{Parser, Point, Tree};
+
+/// The most bytes read at once by [`Phrases`].
+const CHUNK_SIZE: usize = 64 * 1024;
+
+/// A phrase and its tree.
+pub struct Phrase {
+    /// The position of the phrase in the stream. The nodes of `tree` are
+    /// relative to it.
+    pub start_byte: usize,
+    pub start_point: Point,
+    /// The text of the phrase, from the end of the previous one to its `;;`.
+    pub text: Vec<u8>,
+    pub tree: Tree,
+}
+
+/// Splits the input into phrases and parses them.
+pub struct PhraseParser {
+    parser: Parser,
+    /// The input that isn't part of a returned phrase yet, after `consumed`.
+    buffer: Vec<u8>,
+    consumed: usize,
+    /// The position of `buffer[consumed]` in the stream.
+    start_byte: usize,
+    start_point: Point,
+    /// Where the search for the next `;;` resumes in `buffer`, with the
+    /// state of the search at that point.
+    position: usize,
+    comments: usize,
+    /// The string that `position` is in, when the input ended before it did.
+    string: Option<OpenString>,
+    /// The `struct`, `sig`, `object` and `begin` that are open, and whether
+    /// each allows `;;`.
+    blocks: Vec<bool>,
+    structures: usize,
+    finished: bool,
+}
+
+/// What [`PhraseParser::scan_token`] found.
+enum Token {
+    /// A token that ends at the offset.
+    Other(usize),
+    /// The `;;` that ends a phrase at the offset.
+    End(usize),
+    /// A token that may go on in the input to come.
+    Incomplete,
+}
+
+/// A string that the input ended in.
+enum OpenString {
+    String,
+    /// A quoted string, with its id.
+    Quoted(Vec<u8>),
+}
+
+impl PhraseParser {
+    pub fn new() -> PhraseParser {
+        let mut parser = Parser::new();
+        parser.set_language(crate::language_ocaml()).unwrap();
+        PhraseParser {
+            parser,
+            buffer: Vec::new(),
+            consumed: 0,
+            start_byte: 0,
+            start_point: Point::new(0, 0),
+            position: 0,
+            comments: 0,
+            string: None,
+            blocks: Vec::new(),
+            structures: 0,
+            finished: false,
+        }
+    }
+
+    /// Adds `chunk` to the input.
+    ///
+    /// # Panics
+    ///
+    /// If the input was [finished](PhraseParser::finish).
+    pub fn push(&mut self, chunk: &[u8]) {
+        assert!(!self.finished, "input pushed after the end of the stream");
+        if self.consumed > 0 {
+            self.buffer.drain(..self.consumed);
+            self.position -= self.consumed;
+            self.consumed = 0;
+        }
+        self.buffer.extend_from_slice(chunk);
+    }
+
+    /// Marks the end of the input. The phrases it holds can still be taken
+    /// with [`next_phrase`](PhraseParser::next_phrase), the last of them
+    /// without `;;`.
+    pub fn finish(&mut self) {
+        self.finished = true;
+    }
+
+    /// Whether the input was finished and all of its phrases were taken.
+    pub fn is_done(&self) -> bool {
+        self.finished && self.consumed == self.buffer.len()
+    }
+
+    /// Parses and returns the next phrase, if its end is in the input.
+    pub fn next_phrase(&mut self) -> Option<Phrase> {
+        let end = loop {
+            match self.scan_token() {
+                Token::Other(end) => self.position = end,
+                Token::End(end) => {
+                    self.position = end;
+                    break end;
+                }
+                Token::Incomplete if !self.finished => return None,
+                Token::Incomplete => {
+                    let rest = &self.buffer[self.consumed..];
+                    if rest.iter().all(u8::is_ascii_whitespace) {
+                        self.buffer = Vec::new();
+                        self.consumed = 0;
+                        self.position = 0;
+                        return None;
+                    }
+                    // The last phrase, that the input ended before its `;;`.
+                    break self.buffer.len();
+                }
+            }
+        };
+
+        let text = self.buffer[self.consumed..end].to_vec();
+        let tree = self.parser.parse(&text, None).unwrap();
+        let phrase = Phrase {
+            start_byte: self.start_byte,
+            start_point: self.start_point,
+            text,
+            tree,
+        };
+        self.start_byte += phrase.text.len();
+        self.start_point = advance(self.start_point, &phrase.text);
+        self.consumed = end;
+        self.position = end;
+        Some(phrase)
+    }
+
+    /// Scans the token at `position`, following the comments and blocks it
+    /// opens or closes.
+    fn scan_token(&mut self) -> Token {
+        let text = &self.buffer[..];
+        let i = self.position;
+        let finished = self.finished;
+        let at = |offset: usize| text.get(i + offset).copied();
+        // Whether the token may go on past the input.
+        let short = |offset: usize| i + offset >= text.len() && !finished;
+
+        if let Some(string) = self.string.take() {
+            return self.scan_string(string, i);
+        }
+        let c = match at(0) {
+            Some(c) => c,
+            None => return Token::Incomplete,
+        };
+        match c {
+            b'(' | b'*' if short(1) => Token::Incomplete,
+            b'(' if at(1) == Some(b'*') => {
+                self.comments += 1;
+                Token::Other(i + 2)
+            }
+            b'*' if self.comments > 0 && at(1) == Some(b')') => {
+                self.comments -= 1;
+                Token::Other(i + 2)
+            }
+            b'"' => self.scan_string(OpenString::String, i + 1),
+            b'{' => match quoted_string_start(text, i + 1) {
+                Some(Some((body, id))) => {
+                    let id = text[id].to_vec();
+                    self.scan_string(OpenString::Quoted(id), body)
+                }
+                Some(None) => Token::Other(i + 1),
+                None if finished => Token::Other(text.len()),
+                None => Token::Incomplete,
+            },
+            b'\'' => {
+                // A character literal, or the quote of a type variable.
+                if short(2) {
+                    Token::Incomplete
+                } else if at(1) == Some(b'\\') {
+                    let escape = &text[(i + 3).min(text.len())..(i + 12).min(text.len())];
+                    match escape.iter().position(|&c| c == b'\'') {
+                        Some(quote) => Token::Other(i + 4 + quote),
+                        None if short(12) => Token::Incomplete,
+                        None => Token::Other(i + 1),
+                    }
+                } else if at(2) == Some(b'\'') {
+                    Token::Other(i + 3)
+                } else {
+                    Token::Other(i + 1)
+                }
+            }
+            _ if self.comments > 0 => Token::Other(i + 1),
+            b';' if short(1) => Token::Incomplete,
+            b';' if at(1) == Some(b';') => {
+                if self.structures == 0 {
+                    Token::End(i + 2)
+                } else {
+                    Token::Other(i + 2)
+                }
+            }
+            _ if c.is_ascii_alphanumeric() || c == b'_' => {
+                let length = text[i..]
+                    .iter()
+                    .position(|&c| !(c.is_ascii_alphanumeric() || c == b'_' || c == b'\''))
+                    .unwrap_or(text.len() - i);
+                if short(length) {
+                    return Token::Incomplete;
+                }
+                match &text[i..i + length] {
+                    b"struct" | b"sig" => {
+                        self.blocks.push(true);
+                        self.structures += 1;
+                    }
+                    b"object" | b"begin" => self.blocks.push(false),
+                    b"end" => {
+                        if let Some(true) = self.blocks.pop() {
+                            self.structures -= 1;
+                        }
+                    }
+                    _ => {}
+                }
+                Token::Other(i + length)
+            }
+            _ => Token::Other(i + 1),
+        }
+    }
+
+    /// Scans `string` from `start`. If the input ends before the string does,
+    /// the scan resumes where it stopped once there is more, rather than from
+    /// the start of the string.
+    fn scan_string(&mut self, string: OpenString, start: usize) -> Token {
+        let text = &self.buffer[..];
+        let scanned = match &string {
+            OpenString::String => skip_string(text, start),
+            OpenString::Quoted(id) => skip_quoted_string(text, start, id),
+        };
+        match scanned {
+            Ok(end) => Token::Other(end),
+            Err(_) if self.finished => Token::Other(text.len()),
+            Err(resume) => {
+                self.position = resume;
+                self.string = Some(string);
+                Token::Incomplete
+            }
+        }
+    }
+}
+
+impl Default for PhraseParser {
+    fn default() -> Self {
+        PhraseParser::new()
+    }
+}
+
+/// Called in a string. Returns the end of the string if it is in `text`, or
+/// else where to resume the scan.
+fn skip_string(text: &[u8], mut i: usize) -> Result<usize, usize> {
+    while i < text.len() {
+        match text[i] {
+            b'"' => return Ok(i + 1),
+            // The escaped character is still to come.
+            b'\\' if i + 1 == text.len() => return Err(i),
+            b'\\' => i += 2,
+            _ => i += 1,
+        }
+    }
+    Err(text.len())
+}
+
+/// Called after a `{`. Returns the start of the body and the range of the id
+/// of the quoted string, like `{id|...|id}` or `{%ext|...|}`, that starts
+/// there, or `Some(None)` if there is none, or `None` if `text` ends before it
+/// is known.
+fn quoted_string_start(text: &[u8], mut i: usize) -> Option<Option<(usize, Range<usize>)>> {
+    if text.get(i) == Some(&b'%') {
+        i += 1;
+        if text.get(i) == Some(&b'%') {
+            i += 1;
+        }
+        while i < text.len() && (text[i].is_ascii_alphanumeric() || b"_'.".contains(&text[i])) {
+            i += 1;
+        }
+        while i < text.len() && (text[i] == b' ' || text[i] == b'\t') {
+            i += 1;
+        }
+    }
+    let id_start = i;
+    while i < text.len() && (text[i].is_ascii_lowercase() || text[i] == b'_') {
+        i += 1;
+    }
+    match text.get(i) {
+        None => return None,
+        Some(b'|') => {}
+        Some(_) => return Some(None),
+    }
+    Some(Some((i + 1, id_start..i)))
+}
+
+/// Called in the body of a quoted string with the id `id`. Returns the end of
+/// the string if it is in `text`, or else where to resume the scan.
+fn skip_quoted_string(text: &[u8], start: usize, id: &[u8]) -> Result<usize, usize> {
+    let close = text[start..].windows(id.len() + 2).position(|window| {
+        window[0] == b'|' && &window[1..=id.len()] == id && window[id.len() + 1] == b'}'
+    });
+    match close {
+        Some(close) => Ok(start + close + id.len() + 2),
+        // The `|id}` may have started in the last bytes.
+        None => Err(text.len().saturating_sub(id.len() + 1).max(start)),
+    }
+}
+
+/// The point after `text`, from `point`.
+fn advance(point: Point, text: &[u8]) -> Point {
+    match text.iter().rposition(|&c| c == b'\n') {
+        Some(last) => Point::new(
+            point.row + text.iter().filter(|&&c| c == b'\n').count(),
+            text.len() - last - 1,
+        ),
+        None => Point::new(point.row, point.column + text.len()),
+    }
+}
+
+/// The phrases of `reader`, read a chunk at a time.
+pub struct Phrases<R> {
+    reader: R,
+    parser: PhraseParser,
+    chunk: Vec<u8>,
+}
+
+/// Parses the phrases of `reader` as they are read.
+pub fn phrases<R: Read>(reader: R) -> Phrases<R> {
+    Phrases {
+        reader,
+        parser: PhraseParser::new(),
+        chunk: vec![0; CHUNK_SIZE],
+    }
+}
+
+impl<R: Read> Iterator for Phrases<R> {
+    type Item = io::Result<Phrase>;
+
+    fn next(&mut self) -> Option<io::Result<Phrase>> {
+        loop {
+            if let Some(phrase) = self.parser.next_phrase() {
+                return Some(Ok(phrase));
+            }
+            if self.parser.is_done() {
+                return None;
+            }
+            match self.reader.read(&mut self.chunk) {
+                Ok(0) => self.parser.finish(),
+                Ok(length) => self.parser.push(&self.chunk[..length]),
+                Err(error) if error.kind() == io::ErrorKind::Interrupted => {}
+                Err(error) => return Some(Err(error)),
+            }
+        }
+    }
+}
@@ -0,0 +1,96 @@
+//! The queries of both grammars, compiled once per process.
+//!
+//! Compiling `highlights.scm` and `tags.scm` takes much longer than parsing a
+//! typical file, so the queries are compiled the first time they are used
+//! and then shared by all threads. A [`Query`] can be used from several
+//! threads at once, each with its own [`QueryCursor`](tree_sitter::QueryCursor).
+//!
+//! ```
+//! let code = "let f x = x";
+//! let mut parser = tree_sitter::Parser::new();
+//! parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//! let tree = parser.parse(code, None).unwrap();
+//!
+//! let query = tree_sitter_ocaml::queries::ocaml_tags();
+//! let mut cursor = tree_sitter::QueryCursor::new();
+//! let mut matches = cursor.matches(query, tree.root_node(), code.as_bytes());
+//! assert!(matches.next().is_some());
+//! ```
+
+use std::sync::OnceLock;
+use tree_sitter::{Language, Query};
+
+fn compile(
+    cell: &'static OnceLock<Query>,
+    language: fn() -> Language,
+    source: &str,
+) -> &'static Query {
+    cell.get_or_init(|| Query::new(language(), source).expect("invalid bundled query"))
+}
+
+macro_rules! shared_query {
+    ($(#[$doc:meta])* $name:ident, $language:path, $source:path) => {
+        $(#[$doc])*
+        pub fn $name() -> &'static Query {
+            static QUERY: OnceLock<Query> = OnceLock::new();
+            compile(&QUERY, $language, $source)
+        }
+    };
+}
+
+shared_query!(
+    /// [`HIGHLIGHTS_QUERY`](crate::HIGHLIGHTS_QUERY) for OCaml.
+    ocaml_highlights,
+    crate::language_ocaml,
+    crate::HIGHLIGHTS_QUERY
+);
+shared_query!(
+    /// [`INJECTIONS_QUERY`](crate::INJECTIONS_QUERY) for OCaml.
+    ocaml_injections,
+    crate::language_ocaml,
+    crate::INJECTIONS_QUERY
+);
+shared_query!(
+    /// [`LOCALS_QUERY`](crate::LOCALS_QUERY) for OCaml.
+    ocaml_locals,
+    crate::language_ocaml,
+    crate::LOCALS_QUERY
+);
+shared_query!(
+    /// [`TAGGING_QUERY`](crate::TAGGING_QUERY) for OCaml.
+    ocaml_tags,
+    crate::language_ocaml,
+    crate::TAGGING_QUERY
+);
+shared_query!(
+    /// [`HIGHLIGHTS_QUERY`](crate::HIGHLIGHTS_QUERY) for OCaml interfaces.
+    interface_highlights,
+    crate::language_ocaml_interface,
+    crate::HIGHLIGHTS_QUERY
+);
+shared_query!(
+    /// [`INJECTIONS_QUERY`](crate::INJECTIONS_QUERY) for OCaml interfaces.
+    interface_injections,
+    crate::language_ocaml_interface,
+    crate::INJECTIONS_QUERY
+);
+shared_query!(
+    /// [`LOCALS_QUERY`](crate::LOCALS_QUERY) for OCaml interfaces.
+    interface_locals,
+    crate::language_ocaml_interface,
+    crate::LOCALS_QUERY
+);
+shared_query!(
+    /// [`TAGGING_QUERY`](crate::TAGGING_QUERY) for OCaml interfaces.
+    interface_tags,
+    crate::language_ocaml_interface,
+    crate::TAGGING_QUERY
+);
+shared_query!(
+    /// [`TAGGING_QUERY`](crate::TAGGING_QUERY) for the outline of OCaml
+    /// implementations, which only finds definitions.
+    #[cfg(feature = "outline")]
+    outline_tags,
+    crate::language_ocaml_outline,
+    crate::TAGGING_QUERY
+);
@@ -0,0 +1,96 @@
+//! Counters kept by the external scanner.
+//!
+//! They are only available when the crate is built with the `scanner-stats`
+//! feature. The scanner counts on every thread separately, so the counters
+//! returned here cover the parses done by the calling thread.
+
+/// The number of external tokens, including the error sentinel.
+pub const TOKEN_TYPES: usize = 11;
+
+/// The names of the external tokens, as in the `externals` of the grammar,
+/// which index [`ScannerStats::token_counts`] and
+/// [`ScannerStats::token_cycles`].
+pub const TOKEN_NAMES: [&str; TOKEN_TYPES] = [
+    "_left_quoted_string_delim",
+    "_right_quoted_string_delim",
+    "_start_interpolation",
+    "line_number_directive",
+    "_null",
+    "comment",
+    "_string_fragment",
+    "_quoted_string_fragment",
+    "_implementation_start",
+    "_interface_start",
+    "_error_sentinel",
+];
+
+/// What the external scanner did since its counters were last taken. This
+/// mirrors `common/scanner_stats.h`.
+///
+/// The timers count CPU cycles on x86, timer ticks on ARM64 and nothing
+/// elsewhere.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct ScannerStats {
+    /// The number of times the parser called the scanner.
+    pub scan_calls: u64,
+    /// The number of calls that returned a token.
+    pub tokens: u64,
+    /// The calls where only comments and line number directives, which are
+    /// valid almost everywhere, were valid.
+    pub extras_only_calls: u64,
+    /// The whitespace characters skipped before a token.
+    pub whitespace_skipped: u64,
+    /// The calls to `get_column`, to check that `#` starts a line.
+    pub column_queries: u64,
+    pub serializations: u64,
+    pub serialized_bytes: u64,
+    pub deserializations: u64,
+    pub deserialized_bytes: u64,
+    pub serialize_cycles: u64,
+    pub deserialize_cycles: u64,
+    /// The time spent in calls that returned no token.
+    pub miss_cycles: u64,
+    /// The tokens returned of each type, see [`TOKEN_NAMES`].
+    pub token_counts: [u64; TOKEN_TYPES],
+    /// The time spent in the calls that returned each type of token.
+    pub token_cycles: [u64; TOKEN_TYPES],
+}
+
+impl ScannerStats {
+    /// The tokens returned and the time spent scanning them, by token name.
+    pub fn by_token(&self) -> impl Iterator<Item = (&'static str, u64, u64)> + '_ {
+        TOKEN_NAMES
+            .iter()
+            .enumerate()
+            .map(move |(i, name)| (*name, self.token_counts[i], self.token_cycles[i]))
+    }
+
+    /// The time spent in the scanner, including serialization.
+    pub fn total_cycles(&self) -> u64 {
+        self.token_cycles.iter().sum::<u64>()
+            + self.miss_cycles
+            + self.serialize_cycles
+            + self.deserialize_cycles
+    }
+}
+
+extern "C" {
+    fn tree_sitter_ocaml_external_scanner_stats(stats: *mut ScannerStats);
+    fn tree_sitter_ocaml_interface_external_scanner_stats(stats: *mut ScannerStats);
+}
+
+/// Returns the counters of the OCaml scanner on this thread and resets them.
+pub fn take_ocaml() -> ScannerStats {
+    let mut stats = ScannerStats::default();
+    unsafe { tree_sitter_ocaml_external_scanner_stats(&mut stats) };
+    stats
+}
+
+/// Returns the counters of the OCaml interface scanner on this thread and
+/// resets them.
+pub fn take_ocaml_interface() -> ScannerStats {
+    let mut stats = ScannerStats::default();
+    unsafe { tree_sitter_ocaml_interface_external_scanner_stats(&mut stats) };
+    stats
+}
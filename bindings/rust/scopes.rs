@@ -0,0 +1,608 @@
+//! Resolves the value names of a tree to their definitions.
+//!
+//! The scopes, definitions and references are those of
+//! [`LOCALS_QUERY`](crate::LOCALS_QUERY), and the resolver adds what the
+//! query can't express: where each definition is visible. A parameter is
+//! visible in the rest of its function, a pattern in the guard and body of its
+//! match case, and the name bound by a `let` in the body after `in`, or in the
+//! items after it at the top level or in a structure, and in its own bindings
+//! if it is `rec`. A reference resolves to the innermost definition of its
+//! name that is visible where it is.
+//!
+//! [`Scopes`] keeps the scope tree, the definitions and references in the
+//! order of the source, and a table of the uses of every definition. After an
+//! edit it is updated from the changed ranges of the tree, which only queries
+//! the top-level items that changed and only resolves the references whose
+//! name was defined or undefined again.
+//!
+//! ```
+//! use tree_sitter_ocaml::scopes::Scopes;
+//!
+//! let code = "let x = 1\nlet f x = x + 1\nlet y = x\n";
+//! let mut parser = tree_sitter::Parser::new();
+//! parser.set_language(tree_sitter_ocaml::language_ocaml()).unwrap();
+//! let tree = parser.parse(code, None).unwrap();
+//!
+//! let scopes = Scopes::new(&tree, code.as_bytes());
+//! let definition = scopes.definition_at(code.find("x = 1").unwrap()).unwrap();
+//! let uses = scopes.uses(definition);
+//! assert_eq!(uses.len(), 1);
+//! assert_eq!(scopes.references()[uses[0] as usize].range.start, code.rfind('x').unwrap());
+//! ```
+
+use crate::queries;
+use std::cmp::Reverse;
+use std::collections::{HashMap, HashSet};
+use std::ops::Range;
+use tree_sitter::{InputEdit, Node, QueryCursor, Tree};
+
+const NONE: u32 = u32::MAX;
+
+/// A node captured as `@local.scope`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Scope {
+    pub range: Range<usize>,
+    /// The index of the innermost scope around this one.
+    pub parent: Option<u32>,
+}
+
+/// A `value_pattern` captured as `@local.definition`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Definition {
+    /// The name, see [`Scopes::name`].
+    pub name: u32,
+    pub range: Range<usize>,
+    /// Where references resolve to this definition.
+    pub visible: Range<usize>,
+    /// The index of the innermost scope around the definition.
+    pub scope: Option<u32>,
+}
+
+/// A `value_name` captured as `@local.reference`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Reference {
+    /// The name, see [`Scopes::name`].
+    pub name: u32,
+    pub range: Range<usize>,
+    /// The index of the definition, if the name is defined in the file.
+    pub definition: Option<u32>,
+}
+
+/// The scopes, definitions and references of a tree, with the references
+/// resolved.
+#[derive(Default)]
+pub struct Scopes {
+    names: Vec<String>,
+    name_ids: HashMap<Vec<u8>, u32>,
+    /// The top-level items of the tree, which are queried again as a whole.
+    items: Vec<Range<usize>>,
+    /// Sorted by start, outer scopes first.
+    scopes: Vec<Scope>,
+    /// Sorted by start.
+    definitions: Vec<Definition>,
+    /// Sorted by start.
+    references: Vec<Reference>,
+    /// The definitions sorted by name and visible range, outer ones first,
+    /// with the start of the definitions of each name and the position in
+    /// `order` of the definition of the same name that encloses each one.
+    order: Vec<u32>,
+    name_starts: Vec<u32>,
+    enclosing: Vec<u32>,
+    /// The references to each definition, from `uses[use_starts[i]]` to
+    /// `uses[use_starts[i + 1]]`.
+    use_starts: Vec<u32>,
+    uses: Vec<u32>,
+    /// The ranges edited since the last update.
+    edited: Vec<Range<usize>>,
+}
+
+/// What a query over part of the tree found.
+struct Region {
+    scopes: Vec<Scope>,
+    definitions: Vec<Definition>,
+    references: Vec<Reference>,
+}
+
+impl Scopes {
+    /// Resolves the names of `tree`, parsed from `source`.
+    pub fn new(tree: &Tree, source: &[u8]) -> Scopes {
+        let mut scopes = Scopes::default();
+        let root = tree.root_node();
+        let mut affected = HashSet::new();
+        scopes.splice(tree, source, 0..root.end_byte(), &mut affected);
+        scopes.items = top_level_items(root);
+        scopes.index_definitions();
+        for i in 0..scopes.references.len() {
+            let reference = &scopes.references[i];
+            scopes.references[i].definition = scopes.resolve(reference.name, reference.range.start);
+        }
+        scopes.index_uses();
+        scopes
+    }
+
+    /// Moves everything after an edit, which has to be applied to the tree as
+    /// well, before [`update`](Scopes::update).
+    pub fn edit(&mut self, edit: &InputEdit) {
+        let shift = |range: &mut Range<usize>| {
+            range.start = shift_byte(range.start, edit);
+            range.end = shift_byte(range.end, edit);
+        };
+        self.items.iter_mut().for_each(shift);
+        self.edited.iter_mut().for_each(shift);
+        for scope in &mut self.scopes {
+            shift(&mut scope.range);
+        }
+        for definition in &mut self.definitions {
+            shift(&mut definition.range);
+            shift(&mut definition.visible);
+        }
+        for reference in &mut self.references {
+            shift(&mut reference.range);
+        }
+        self.edited.push(edit.start_byte..edit.new_end_byte);
+    }
+
+    /// Brings the scopes up to date with `tree`, the new parse of the edited
+    /// `old_tree`.
+    pub fn update(&mut self, old_tree: &Tree, tree: &Tree, source: &[u8]) {
+        let root = tree.root_node();
+        let items = top_level_items(root);
+        let mut changed: Vec<Range<usize>> = self.edited.drain(..).collect();
+        changed.extend(
+            old_tree
+                .changed_ranges(tree)
+                .map(|range| range.start_byte..range.end_byte),
+        );
+        let regions = regions(changed, &self.items, &items);
+
+        let mut affected = HashSet::new();
+        for region in &regions {
+            self.splice(tree, source, region.clone(), &mut affected);
+        }
+        self.items = items;
+
+        self.index_definitions();
+        for i in 0..self.references.len() {
+            let reference = &self.references[i];
+            let start = reference.range.start;
+            if affected.contains(&reference.name)
+                || regions.iter().any(|region| region.contains(&start))
+            {
+                self.references[i].definition = self.resolve(reference.name, start);
+            }
+        }
+        self.index_uses();
+    }
+
+    pub fn scopes(&self) -> &[Scope] {
+        &self.scopes
+    }
+
+    pub fn definitions(&self) -> &[Definition] {
+        &self.definitions
+    }
+
+    pub fn references(&self) -> &[Reference] {
+        &self.references
+    }
+
+    /// The text of a name of a definition or reference.
+    pub fn name(&self, name: u32) -> &str {
+        &self.names[name as usize]
+    }
+
+    /// The innermost scope around `byte`.
+    pub fn scope_at(&self, byte: usize) -> Option<u32> {
+        let after = self
+            .scopes
+            .partition_point(|scope| scope.range.start <= byte);
+        let mut scope = after.checked_sub(1)? as u32;
+        loop {
+            if self.scopes[scope as usize].range.end > byte {
+                return Some(scope);
+            }
+            scope = self.scopes[scope as usize].parent?;
+        }
+    }
+
+    /// The definition at `byte`, or the one the reference at `byte` resolves
+    /// to.
+    pub fn definition_at(&self, byte: usize) -> Option<u32> {
+        let at = |range: &Range<usize>| range.start <= byte && byte < range.end;
+        let i = self
+            .definitions
+            .partition_point(|definition| definition.range.start <= byte);
+        if i > 0 && at(&self.definitions[i - 1].range) {
+            return Some(i as u32 - 1);
+        }
+        let i = self
+            .references
+            .partition_point(|reference| reference.range.start <= byte);
+        if i > 0 && at(&self.references[i - 1].range) {
+            return self.references[i - 1].definition;
+        }
+        None
+    }
+
+    /// The indices of the references that resolve to a definition, in the
+    /// order of the source.
+    pub fn uses(&self, definition: u32) -> &[u32] {
+        let start = self.use_starts[definition as usize] as usize;
+        let end = self.use_starts[definition as usize + 1] as usize;
+        &self.uses[start..end]
+    }
+
+    fn intern(&mut self, text: &[u8]) -> u32 {
+        if let Some(&id) = self.name_ids.get(text) {
+            return id;
+        }
+        let id = self.names.len() as u32;
+        self.names.push(String::from_utf8_lossy(text).into_owned());
+        self.name_ids.insert(text.to_vec(), id);
+        id
+    }
+
+    /// Replaces what starts in `range` with what the query finds there in
+    /// `tree`, and adds the names defined there before and after to
+    /// `affected`. The range has to be made of whole top-level items.
+    fn splice(
+        &mut self,
+        tree: &Tree,
+        source: &[u8],
+        range: Range<usize>,
+        affected: &mut HashSet<u32>,
+    ) {
+        let region = self.query(tree, source, range.clone());
+
+        let starts = |start: usize| start < range.start;
+        let ends = |start: usize| start < range.end;
+
+        // Nothing outside of the range points into it, since it is made of
+        // whole items, but the indices after it move.
+        let lo = self
+            .scopes
+            .partition_point(|scope| starts(scope.range.start));
+        let hi = self.scopes.partition_point(|scope| ends(scope.range.start));
+        let moved = |i: u32| {
+            if i as usize >= hi {
+                i + region.scopes.len() as u32 - (hi - lo) as u32
+            } else {
+                i
+            }
+        };
+        for scope in &mut self.scopes[hi..] {
+            scope.parent = scope.parent.map(moved);
+        }
+        for definition in &mut self.definitions {
+            definition.scope = definition.scope.map(moved);
+        }
+        let offset = lo as u32;
+        self.scopes.splice(
+            lo..hi,
+            region.scopes.into_iter().map(|mut scope| {
+                scope.parent = scope.parent.map(|parent| parent + offset);
+                scope
+            }),
+        );
+
+        let lo = self
+            .definitions
+            .partition_point(|definition| starts(definition.range.start));
+        let hi = self
+            .definitions
+            .partition_point(|definition| ends(definition.range.start));
+        affected.extend(
+            self.definitions[lo..hi]
+                .iter()
+                .map(|definition| definition.name),
+        );
+        affected.extend(region.definitions.iter().map(|definition| definition.name));
+        let added = region.definitions.len() as u32;
+        for reference in &mut self.references {
+            reference.definition = match reference.definition {
+                Some(i) if i as usize >= hi => Some(i + added - (hi - lo) as u32),
+                Some(i) if i as usize >= lo => None,
+                definition => definition,
+            };
+        }
+        self.definitions.splice(
+            lo..hi,
+            region.definitions.into_iter().map(|mut definition| {
+                definition.scope = definition.scope.map(|scope| scope + offset);
+                definition
+            }),
+        );
+
+        let lo = self
+            .references
+            .partition_point(|reference| starts(reference.range.start));
+        let hi = self
+            .references
+            .partition_point(|reference| ends(reference.range.start));
+        self.references.splice(lo..hi, region.references);
+    }
+
+    /// Runs the locals query over `range`, keeping the captures that start in
+    /// it. The query is compiled for OCaml, but both languages share their
+    /// node types.
+    fn query(&mut self, tree: &Tree, source: &[u8], range: Range<usize>) -> Region {
+        let query = queries::ocaml_locals();
+        let index = |name| query.capture_index_for_name(name).unwrap();
+        let (scope_index, definition_index, reference_index) = (
+            index("local.scope"),
+            index("local.definition"),
+            index("local.reference"),
+        );
+
+        let root = tree.root_node();
+        let mut scope_nodes = Vec::new();
+        let mut definition_nodes = Vec::new();
+        let mut reference_nodes = Vec::new();
+        let mut cursor = QueryCursor::new();
+        cursor.set_byte_range(range.clone());
+        for (query_match, i) in cursor.captures(query, root, source) {
+            let capture = query_match.captures[i];
+            if !range.contains(&capture.node.start_byte()) {
+                continue;
+            }
+            if capture.index == scope_index {
+                scope_nodes.push(capture.node);
+            } else if capture.index == definition_index {
+                definition_nodes.push(capture.node);
+            } else if capture.index == reference_index {
+                reference_nodes.push(capture.node);
+            }
+        }
+        scope_nodes.sort_by_key(|node| (node.start_byte(), Reverse(node.end_byte())));
+        definition_nodes.sort_by_key(|node| node.start_byte());
+        reference_nodes.sort_by_key(|node| node.start_byte());
+
+        let mut scopes: Vec<Scope> = Vec::with_capacity(scope_nodes.len());
+        let mut open: Vec<u32> = Vec::new();
+        for node in &scope_nodes {
+            close_scopes(&scopes, &mut open, node.start_byte() + 1);
+            scopes.push(Scope {
+                range: node.byte_range(),
+                parent: open.last().copied(),
+            });
+            open.push(scopes.len() as u32 - 1);
+        }
+
+        // Sweep the scopes again to find the innermost one around every
+        // definition.
+        let mut definitions = Vec::with_capacity(definition_nodes.len());
+        let mut next_scope = 0;
+        open.clear();
+        for node in definition_nodes {
+            while next_scope < scopes.len() && scopes[next_scope].range.start <= node.start_byte() {
+                close_scopes(&scopes, &mut open, scopes[next_scope].range.start + 1);
+                open.push(next_scope as u32);
+                next_scope += 1;
+            }
+            close_scopes(&scopes, &mut open, node.end_byte());
+            let scope = open.last().copied();
+            let scope_node = scope.map(|scope| scope_nodes[scope as usize]);
+            definitions.push(Definition {
+                name: self.intern(&source[node.byte_range()]),
+                range: node.byte_range(),
+                visible: visibility(node, scope_node, root),
+                scope,
+            });
+        }
+
+        let references = reference_nodes
+            .into_iter()
+            .map(|node| Reference {
+                name: self.intern(&source[node.byte_range()]),
+                range: node.byte_range(),
+                definition: None,
+            })
+            .collect();
+
+        Region {
+            scopes,
+            definitions,
+            references,
+        }
+    }
+
+    fn index_definitions(&mut self) {
+        let definitions = &self.definitions;
+        let mut order: Vec<u32> = (0..definitions.len() as u32).collect();
+        order.sort_by_key(|&i| {
+            let definition = &definitions[i as usize];
+            (
+                definition.name,
+                definition.visible.start,
+                Reverse(definition.visible.end),
+            )
+        });
+
+        let mut name_starts = vec![0; self.names.len() + 1];
+        for &i in &order {
+            name_starts[definitions[i as usize].name as usize + 1] += 1;
+        }
+        for name in 0..self.names.len() {
+            name_starts[name + 1] += name_starts[name];
+        }
+
+        // The visible ranges of the definitions of a name nest, so the one
+        // enclosing a definition is the closest earlier one still open.
+        let mut enclosing = vec![NONE; order.len()];
+        let mut open: Vec<u32> = Vec::new();
+        for name in 0..self.names.len() {
+            open.clear();
+            for position in name_starts[name]..name_starts[name + 1] {
+                let visible = &definitions[order[position as usize] as usize].visible;
+                while let Some(&top) = open.last() {
+                    let top_visible = &definitions[order[top as usize] as usize].visible;
+                    if top_visible.end > visible.start {
+                        break;
+                    }
+                    open.pop();
+                }
+                enclosing[position as usize] = open.last().copied().unwrap_or(NONE);
+                open.push(position);
+            }
+        }
+
+        self.order = order;
+        self.name_starts = name_starts;
+        self.enclosing = enclosing;
+    }
+
+    /// The innermost definition of `name` visible at `byte`.
+    fn resolve(&self, name: u32, byte: usize) -> Option<u32> {
+        let start = self.name_starts[name as usize] as usize;
+        let end = self.name_starts[name as usize + 1] as usize;
+        let candidates = self.order[start..end]
+            .partition_point(|&i| self.definitions[i as usize].visible.start <= byte);
+        let mut position = (start + candidates).checked_sub(1)?;
+        if position < start {
+            return None;
+        }
+        loop {
+            let definition = self.order[position];
+            if self.definitions[definition as usize].visible.end > byte {
+                return Some(definition);
+            }
+            position = match self.enclosing[position] {
+                NONE => return None,
+                enclosing => enclosing as usize,
+            };
+        }
+    }
+
+    fn index_uses(&mut self) {
+        let mut use_starts = vec![0u32; self.definitions.len() + 1];
+        for reference in &self.references {
+            if let Some(definition) = reference.definition {
+                use_starts[definition as usize + 1] += 1;
+            }
+        }
+        for i in 0..self.definitions.len() {
+            use_starts[i + 1] += use_starts[i];
+        }
+        let mut next = use_starts.clone();
+        let mut uses = vec![0; use_starts[self.definitions.len()] as usize];
+        for (i, reference) in self.references.iter().enumerate() {
+            if let Some(definition) = reference.definition {
+                uses[next[definition as usize] as usize] = i as u32;
+                next[definition as usize] += 1;
+            }
+        }
+        self.use_starts = use_starts;
+        self.uses = uses;
+    }
+}
+
+/// Pops the scopes that end before `byte` off the stack of open scopes.
+fn close_scopes(scopes: &[Scope], open: &mut Vec<u32>, byte: usize) {
+    while let Some(&top) = open.last() {
+        if scopes[top as usize].range.end >= byte {
+            break;
+        }
+        open.pop();
+    }
+}
+
+/// Where a definition in `scope` is visible.
+fn visibility(definition: Node, scope: Option<Node>, root: Node) -> Range<usize> {
+    let scope = match scope {
+        Some(scope) => scope,
+        None => return definition.end_byte()..root.end_byte(),
+    };
+    // The names bound by a `let`, as opposed to its parameters.
+    if scope.kind() == "let_binding" {
+        let pattern = scope.child_by_field_name("pattern");
+        let value_definition = scope.parent();
+        if let (Some(pattern), Some(value_definition)) = (pattern, value_definition) {
+            if pattern.start_byte() <= definition.start_byte()
+                && definition.end_byte() <= pattern.end_byte()
+            {
+                let start = if is_recursive(value_definition) {
+                    value_definition.start_byte()
+                } else {
+                    value_definition.end_byte()
+                };
+                let end = value_definition
+                    .parent()
+                    .map_or(value_definition.end_byte(), |parent| parent.end_byte());
+                return start..end;
+            }
+        }
+    }
+    // The index of a `for` loop isn't visible in its bounds.
+    if scope.kind() == "for_expression" {
+        if let Some(to) = scope.child_by_field_name("to") {
+            return to.end_byte()..scope.end_byte();
+        }
+    }
+    definition.end_byte()..scope.end_byte()
+}
+
+fn is_recursive(value_definition: Node) -> bool {
+    let mut cursor = value_definition.walk();
+    let recursive = value_definition
+        .children(&mut cursor)
+        .take_while(|child| child.kind() != "let_binding")
+        .any(|child| child.kind() == "rec");
+    recursive
+}
+
+/// The ranges of the items of a compilation unit.
+pub(crate) fn top_level_items(root: Node) -> Vec<Range<usize>> {
+    let mut cursor = root.walk();
+    let items = root
+        .children(&mut cursor)
+        .filter(|child| !child.is_extra())
+        .map(|child| child.byte_range())
+        .collect();
+    items
+}
+
+/// Where an edit moves `byte`. Bytes in the replaced text move to its end.
+pub(crate) fn shift_byte(byte: usize, edit: &InputEdit) -> usize {
+    if byte >= edit.old_end_byte {
+        byte - edit.old_end_byte + edit.new_end_byte
+    } else if byte > edit.new_end_byte {
+        edit.new_end_byte
+    } else {
+        byte
+    }
+}
+
+/// Grows the changed ranges to whole top-level items, old and new, and merges
+/// those that overlap.
+pub(crate) fn regions(
+    mut changed: Vec<Range<usize>>,
+    old_items: &[Range<usize>],
+    items: &[Range<usize>],
+) -> Vec<Range<usize>> {
+    let touches = |a: &Range<usize>, b: &Range<usize>| a.start <= b.end && b.start <= a.end;
+    changed.sort_by_key(|range| range.start);
+    let mut regions: Vec<Range<usize>> = Vec::new();
+    for mut range in changed {
+        loop {
+            let mut grown = range.clone();
+            for item in old_items.iter().chain(items) {
+                if touches(item, &grown) {
+                    grown.start = grown.start.min(item.start);
+                    grown.end = grown.end.max(item.end);
+                }
+            }
+            if grown == range {
+                break;
+            }
+            range = grown;
+        }
+        match regions.last_mut() {
+            Some(last) if touches(last, &range) => {
+                last.start = last.start.min(range.start);
+                last.end = last.end.max(range.end);
+            }
+            _ => regions.push(range),
+        }
+    }
+    regions
+}
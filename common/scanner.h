@@ -1,12 +1,20 @@
 #ifndef TREE_SITTER_OCAML_SCANNER_H_
 #define TREE_SITTER_OCAML_SCANNER_H_
 
-#define QUOTED_STRING_DEPTH 10
-
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <tree_sitter/parser.h>
-#include <wctype.h>
+
+// Bytes of quoted string state kept inside the scanner before it has to grow
+// on the heap. This covers a few levels of nesting with short ids.
+#define INLINE_FRAMES_SIZE 48
+
+// The longest quoted string id recognized during error recovery. The scanner
+// is then tried at every position, and reading a long run of lowercase letters
+// that isn't followed by `|` again from each of them would be quadratic.
+#define RECOVERY_QUOTED_STRING_ID_MAX 16
 
 enum TokenType {
   LEFT_QUOTED_STRING_DELIM,
@@ -14,46 +22,236 @@ enum TokenType {
   START_INTERPOLATION,
   LINE_NUMBER_DIRECTIVE,
   NULL_CHARACTER,
+  COMMENT,
+  STRING_FRAGMENT,
+  QUOTED_STRING_FRAGMENT,
+  IMPLEMENTATION_START,
+  INTERFACE_START,
+  ERROR_SENTINEL,
 };
 
-enum ParserState {
-  IN_QUOTED_STRING,
-  IN_NOTHING,
+// Character classes
+
+enum CharClass {
+  SPACE = 1 << 0,
+  DIGIT = 1 << 1,
+  LOWER = 1 << 2,
+  UPPER = 1 << 3,
+  IDENTIFIER = 1 << 4,
 };
 
-typedef struct {
-  size_t id_length;
-  enum ParserState state;
-  char id[1000];
-} Scan_state;
+// Only ASCII characters are significant to the scanner, so classify them with
+// a table instead of the locale-dependent `isw*` functions.
+static const uint8_t char_classes[128] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, SPACE, SPACE, SPACE, SPACE, SPACE, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    SPACE, 0, 0, 0, 0, 0, 0, IDENTIFIER,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    DIGIT, DIGIT, DIGIT, DIGIT, DIGIT, DIGIT, DIGIT, DIGIT,
+    DIGIT, DIGIT, 0, 0, 0, 0, 0, 0,
+    0, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER,
+    UPPER, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER,
+    UPPER, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER, UPPER,
+    UPPER, UPPER, UPPER, 0, 0, 0, 0, IDENTIFIER,
+    0, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER,
+    LOWER, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER,
+    LOWER, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER, LOWER,
+    LOWER, LOWER, LOWER, 0, 0, 0, 0, 0,
+};
 
-typedef struct {
-  size_t state_depth;
+static inline bool is_class(int32_t c, uint8_t char_class) {
+  return c >= 0 && c < 128 && (char_classes[c] & char_class) != 0;
+}
+
+static inline bool is_space(int32_t c) { return is_class(c, SPACE); }
+
+static inline bool is_digit(int32_t c) { return is_class(c, DIGIT); }
+
+static inline bool is_lower(int32_t c) { return is_class(c, LOWER); }
+
+static inline bool is_upper(int32_t c) { return is_class(c, UPPER); }
+
+static inline bool is_alpha(int32_t c) { return is_class(c, LOWER | UPPER); }
+
+static inline bool is_identifier_char(int32_t c) {
+  return is_class(c, LOWER | UPPER | DIGIT | IDENTIFIER);
+}
+
+static inline bool is_identifier_start(int32_t c) {
+  return c == '_' || is_alpha(c);
+}
+
+// Allocation
+//
+// Defining TREE_SITTER_OCAML_SHARED_ALLOCATOR makes the scanner allocate with
+// the functions set by `ts_set_allocator`, like the rest of the parser, so that
+// an arena given to tree-sitter also holds the scanner.
+
+#ifdef TREE_SITTER_OCAML_SHARED_ALLOCATOR
+extern void *(*ts_current_malloc)(size_t);
+extern void *(*ts_current_calloc)(size_t, size_t);
+extern void *(*ts_current_realloc)(void *, size_t);
+extern void (*ts_current_free)(void *);
+
+#define scanner_malloc ts_current_malloc
+#define scanner_calloc ts_current_calloc
+#define scanner_realloc ts_current_realloc
+#define scanner_free ts_current_free
+#else
+#define scanner_malloc malloc
+#define scanner_calloc calloc
+#define scanner_realloc realloc
+#define scanner_free free
+#endif
 
-  Scan_state *states[QUOTED_STRING_DEPTH];
+// Scanner state
+//
+// The ids of the open quoted strings are kept as a stack of frames in a single
+// buffer, which lives inside the scanner until it outgrows it. Every frame is
+// laid out as `[length][id][length]` so the stack can be walked in both
+// directions without an index.
+
+typedef struct {
+  uint32_t depth;
+  // The number of outermost frames whose ids a truncated state dropped, see
+  // `serialize_state`. Their ids are empty and no delimiter closes them.
+  uint32_t lost;
+  uint32_t size;
+  uint32_t capacity;
+  char *frames;
+  char inline_frames[INLINE_FRAMES_SIZE];
+  // Whether the file is an interface (`.mli`). Both grammars share one parse
+  // table, and the scanner picks its entry point, see `scan_token`.
+  bool interface;
 } Scanner;
 
-static inline Scan_state *get_current_state(Scanner *scanner) {
-  return scanner->states[scanner->state_depth - 1];
+// Statistics
+//
+// Defining TREE_SITTER_OCAML_SCANNER_STATS makes the scanner keep the counters
+// of scanner_stats.h. Otherwise `COUNT` does nothing.
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+
+#include "scanner_stats.h"
+
+#ifdef _MSC_VER
+#define SCANNER_THREAD_LOCAL __declspec(thread)
+#else
+#define SCANNER_THREAD_LOCAL __thread
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+static inline uint64_t read_cycles(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+static inline uint64_t read_cycles(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && defined(__aarch64__)
+static inline uint64_t read_cycles(void) {
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
 }
-static inline void remove_state(Scanner *scanner) { scanner->state_depth--; }
+#else
+static inline uint64_t read_cycles(void) { return 0; }
+#endif
+
+typedef char scanner_stats_token_types_match
+    [SCANNER_STATS_TOKEN_TYPES == ERROR_SENTINEL + 1 ? 1 : -1];
+
+static SCANNER_THREAD_LOCAL ScannerStats scanner_stats[2];
 
-static inline void add_state(Scanner *scanner, enum ParserState new_state) {
-  scanner->state_depth++;
-  Scan_state *state = get_current_state(scanner);
-  state->state = new_state;
-  state->id_length = 0;
+#define COUNT(scanner, counter, n) \
+  (scanner_stats[(scanner)->interface].counter += (n))
+
+// Copies the counters of implementations or interfaces into `stats` and resets
+// them.
+static void take_scanner_stats(ScannerStats *stats, bool interface) {
+  *stats = scanner_stats[interface];
+  memset(&scanner_stats[interface], 0, sizeof(ScannerStats));
 }
 
-static inline void quoted_string_id_clear(Scan_state *state) {
-  state->id_length = 0;
+#else
+
+#define COUNT(scanner, counter, n) ((void)0)
+
+#endif
+
+#define FRAME_OVERHEAD (2 * sizeof(uint32_t))
+
+static inline uint32_t read_length(const char *buffer) {
+  uint32_t length;
+  memcpy(&length, buffer, sizeof(length));
+  return length;
+}
+
+static inline void write_length(char *buffer, uint32_t length) {
+  memcpy(buffer, &length, sizeof(length));
+}
+
+static void grow(Scanner *scanner, uint32_t required) {
+  uint32_t capacity = scanner->capacity * 2;
+  if (capacity < required) capacity = required;
+
+  if (scanner->frames == scanner->inline_frames) {
+    char *frames = scanner_malloc(capacity);
+    if (frames == NULL) abort();
+    memcpy(frames, scanner->inline_frames, scanner->size);
+    scanner->frames = frames;
+  } else {
+    char *frames = scanner_realloc(scanner->frames, capacity);
+    if (frames == NULL) abort();
+    scanner->frames = frames;
+  }
+  scanner->capacity = capacity;
+}
+
+static inline void reserve(Scanner *scanner, uint32_t additional) {
+  uint32_t required = scanner->size + additional;
+  if (required > scanner->capacity) grow(scanner, required);
+}
+
+static inline uint32_t quoted_string_id_length(Scanner *scanner) {
+  return read_length(scanner->frames + scanner->size - sizeof(uint32_t));
+}
+
+static inline const char *quoted_string_id(Scanner *scanner) {
+  return scanner->frames + scanner->size - sizeof(uint32_t) -
+         quoted_string_id_length(scanner);
+}
+
+// Opens a frame at the top of the stack; the id is appended with
+// `quoted_string_id_push` and the frame completed with `push_quoted_string`.
+static inline uint32_t quoted_string_id_start(Scanner *scanner) {
+  reserve(scanner, sizeof(uint32_t));
+  uint32_t start = scanner->size;
+  scanner->size += sizeof(uint32_t);
+  return start;
 }
 
 static inline void quoted_string_id_push(Scanner *scanner, char c) {
-  Scan_state *state = get_current_state(scanner);
-  state->id[state->id_length++] = c;
+  reserve(scanner, 1);
+  scanner->frames[scanner->size++] = c;
 }
 
+static inline void push_quoted_string(Scanner *scanner, uint32_t start) {
+  uint32_t length = scanner->size - start - sizeof(uint32_t);
+  reserve(scanner, sizeof(uint32_t));
+  write_length(scanner->frames + start, length);
+  write_length(scanner->frames + scanner->size, length);
+  scanner->size += sizeof(uint32_t);
+  scanner->depth++;
+}
+
+static inline void pop_quoted_string(Scanner *scanner) {
+  scanner->size -= quoted_string_id_length(scanner) + FRAME_OVERHEAD;
+  scanner->depth--;
+}
+
+// Lexer helpers
+
 static inline void advance(TSLexer *lexer) { lexer->advance(lexer, false); }
 
 static inline void mark_end(TSLexer *lexer) { lexer->mark_end(lexer); }
@@ -66,102 +264,247 @@ static inline bool next_is(TSLexer *lexer, char c) {
   return lexer->lookahead == c;
 }
 
+// Consumes an id of at most `max_length` characters and the `|` after it.
 static bool parse_left_quoted_string_delimiter(Scanner *scanner,
-                                               TSLexer *lexer) {
-  // Ensure we remove any leftovers from previous uses
-  add_state(scanner, IN_QUOTED_STRING);
+                                               TSLexer *lexer,
+                                               uint32_t max_length) {
+  uint32_t start = quoted_string_id_start(scanner);
+  uint32_t length = 0;
 
-  while (iswlower(lexer->lookahead) || next_is(lexer, '_')) {
+  while ((is_lower(lexer->lookahead) || next_is(lexer, '_')) &&
+         length++ < max_length) {
     quoted_string_id_push(scanner, lexer->lookahead);
     advance(lexer);
   }
 
   if (lexer->lookahead != '|') {
-    remove_state(scanner);
+    scanner->size = start;
     return false;
   }
 
+  push_quoted_string(scanner, start);
   advance(lexer);
   return true;
 }
 
-static bool scan_right_quoted_string_delimiter(Scanner *scanner,
-                                               TSLexer *lexer) {
-  Scan_state *state = get_current_state(scanner);
+// Called after `|`. Consumes the id of the innermost quoted string as far as
+// it matches, but not the `}`.
+static bool scan_quoted_string_end(Scanner *scanner, TSLexer *lexer) {
+  if (scanner->depth <= scanner->lost) return false;
+  const char *id = quoted_string_id(scanner);
+  uint32_t id_length = quoted_string_id_length(scanner);
 
-  if (state->id_length > 0) {
-    for (size_t i = 0; i < state->id_length; i++) {
-      if (lexer->lookahead != state->id[i]) return false;
-      advance(lexer);
-    }
+  for (uint32_t i = 0; i < id_length; i++) {
+    if (lexer->lookahead != id[i]) return false;
+    advance(lexer);
   }
-  if (lexer->lookahead != '}') return false;
+  return lexer->lookahead == '}';
+}
+
+static bool scan_right_quoted_string_delimiter(Scanner *scanner,
+                                               TSLexer *lexer) {
+  if (!scan_quoted_string_end(scanner, lexer)) return false;
   // we don't advance here because we want to leave the '}'
-  remove_state(scanner);
+  pop_quoted_string(scanner);
   return true;
 }
 
-static Scanner *create() {
-  Scanner *scanner = calloc(1, sizeof(Scanner));
-  for (size_t i = 0; i < QUOTED_STRING_DEPTH; i++) {
-    scanner->states[i] = calloc(1, sizeof(Scan_state));
-  }
+static Scanner *create(bool interface) {
+  Scanner *scanner = scanner_calloc(1, sizeof(Scanner));
+  scanner->frames = scanner->inline_frames;
+  scanner->capacity = INLINE_FRAMES_SIZE;
+  scanner->interface = interface;
   return scanner;
 }
 
 static void destroy(Scanner *scanner) {
-  for (size_t i = 0; i < QUOTED_STRING_DEPTH; i++) {
-    free(scanner->states[i]);
+  if (scanner->frames != scanner->inline_frames) {
+    scanner_free(scanner->frames);
+  }
+  scanner_free(scanner);
+}
+
+// Serialization
+//
+// Nothing is written outside of quoted strings. Otherwise the state starts
+// with `depth << 1 | truncated`, followed by the number of stored frames if
+// `truncated` is set. The stored frames come outermost first: the first one as
+// `length id`, every other one as `prefix suffix_length suffix`, a delta
+// against the id of the frame enclosing it. All numbers are LEB128 varints.
+//
+// When the stack doesn't fit into the serialization buffer only the innermost
+// frames are stored, and the outermost ones come back lost: with empty ids,
+// which no `|id}` matches, since the id it would have to match is unknown. The
+// strings they belong to then run to the end of the input rather than closing
+// at whatever `|}` comes first. Lost frames are never stored again, so a
+// state that was truncated once stays truncated.
+
+#define VARINT_MAX_SIZE 5
+
+static inline unsigned varint_size(uint32_t value) {
+  unsigned size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
   }
-  free(scanner);
+  return size;
 }
-static size_t total_quoted_string_length(Scanner *scanner) {
-  size_t length = 0;
-  for (size_t i = 0; i < scanner->state_depth; i++) {
-    Scan_state *state = scanner->states[i];
-    length += state->id_length;
+
+static inline unsigned write_varint(char *buffer, uint32_t value) {
+  unsigned size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = (char)(value | 0x80);
+    value >>= 7;
   }
-  return length;
+  buffer[size++] = (char)value;
+  return size;
 }
 
-static unsigned serialize_scan_state(Scan_state *state, char *buffer) {
-  buffer[0] = state->state;
-  buffer[1] = state->id_length;
-  memcpy(buffer + 2, state->id, state->id_length);
+// Returns the number of bytes read, or 0 if the varint is malformed.
+static inline unsigned read_varint(const char *buffer, unsigned length,
+                                   uint32_t *value) {
+  uint32_t result = 0;
+  for (unsigned i = 0; i < length && i < VARINT_MAX_SIZE; i++) {
+    uint8_t byte = (uint8_t)buffer[i];
+    result |= (uint32_t)(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
 
-  return 2 + state->id_length;
+static inline uint32_t common_prefix(const char *a, uint32_t a_length,
+                                     const char *b, uint32_t b_length) {
+  uint32_t length = a_length < b_length ? a_length : b_length;
+  uint32_t i = 0;
+  while (i < length && a[i] == b[i]) i++;
+  return i;
 }
 
-static unsigned serialize(Scanner *scanner, char *buffer) {
-  buffer[0] = scanner->state_depth;
+static inline unsigned delta_size(uint32_t prefix, uint32_t id_length) {
+  uint32_t suffix_length = id_length - prefix;
+  return varint_size(prefix) + varint_size(suffix_length) + suffix_length;
+}
+
+static unsigned serialize_state(Scanner *scanner, char *buffer) {
+  if (scanner->depth == 0) return 0;
+
+  const unsigned budget =
+      TREE_SITTER_SERIALIZATION_BUFFER_SIZE - 2 * VARINT_MAX_SIZE;
+
+  // Walk from the innermost frame outwards to find how many frames fit, given
+  // that the outermost stored frame is written in full.
+  uint32_t kept = 0;
+  uint32_t first = scanner->size;
+  unsigned deltas = 0;
+  uint32_t end = scanner->size;
+  for (uint32_t i = 0; i < scanner->depth - scanner->lost; i++) {
+    uint32_t id_length = read_length(scanner->frames + end - sizeof(uint32_t));
+    uint32_t start = end - id_length - FRAME_OVERHEAD;
+    const char *id = scanner->frames + start + sizeof(uint32_t);
 
-  unsigned length = 1;
-  for (size_t j = 0; j < scanner->state_depth; j++) {
-    Scan_state *state = scanner->states[j];
-    length += serialize_scan_state(state, buffer + length);
+    if (deltas + varint_size(id_length) + id_length <= budget) {
+      kept = i + 1;
+      first = start;
+    }
+
+    if (start == 0) break;
+    uint32_t outer_end = start - sizeof(uint32_t);
+    uint32_t outer_length = read_length(scanner->frames + outer_end);
+    const char *outer = scanner->frames + outer_end - outer_length;
+    deltas += delta_size(common_prefix(outer, outer_length, id, id_length),
+                         id_length);
+    if (deltas > budget) break;
+    end = start;
+  }
+
+  bool truncated = kept < scanner->depth;
+  unsigned length = write_varint(buffer, scanner->depth << 1 | truncated);
+  if (truncated) length += write_varint(buffer + length, kept);
+  if (kept == 0) return length;
+
+  uint32_t id_length = read_length(scanner->frames + first);
+  const char *id = scanner->frames + first + sizeof(uint32_t);
+  length += write_varint(buffer + length, id_length);
+  memcpy(buffer + length, id, id_length);
+  length += id_length;
+
+  for (uint32_t offset = first + id_length + FRAME_OVERHEAD;
+       offset < scanner->size;) {
+    const char *outer = id;
+    uint32_t outer_length = id_length;
+    id_length = read_length(scanner->frames + offset);
+    id = scanner->frames + offset + sizeof(uint32_t);
+    uint32_t prefix = common_prefix(outer, outer_length, id, id_length);
+
+    length += write_varint(buffer + length, prefix);
+    length += write_varint(buffer + length, id_length - prefix);
+    memcpy(buffer + length, id + prefix, id_length - prefix);
+    length += id_length - prefix;
+    offset += id_length + FRAME_OVERHEAD;
   }
+
+  assert(length <= TREE_SITTER_SERIALIZATION_BUFFER_SIZE);
   return length;
 }
-static const char *deserialize_scan_state(Scan_state *state,
-                                          const char *buffer) {
-  state->state = buffer[0];
-  state->id_length = buffer[1];
-  memcpy(state->id, buffer + 2, state->id_length);
 
-  return buffer + state->id_length + 2;
-}
+static void deserialize_state(Scanner *scanner, const char *buffer,
+                              unsigned length) {
+  scanner->depth = 0;
+  scanner->lost = 0;
+  scanner->size = 0;
+  if (length == 0) return;
+
+  uint32_t header, kept;
+  unsigned offset = read_varint(buffer, length, &header);
+  if (offset == 0) return;
+  uint32_t depth = header >> 1;
+  kept = depth;
+  if (header & 1) {
+    unsigned read = read_varint(buffer + offset, length - offset, &kept);
+    if (read == 0 || kept > depth) return;
+    offset += read;
+  }
+
+  for (uint32_t i = kept; i < depth; i++) {
+    push_quoted_string(scanner, quoted_string_id_start(scanner));
+  }
+  scanner->lost = depth - kept;
+
+  for (uint32_t i = 0; i < kept; i++) {
+    uint32_t prefix = 0, suffix_length;
+    unsigned read;
+    if (i > 0) {
+      read = read_varint(buffer + offset, length - offset, &prefix);
+      if (read == 0) return;
+      offset += read;
+    }
+    read = read_varint(buffer + offset, length - offset, &suffix_length);
+    if (read == 0 || suffix_length > length - offset - read) return;
+    offset += read;
 
-// DONE
-static void deserialize(Scanner *scanner, const char *buffer, unsigned length) {
-  if (length > 0) {
-    scanner->state_depth = buffer[0];
-    const char *offset_buffer = buffer + 1;
-    for (size_t j = 0; j < scanner->state_depth; j++) {
-      Scan_state *state = scanner->states[j];
-      offset_buffer = deserialize_scan_state(state, offset_buffer);
+    uint32_t outer = 0;
+    if (i > 0) {
+      uint32_t outer_length = quoted_string_id_length(scanner);
+      if (prefix > outer_length) return;
+      outer = scanner->size - sizeof(uint32_t) - outer_length;
     }
+
+    reserve(scanner, FRAME_OVERHEAD + prefix + suffix_length);
+    char *frame = scanner->frames + scanner->size;
+    uint32_t id_length = prefix + suffix_length;
+    write_length(frame, id_length);
+    memcpy(frame + sizeof(uint32_t), scanner->frames + outer, prefix);
+    memcpy(frame + sizeof(uint32_t) + prefix, buffer + offset, suffix_length);
+    write_length(frame + sizeof(uint32_t) + id_length, id_length);
+    scanner->size += id_length + FRAME_OVERHEAD;
+    scanner->depth++;
+    offset += suffix_length;
   }
 }
+
 static inline bool try_parse_line_number_directive(Scanner *scanner,
                                                    TSLexer *lexer) {
   advance(lexer);
@@ -170,8 +513,8 @@ static inline bool try_parse_line_number_directive(Scanner *scanner,
     advance(lexer);
   }
 
-  if (!iswdigit(lexer->lookahead)) return false;
-  while (iswdigit(lexer->lookahead)) advance(lexer);
+  if (!is_digit(lexer->lookahead)) return false;
+  while (is_digit(lexer->lookahead)) advance(lexer);
 
   while (next_is(lexer, ' ') || next_is(lexer, '\t')) {
     advance(lexer);
@@ -197,65 +540,561 @@ static inline bool try_parse_line_number_directive(Scanner *scanner,
 }
 
 
+// Called after `$`. Consumes the module name if it exists, but not the `{`.
+static bool scan_interpolation_start(TSLexer *lexer) {
+  if (is_upper(lexer->lookahead)) {
+    advance(lexer);
+    while (is_alpha(lexer->lookahead)) {
+      advance(lexer);
+    }
+  }
+  return lexer->lookahead == '{';
+}
+
 static bool scan_left_interpolation_delim(Scanner *scanner, TSLexer *lexer) {
-  //because we only want to know if we are starting the interpolation we mark this as the end 
+  //because we only want to know if we are starting the interpolation we mark this as the end
   mark_end(lexer);
-  // scan the Module name if it exists
-  if (iswupper(lexer->lookahead)) {
+  return scan_interpolation_start(lexer);
+}
+
+// String content
+//
+// The text of string and quoted string literals is scanned in runs that only
+// end where an escape sequence, a format specifier, an interpolation or the
+// end of the literal begins; those are left to the grammar. The candidates
+// `%`, `@` and `$` are checked in full before ending a run on them, so runs
+// aren't split where they turn out to be plain text. When a candidate is
+// checked past the end of a non-empty run, the end is marked before it.
+
+static inline bool is_conversion_char(int32_t c) {
+  switch (c) {
+    case 'd': case 'i': case 'u': case 'n': case 'l': case 'L': case 'N':
+    case 'x': case 'X': case 'o': case 's': case 'S': case 'c': case 'C':
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'h':
+    case 'H': case 'b': case 'B': case 'a': case 't': case '!': case '%':
+    case '@': case ',':
+      return true;
+    default:
+      return false;
+  }
+}
+
+static inline bool is_indication_char(int32_t c) {
+  switch (c) {
+    case '[': case ']': case ',': case ' ': case ';': case '.': case '{':
+    case '}': case '?':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Called after `%`. Consumes the flag, width and precision, none of which end
+// a run.
+static bool scan_conversion_specification(TSLexer *lexer) {
+  switch (lexer->lookahead) {
+    case '-': case '0': case '+': case ' ': case '#':
+      advance(lexer);
+      break;
+  }
+  if (next_is(lexer, '*')) {
+    advance(lexer);
+  } else if (is_digit(lexer->lookahead) && !next_is(lexer, '0')) {
+    while (is_digit(lexer->lookahead)) advance(lexer);
+  }
+  if (next_is(lexer, '.')) {
     advance(lexer);
-    while (iswalpha(lexer->lookahead)) {
+    if (next_is(lexer, '*')) {
       advance(lexer);
+    } else {
+      while (is_digit(lexer->lookahead)) advance(lexer);
     }
   }
-  if (lexer->lookahead != '{') return false;
-  advance(lexer);
-  return true;
+  return is_conversion_char(lexer->lookahead);
 }
 
-static bool scan(Scanner *scanner, TSLexer *lexer, const bool *valid_symbols) {
-  while (iswspace(lexer->lookahead)) {
-    skip(lexer);
+// Called after `@<`.
+static bool scan_box_offset(TSLexer *lexer) {
+  if (!is_digit(lexer->lookahead)) return false;
+  while (is_digit(lexer->lookahead)) advance(lexer);
+  return next_is(lexer, '>');
+}
+
+static bool scan_string_fragment(TSLexer *lexer) {
+  lexer->result_symbol = STRING_FRAGMENT;
+  bool has_content = false;
+  for (;;) {
+    switch (lexer->lookahead) {
+      case '"':
+      case '\\':
+        mark_end(lexer);
+        return has_content;
+      case '%':
+        mark_end(lexer);
+        advance(lexer);
+        if (scan_conversion_specification(lexer)) return has_content;
+        break;
+      case '@':
+        mark_end(lexer);
+        advance(lexer);
+        if (is_indication_char(lexer->lookahead)) return has_content;
+        if (next_is(lexer, '<')) {
+          advance(lexer);
+          if (scan_box_offset(lexer)) return has_content;
+        } else if (next_is(lexer, '\\')) {
+          // The backslash starts an escape sequence unless it belongs to `@\n`,
+          // so a run can't go on past it either way.
+          if (has_content) return true;
+          mark_end(lexer);
+          advance(lexer);
+          return !next_is(lexer, 'n');
+        }
+        break;
+      case '\0':
+        if (eof(lexer)) {
+          mark_end(lexer);
+          return has_content;
+        }
+        advance(lexer);
+        break;
+      default:
+        advance(lexer);
+        break;
+    }
+    has_content = true;
   }
-  enum ParserState p_state = IN_NOTHING;
+}
 
-  if (scanner->state_depth != 0) {
-    p_state = get_current_state(scanner)->state;
+static bool scan_quoted_string_fragment(Scanner *scanner, TSLexer *lexer,
+                                        const bool *valid_symbols) {
+  lexer->result_symbol = QUOTED_STRING_FRAGMENT;
+  bool has_content = false;
+  for (;;) {
+    switch (lexer->lookahead) {
+      case '|':
+        mark_end(lexer);
+        advance(lexer);
+        if (scan_quoted_string_end(scanner, lexer)) {
+          if (has_content) return true;
+          if (!valid_symbols[RIGHT_QUOTED_STRING_DELIM]) return false;
+          mark_end(lexer);
+          pop_quoted_string(scanner);
+          lexer->result_symbol = RIGHT_QUOTED_STRING_DELIM;
+          return true;
+        }
+        break;
+      case '$':
+        if (!valid_symbols[START_INTERPOLATION]) {
+          advance(lexer);
+          break;
+        }
+        // At the start of the token a `$` is either an interpolation or a
+        // run of its own.
+        if (has_content) mark_end(lexer);
+        advance(lexer);
+        if (!has_content) mark_end(lexer);
+        if (next_is(lexer, '$')) {
+          // `$$` escapes an interpolation. Otherwise the second `$` has to be
+          // looked at on its own.
+          advance(lexer);
+          while (is_identifier_char(lexer->lookahead)) advance(lexer);
+          return has_content || !next_is(lexer, '{');
+        }
+        if (scan_interpolation_start(lexer)) {
+          if (!has_content) lexer->result_symbol = START_INTERPOLATION;
+          return true;
+        }
+        break;
+      case '%':
+        mark_end(lexer);
+        advance(lexer);
+        if (scan_conversion_specification(lexer)) return has_content;
+        break;
+      case '@':
+        mark_end(lexer);
+        advance(lexer);
+        if (is_indication_char(lexer->lookahead)) return has_content;
+        if (next_is(lexer, '<')) {
+          advance(lexer);
+          if (scan_box_offset(lexer)) return has_content;
+        } else if (next_is(lexer, '\\')) {
+          advance(lexer);
+          if (next_is(lexer, 'n')) return has_content;
+        }
+        break;
+      case '\0':
+        if (eof(lexer)) {
+          mark_end(lexer);
+          return has_content;
+        }
+        advance(lexer);
+        break;
+      default:
+        advance(lexer);
+        break;
+    }
+    has_content = true;
   }
+}
 
-  switch (p_state) {
-    case IN_QUOTED_STRING:
-      if (valid_symbols[RIGHT_QUOTED_STRING_DELIM] && next_is(lexer, '|')) {
+// Comments
+//
+// Comments nest and may contain string, quoted string and character literals,
+// inside which `*)` doesn't close the comment. This follows the `comment` rule
+// of the OCaml lexer: identifiers are skipped as a whole since they may contain
+// quotes, and a quote only starts a character literal if the literal is
+// complete. Literals that turn out to be incomplete are taken apart again, so
+// a character consumed while trying one is handed back to be interpreted.
+
+static bool scan_comment_string(TSLexer *lexer) {
+  for (;;) {
+    switch (lexer->lookahead) {
+      case '"':
         advance(lexer);
-        lexer->result_symbol = RIGHT_QUOTED_STRING_DELIM;
-        return scan_right_quoted_string_delimiter(scanner, lexer);
-      }
+        return true;
+      case '\\':
+        advance(lexer);
+        if (eof(lexer)) return false;
+        advance(lexer);
+        break;
+      case '\0':
+        if (eof(lexer)) return false;
+        advance(lexer);
+        break;
+      default:
+        advance(lexer);
+        break;
+    }
+  }
+}
+
+// Called after `{`. Returns false if a quoted string was opened but never
+// closed.
+static bool scan_comment_quoted_string(Scanner *scanner, TSLexer *lexer,
+                                       bool *in_identifier) {
+  if (next_is(lexer, '%')) {
+    advance(lexer);
+    if (next_is(lexer, '%')) advance(lexer);
+    for (;;) {
+      if (!is_identifier_start(lexer->lookahead)) return true;
+      while (is_identifier_char(lexer->lookahead)) advance(lexer);
+      if (!next_is(lexer, '.')) break;
+      advance(lexer);
+    }
+    while (next_is(lexer, ' ') || next_is(lexer, '\t') ||
+           next_is(lexer, '\f')) {
+      advance(lexer);
+    }
+  }
 
-      if (valid_symbols[START_INTERPOLATION] && next_is(lexer, '$')) {
+  uint32_t start = quoted_string_id_start(scanner);
+  while (is_lower(lexer->lookahead) || next_is(lexer, '_')) {
+    quoted_string_id_push(scanner, lexer->lookahead);
+    advance(lexer);
+  }
+  if (!next_is(lexer, '|')) {
+    *in_identifier = scanner->size > start + sizeof(uint32_t);
+    scanner->size = start;
+    return true;
+  }
+  advance(lexer);
+
+  const char *id = scanner->frames + start + sizeof(uint32_t);
+  uint32_t id_length = scanner->size - start - sizeof(uint32_t);
+  for (;;) {
+    if (next_is(lexer, '|')) {
+      advance(lexer);
+      uint32_t i = 0;
+      while (i < id_length && lexer->lookahead == id[i]) {
         advance(lexer);
-        lexer->result_symbol = START_INTERPOLATION;
-        return scan_left_interpolation_delim(scanner, lexer);
+        i++;
       }
-    case IN_NOTHING:
-      if (valid_symbols[LEFT_QUOTED_STRING_DELIM] &&
-          (iswlower(lexer->lookahead) || next_is(lexer, '_') ||
-           next_is(lexer, '|'))) {
-        lexer->result_symbol = LEFT_QUOTED_STRING_DELIM;
-        return parse_left_quoted_string_delimiter(scanner, lexer);
-      }
-      if (next_is(lexer, '#') && lexer->get_column(lexer) == 0) {
-        return try_parse_line_number_directive(scanner, lexer);
+      if (i == id_length && next_is(lexer, '}')) {
+        advance(lexer);
+        scanner->size = start;
+        return true;
       }
+    } else if (next_is(lexer, '\0') && eof(lexer)) {
+      scanner->size = start;
+      return false;
+    } else {
+      advance(lexer);
+    }
+  }
+}
+
+static inline bool is_escaped_char(int32_t c) {
+  switch (c) {
+    case '\\':
+    case '"':
+    case '\'':
+    case 'n':
+    case 't':
+    case 'b':
+    case 'r':
+    case ' ':
+      return true;
+    default:
+      return false;
+  }
+}
 
-      if (valid_symbols[NULL_CHARACTER] && next_is(lexer, '\0') &&
-          !eof(lexer)) {
+// Called after `'`. Returns the character that has been consumed but still
+// needs to be interpreted when this isn't a character literal, or 0.
+static int32_t scan_comment_character(TSLexer *lexer) {
+  int32_t c = lexer->lookahead;
+
+  if (c == '\\') {
+    advance(lexer);
+    c = lexer->lookahead;
+    if (is_escaped_char(c)) {
+      advance(lexer);
+    } else if (is_digit(c)) {
+      for (int i = 0; i < 3 && is_digit(lexer->lookahead); i++) {
         advance(lexer);
-        lexer->result_symbol = NULL_CHARACTER;
-        return true;
       }
-      break;
+      c = 0;
+    } else if (c == 'o' || c == 'x') {
+      advance(lexer);
+      int digits = c == 'o' ? 3 : 2;
+      for (int i = 0; i < digits && (is_alpha(lexer->lookahead) ||
+                                     is_digit(lexer->lookahead));
+           i++) {
+        advance(lexer);
+      }
+    } else {
+      return 0;
+    }
+  } else if (c == '\'') {
+    advance(lexer);
+    return 0;
+  } else if (c == '\r' || c == '\n') {
+    advance(lexer);
+    if (c == '\r' && next_is(lexer, '\n')) advance(lexer);
+    c = 0;
+  } else if (c == '\0' && eof(lexer)) {
+    return 0;
+  } else {
+    advance(lexer);
+  }
+
+  if (next_is(lexer, '\'')) {
+    advance(lexer);
+    return 0;
+  }
+  return c;
+}
+
+// Called after `(*`. Consumes the rest of the comment, returning false if it
+// is never closed, with the whole input consumed.
+static bool scan_comment_body(Scanner *scanner, TSLexer *lexer) {
+  uint32_t depth = 1;
+  bool in_identifier = false;
+  for (;;) {
+    int32_t c = lexer->lookahead;
+
+    // Identifiers are skipped whole, because a `'` inside one, as in `x'`,
+    // doesn't start a character literal.
+    if (is_identifier_char(c) && (c != '\'' || in_identifier)) {
+      in_identifier = in_identifier || !is_digit(c);
+      advance(lexer);
+      continue;
+    }
+    in_identifier = false;
+
+    if (c == '\0' && eof(lexer)) return false;
+    advance(lexer);
+
+    while (c != 0) {
+      int32_t pending = 0;
+      switch (c) {
+        case '(':
+          if (next_is(lexer, '*')) {
+            advance(lexer);
+            depth++;
+          }
+          break;
+        case '*':
+          if (next_is(lexer, ')')) {
+            advance(lexer);
+            if (--depth == 0) return true;
+          }
+          break;
+        case '"':
+          if (!scan_comment_string(lexer)) return false;
+          break;
+        case '{':
+          if (!scan_comment_quoted_string(scanner, lexer, &in_identifier)) {
+            return false;
+          }
+          break;
+        case '\'':
+          pending = scan_comment_character(lexer);
+          break;
+        default:
+          in_identifier = is_identifier_start(c);
+          break;
+      }
+      c = pending;
+    }
+  }
+}
+
+// Called at `(`.
+static bool scan_comment(Scanner *scanner, TSLexer *lexer) {
+  advance(lexer);
+  if (!next_is(lexer, '*')) return false;
+  advance(lexer);
+  lexer->result_symbol = COMMENT;
+  // A comment that is never closed takes the rest of the input. Failing
+  // instead would have the lexer try again from every `(*` after it, each
+  // time to the end of the input.
+  if (!scan_comment_body(scanner, lexer)) mark_end(lexer);
+  return true;
+}
+
+static bool scan_token(Scanner *scanner, TSLexer *lexer,
+                       const bool *valid_symbols) {
+  // Every token is valid during error recovery, where scanning the rest of the
+  // line as string content would swallow the code that follows.
+  bool in_recovery = valid_symbols[ERROR_SENTINEL];
+
+  // A parse starts with an empty token that selects the implementation or the
+  // interface compilation unit. Both are only valid at the very start.
+  if (valid_symbols[IMPLEMENTATION_START] && valid_symbols[INTERFACE_START] &&
+      !in_recovery) {
+    lexer->mark_end(lexer);
+    lexer->result_symbol =
+        scanner->interface ? INTERFACE_START : IMPLEMENTATION_START;
+    return true;
+  }
+
+  // Whitespace is content in strings, so they are scanned before it is
+  // skipped.
+  if (valid_symbols[STRING_FRAGMENT] && !in_recovery) {
+    return scan_string_fragment(lexer);
+  }
+
+  if (scanner->depth > 0 && valid_symbols[QUOTED_STRING_FRAGMENT] &&
+      !in_recovery) {
+    return scan_quoted_string_fragment(scanner, lexer, valid_symbols);
+  }
+
+  while (is_space(lexer->lookahead)) {
+    skip(lexer);
+    COUNT(scanner, whitespace_skipped, 1);
+  }
+
+  if (scanner->depth > 0) {
+    if (valid_symbols[RIGHT_QUOTED_STRING_DELIM] && next_is(lexer, '|')) {
+      advance(lexer);
+      lexer->result_symbol = RIGHT_QUOTED_STRING_DELIM;
+      return scan_right_quoted_string_delimiter(scanner, lexer);
+    }
+
+    if (valid_symbols[START_INTERPOLATION] && next_is(lexer, '$')) {
+      advance(lexer);
+      lexer->result_symbol = START_INTERPOLATION;
+      return scan_left_interpolation_delim(scanner, lexer);
+    }
+  }
+
+  if (valid_symbols[LEFT_QUOTED_STRING_DELIM] &&
+      (is_lower(lexer->lookahead) || next_is(lexer, '_') ||
+       next_is(lexer, '|'))) {
+    lexer->result_symbol = LEFT_QUOTED_STRING_DELIM;
+    return parse_left_quoted_string_delimiter(
+        scanner, lexer,
+        in_recovery ? RECOVERY_QUOTED_STRING_ID_MAX : UINT32_MAX);
+  }
+  if (next_is(lexer, '#')) {
+    COUNT(scanner, column_queries, 1);
+    if (lexer->get_column(lexer) == 0) {
+      return try_parse_line_number_directive(scanner, lexer);
+    }
+  }
+
+  // `(*` is content in string and character literals, which are the only
+  // places where `NULL_CHARACTER` is valid.
+  if (valid_symbols[COMMENT] && next_is(lexer, '(') &&
+      (!valid_symbols[NULL_CHARACTER] || in_recovery)) {
+    return scan_comment(scanner, lexer);
+  }
+
+  if (valid_symbols[NULL_CHARACTER] && next_is(lexer, '\0') && !eof(lexer)) {
+    advance(lexer);
+    lexer->result_symbol = NULL_CHARACTER;
+    return true;
   }
 
   return false;
 }
 
+// Entry points
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+
+static bool scan(Scanner *scanner, TSLexer *lexer, const bool *valid_symbols) {
+  bool extras_only = true;
+  for (int i = 0; i < ERROR_SENTINEL; i++) {
+    if (valid_symbols[i] && i != COMMENT && i != LINE_NUMBER_DIRECTIVE) {
+      extras_only = false;
+      break;
+    }
+  }
+  uint64_t start = read_cycles();
+  bool found = scan_token(scanner, lexer, valid_symbols);
+  uint64_t cycles = read_cycles() - start;
+
+  ScannerStats *stats = &scanner_stats[scanner->interface];
+  stats->scan_calls++;
+  if (extras_only) stats->extras_only_calls++;
+  if (found && lexer->result_symbol < SCANNER_STATS_TOKEN_TYPES) {
+    stats->tokens++;
+    stats->token_counts[lexer->result_symbol]++;
+    stats->token_cycles[lexer->result_symbol] += cycles;
+  } else {
+    stats->miss_cycles += cycles;
+  }
+  return found;
+}
+
+static unsigned serialize(Scanner *scanner, char *buffer) {
+  uint64_t start = read_cycles();
+  unsigned length = serialize_state(scanner, buffer);
+  ScannerStats *stats = &scanner_stats[scanner->interface];
+  stats->serialize_cycles += read_cycles() - start;
+  stats->serializations++;
+  stats->serialized_bytes += length;
+  return length;
+}
+
+static void deserialize(Scanner *scanner, const char *buffer,
+                        unsigned length) {
+  uint64_t start = read_cycles();
+  deserialize_state(scanner, buffer, length);
+  ScannerStats *stats = &scanner_stats[scanner->interface];
+  stats->deserialize_cycles += read_cycles() - start;
+  stats->deserializations++;
+  stats->deserialized_bytes += length;
+}
+
+#else
+
+static inline bool scan(Scanner *scanner, TSLexer *lexer,
+                        const bool *valid_symbols) {
+  return scan_token(scanner, lexer, valid_symbols);
+}
+
+static inline unsigned serialize(Scanner *scanner, char *buffer) {
+  return serialize_state(scanner, buffer);
+}
+
+static inline void deserialize(Scanner *scanner, const char *buffer,
+                               unsigned length) {
+  deserialize_state(scanner, buffer, length);
+}
+
+#endif
+
 #endif  // TREE_SITTER_OCAML_SCANNER_H_
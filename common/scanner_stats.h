@@ -0,0 +1,48 @@
+#ifndef TREE_SITTER_OCAML_SCANNER_STATS_H_
+#define TREE_SITTER_OCAML_SCANNER_STATS_H_
+
+// Counters kept by the external scanner when it is built with
+// TREE_SITTER_OCAML_SCANNER_STATS defined.
+//
+// The scanner counts on every thread separately, and separately for
+// implementations and interfaces. The counters of the calling thread are
+// copied out and reset by
+//
+//   void tree_sitter_ocaml_external_scanner_stats(ScannerStats *stats);
+//   void tree_sitter_ocaml_interface_external_scanner_stats(ScannerStats *stats);
+//
+// The timers count CPU cycles on x86, timer ticks on ARM64 and nothing
+// elsewhere.
+
+#include <stdint.h>
+
+// The number of external tokens, including the error sentinel. Tokens are
+// indexed as in the `externals` of the grammar.
+#define SCANNER_STATS_TOKEN_TYPES 11
+
+typedef struct {
+  // Calls to the scanner, and the calls that returned a token.
+  uint64_t scan_calls;
+  uint64_t tokens;
+  // Calls where only the comments and line number directives, which are valid
+  // almost everywhere, were valid.
+  uint64_t extras_only_calls;
+  // Whitespace characters skipped before a token.
+  uint64_t whitespace_skipped;
+  // Calls to `get_column`, to check that `#` starts a line.
+  uint64_t column_queries;
+  uint64_t serializations;
+  uint64_t serialized_bytes;
+  uint64_t deserializations;
+  uint64_t deserialized_bytes;
+  uint64_t serialize_cycles;
+  uint64_t deserialize_cycles;
+  // Time spent in calls that returned no token.
+  uint64_t miss_cycles;
+  // The tokens returned of each type, and the time spent in the calls that
+  // returned them.
+  uint64_t token_counts[SCANNER_STATS_TOKEN_TYPES];
+  uint64_t token_cycles[SCANNER_STATS_TOKEN_TYPES];
+} ScannerStats;
+
+#endif  // TREE_SITTER_OCAML_SCANNER_STATS_H_
@@ -0,0 +1,2 @@
+// Generated by script/generate-interface.
+#include "../../ocaml/src/parser.c"
@@ -85,9 +85,11 @@ module.exports = grammar({
   ],
 
   rules: {
-    compilation_unit: $ => seq(
-      optional($.shebang),
-      optional($._structure)
+    // Interfaces share this grammar, the scanner starts them with
+    // _interface_start instead of _implementation_start.
+    compilation_unit: $ => choice(
+      seq($._implementation_start, optional($.shebang), optional($._structure)),
+      seq($._interface_start, optional($._signature))
     ),
 
     shebang: $ => /#!.*/,
@@ -104,31 +106,6 @@ module.exports = grammar({
         repeat(';;')
       )
     ),
-    _comment_content: $ =>
-      repeat1(
-        choice(
-          token.immediate(prec(1, /'[\"\{\[]'/)),
-          alias($._string, "anon"),
-          alias($.quoted_string, "anon"),
-          //grabs things that could be confused for quoted strings
-          prec(2, /\{[^a-z\|]/),
-          alias($.quoted_extension, "anon"),
-          //to make this more efficent we grab big chunks till we hit any of the chars that might start one of the other possibilities
-          token(/[^{('"*]+|[^*]/),
-          //This is still needed because if all the other features aren't present we still need to be able to parse over a {('" 
-          //,
-          /\*[^)]/
-
-        )
-      ),
-    //TODO use the string and string quote parsers to parse the unwanted tokens out 
-    comment: $ => seq(
-      '(*',
-      optional($._comment_content),
-      '*)'
-
-    ),
-
 
     expression_item: $ => seq(
       $._sequence_expression,
@@ -1742,15 +1719,9 @@ module.exports = grammar({
     ),
 
     string: $ => seq('"', optional($.string_content), token.immediate('"')),
-    _string_content: $ => alias($.string_content, "content"),
-    _string: $ => seq('"', optional($._string_content), token.immediate('"')),
 
     string_content: $ => repeat1(choice(
-      token.immediate(/\s/),
-      token.immediate(/\[@/),
-      token.immediate(prec(1, /[^\\"%@]+/)),
-
-      /%|@/, $._null,
+      $._string_fragment,
       prec(2, $.escape_sequence),
       prec(2, alias(/\\u\{[0-9A-Fa-f]+\}/, $.escape_sequence)),
       prec(2, alias(/\\\n[\t ]*/, $.escape_sequence)),
@@ -1767,14 +1738,9 @@ module.exports = grammar({
 
 
     quoted_string_content: $ => repeat1(choice(
-      token.immediate(/\s/),
-      token.immediate(/\[@/),
-      //TODO i think this is what is now stopping my string interpolation from ever running
-      token.immediate(prec(1, /[^%@$|]+/)),
+      $._quoted_string_fragment,
       prec(4, $.string_interpolation_escape),
       prec(2, $.string_interpolation),
-      /%|@|\$|\|/,
-      $._null,
       prec(2, $.conversion_specification),
       prec(2, $.pretty_printing_indication),
     )),
@@ -1977,7 +1943,13 @@ module.exports = grammar({
     $._right_quoted_string_delim,
     $._start_interpolation,
     $.line_number_directive,
-    $._null
+    $._null,
+    $.comment,
+    $._string_fragment,
+    $._quoted_string_fragment,
+    $._implementation_start,
+    $._interface_start,
+    $._error_sentinel
   ]
 })
 
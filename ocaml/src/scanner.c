@@ -1,6 +1,6 @@
 #include "../../common/scanner.h"
 
-void *tree_sitter_ocaml_external_scanner_create() { return create(); }
+void *tree_sitter_ocaml_external_scanner_create() { return create(false); }
 
 void tree_sitter_ocaml_external_scanner_destroy(void *payload) {
   Scanner *scanner = (Scanner *)payload;
@@ -25,3 +25,67 @@ bool tree_sitter_ocaml_external_scanner_scan(void *payload, TSLexer *lexer,
   Scanner *scanner = (Scanner *)payload;
   return scan(scanner, lexer, valid_symbols);
 }
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+void tree_sitter_ocaml_external_scanner_stats(ScannerStats *stats) {
+  take_scanner_stats(stats, false);
+}
+#endif
+
+// The interface language
+//
+// Interfaces are parsed with the tables of the OCaml grammar, whose
+// compilation unit is either a structure or a signature. The interface
+// language is a copy of the OCaml language whose scanner starts signatures.
+
+const TSLanguage *tree_sitter_ocaml(void);
+
+void *tree_sitter_ocaml_interface_external_scanner_create() {
+  return create(true);
+}
+
+#ifdef TREE_SITTER_OCAML_SCANNER_STATS
+void tree_sitter_ocaml_interface_external_scanner_stats(ScannerStats *stats) {
+  take_scanner_stats(stats, true);
+}
+#endif
+
+static TSLanguage interface_language;
+
+static void init_interface_language(void) {
+  interface_language = *tree_sitter_ocaml();
+  interface_language.external_scanner.create =
+      tree_sitter_ocaml_interface_external_scanner_create;
+}
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+static INIT_ONCE interface_language_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK init_interface_language_once(PINIT_ONCE once,
+                                                  PVOID parameter,
+                                                  PVOID *context) {
+  init_interface_language();
+  return TRUE;
+}
+
+const TSLanguage *tree_sitter_ocaml_interface(void) {
+  InitOnceExecuteOnce(&interface_language_once, init_interface_language_once,
+                      NULL, NULL);
+  return &interface_language;
+}
+
+#else
+
+#include <pthread.h>
+
+static pthread_once_t interface_language_once = PTHREAD_ONCE_INIT;
+
+const TSLanguage *tree_sitter_ocaml_interface(void) {
+  pthread_once(&interface_language_once, init_interface_language);
+  return &interface_language;
+}
+
+#endif
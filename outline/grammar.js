@@ -0,0 +1,71 @@
+// The outline grammar parses the items of OCaml implementations but not the
+// bodies of their bindings, methods, instance variables and initializers,
+// which the scanner consumes as a single `skimmed_expression` token, see
+// outline/src/scanner.c. It is for tools like indexers that only need the
+// structure of a file. Items have the same node types as in the OCaml grammar,
+// so the definitions of tags.scm are found as usual, but not the references
+// inside the bodies.
+
+const ocaml = require('../ocaml/grammar')
+
+module.exports = grammar(ocaml, {
+  name: 'ocaml_outline',
+
+  externals: ($, original) => original.concat([
+    $.skimmed_expression
+  ]),
+
+  rules: {
+    let_binding: $ => prec.right(seq(
+      field('pattern', $._binding_pattern),
+      optional(seq(
+        repeat($._parameter),
+        optional($._polymorphic_typed),
+        optional(seq(':>', $._type)),
+        '=',
+        field('body', $._skimmed_body),
+      )),
+      repeat($.item_attribute)
+    )),
+
+    instance_variable_definition: $ => seq(
+      'val',
+      optional('!'),
+      repeat(choice('mutable', 'virtual')),
+      field('name', $._instance_variable_name),
+      optional($._typed),
+      optional(seq(':>', $._type)),
+      optional(seq('=', field('body', $._skimmed_body))),
+      repeat($.item_attribute)
+    ),
+
+    method_definition: $ => seq(
+      'method',
+      optional('!'),
+      repeat(choice('private', 'virtual')),
+      field('name', $._method_name),
+      repeat($._parameter),
+      optional($._polymorphic_typed),
+      optional(seq('=', field('body', $._skimmed_body))),
+      repeat($.item_attribute)
+    ),
+
+    class_initializer: $ => seq(
+      'initializer',
+      $.skimmed_expression,
+      repeat($.item_attribute)
+    ),
+
+    // The scanner leaves a leading `fun` or `function` to the grammar, so that
+    // tags.scm can tell function definitions.
+    _skimmed_body: $ => choice(
+      $.skimmed_expression,
+      alias($._skimmed_fun_expression, $.fun_expression),
+      alias($._skimmed_function_expression, $.function_expression)
+    ),
+
+    _skimmed_fun_expression: $ => seq('fun', $.skimmed_expression),
+
+    _skimmed_function_expression: $ => seq('function', $.skimmed_expression)
+  }
+})
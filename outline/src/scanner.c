@@ -0,0 +1,349 @@
+// The scanner stats only cover the OCaml and interface grammars.
+#undef TREE_SITTER_OCAML_SCANNER_STATS
+#include "../../common/scanner.h"
+
+// The outline grammar adds one external token to those of the OCaml grammar,
+// see outline/grammar.js.
+enum { SKIMMED_EXPRESSION = ERROR_SENTINEL + 1 };
+
+// Skimming
+//
+// The bodies of bindings, methods and instance variables are consumed as a
+// single token, without being parsed. The skimmer only follows the nesting of
+// brackets, `begin`, `struct`, `sig`, `object` and `do` with their `end` or
+// `done`, and of `let` with `in`, and skips over comments and literals. At the
+// outermost level, the body ends before
+//
+// - a closing bracket, `end` or `done` it didn't open, `;;`, or an item
+//   attribute or extension,
+// - `and` or `in` that don't belong to a `let` of the body,
+// - a keyword that only starts a structure item, a class field or a signature
+//   item, like `type` or `method`,
+// - `let`, `module`, `open` or `exception` after an operand, where they can't
+//   be part of an expression. After `let` or an operator they are.
+//
+// The token ends after the last operand, keyword or operator of the body, so
+// that the comments after it are left to the grammar as usual, as is a
+// comment before it.
+
+typedef enum {
+  WORD_IDENTIFIER,
+  // Keywords that can't end an expression.
+  WORD_KEYWORD,
+  WORD_AND,
+  WORD_IN,
+  WORD_LET,
+  // Keywords that start an expression as well as an item.
+  WORD_AMBIGUOUS_ITEM,
+  // Keywords that only start an item.
+  WORD_ITEM,
+  WORD_OPEN,
+  WORD_CLOSE,
+  WORD_FUN,
+} WordKind;
+
+typedef struct {
+  const char *word;
+  WordKind kind;
+} Keyword;
+
+// Sorted by `strcmp`, for the binary search of `scan_word`.
+static const Keyword keywords[] = {
+    {"and", WORD_AND},
+    {"as", WORD_KEYWORD},
+    {"asr", WORD_KEYWORD},
+    {"assert", WORD_KEYWORD},
+    {"begin", WORD_OPEN},
+    {"class", WORD_ITEM},
+    {"constraint", WORD_ITEM},
+    {"do", WORD_OPEN},
+    {"done", WORD_CLOSE},
+    {"downto", WORD_KEYWORD},
+    {"else", WORD_KEYWORD},
+    {"end", WORD_CLOSE},
+    {"exception", WORD_AMBIGUOUS_ITEM},
+    {"external", WORD_ITEM},
+    {"for", WORD_KEYWORD},
+    {"fun", WORD_FUN},
+    {"function", WORD_FUN},
+    {"functor", WORD_KEYWORD},
+    {"if", WORD_KEYWORD},
+    {"in", WORD_IN},
+    {"include", WORD_ITEM},
+    {"inherit", WORD_ITEM},
+    {"initializer", WORD_ITEM},
+    {"land", WORD_KEYWORD},
+    {"lazy", WORD_KEYWORD},
+    {"let", WORD_LET},
+    {"lor", WORD_KEYWORD},
+    {"lsl", WORD_KEYWORD},
+    {"lsr", WORD_KEYWORD},
+    {"lxor", WORD_KEYWORD},
+    {"match", WORD_KEYWORD},
+    {"method", WORD_ITEM},
+    {"mod", WORD_KEYWORD},
+    {"module", WORD_AMBIGUOUS_ITEM},
+    {"mutable", WORD_KEYWORD},
+    {"new", WORD_KEYWORD},
+    {"nonrec", WORD_KEYWORD},
+    {"object", WORD_OPEN},
+    {"of", WORD_KEYWORD},
+    {"open", WORD_AMBIGUOUS_ITEM},
+    {"or", WORD_KEYWORD},
+    {"private", WORD_KEYWORD},
+    {"rec", WORD_KEYWORD},
+    {"sig", WORD_OPEN},
+    {"struct", WORD_OPEN},
+    {"then", WORD_KEYWORD},
+    {"to", WORD_KEYWORD},
+    {"try", WORD_KEYWORD},
+    {"type", WORD_ITEM},
+    {"val", WORD_ITEM},
+    {"virtual", WORD_KEYWORD},
+    {"when", WORD_KEYWORD},
+    {"while", WORD_KEYWORD},
+    {"with", WORD_KEYWORD},
+};
+
+// The longest keyword, `initializer`, and one more character to tell it from
+// longer identifiers.
+#define MAX_KEYWORD_LENGTH 12
+
+// Called at an identifier character. Consumes the word.
+static WordKind scan_word(TSLexer *lexer) {
+  char word[MAX_KEYWORD_LENGTH + 1];
+  unsigned length = 0;
+  while (is_identifier_char(lexer->lookahead)) {
+    if (length < MAX_KEYWORD_LENGTH) word[length] = (char)lexer->lookahead;
+    length++;
+    advance(lexer);
+  }
+  if (length > MAX_KEYWORD_LENGTH) return WORD_IDENTIFIER;
+  word[length] = '\0';
+
+  unsigned low = 0, high = sizeof(keywords) / sizeof(keywords[0]);
+  while (low < high) {
+    unsigned middle = (low + high) / 2;
+    int order = strcmp(word, keywords[middle].word);
+    if (order == 0) return keywords[middle].kind;
+    if (order < 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return WORD_IDENTIFIER;
+}
+
+// Called after `{`. Consumes a quoted string and returns true, or consumes the
+// identifier after the brace, if any, and returns false.
+static bool skim_quoted_string(Scanner *scanner, TSLexer *lexer,
+                               bool *identifier) {
+  if (next_is(lexer, '%')) {
+    // The extension of `{%ext|...|}`.
+    advance(lexer);
+    if (next_is(lexer, '%')) advance(lexer);
+    while (is_identifier_char(lexer->lookahead) || next_is(lexer, '.')) {
+      advance(lexer);
+    }
+    while (next_is(lexer, ' ') || next_is(lexer, '\t')) advance(lexer);
+  }
+
+  uint32_t start = quoted_string_id_start(scanner);
+  while (is_lower(lexer->lookahead) || next_is(lexer, '_')) {
+    quoted_string_id_push(scanner, lexer->lookahead);
+    advance(lexer);
+  }
+  *identifier = scanner->size > start + sizeof(uint32_t);
+  if (!next_is(lexer, '|')) {
+    scanner->size = start;
+    return false;
+  }
+  advance(lexer);
+
+  const char *id = scanner->frames + start + sizeof(uint32_t);
+  uint32_t id_length = scanner->size - start - sizeof(uint32_t);
+  for (;;) {
+    if (next_is(lexer, '|')) {
+      advance(lexer);
+      uint32_t i = 0;
+      while (i < id_length && lexer->lookahead == id[i]) {
+        advance(lexer);
+        i++;
+      }
+      if (i == id_length && next_is(lexer, '}')) {
+        advance(lexer);
+        break;
+      }
+    } else if (next_is(lexer, '\0') && eof(lexer)) {
+      break;
+    } else {
+      advance(lexer);
+    }
+  }
+  scanner->size = start;
+  return true;
+}
+
+static bool scan_skimmed_expression(Scanner *scanner, TSLexer *lexer) {
+  lexer->result_symbol = SKIMMED_EXPRESSION;
+  // Brackets and keyword pairs.
+  uint32_t depth = 0;
+  // Outermost `let`s waiting for their `in`.
+  uint32_t lets = 0;
+  bool after_operand = false;
+  bool empty = true;
+
+  for (;;) {
+    int32_t c = lexer->lookahead;
+    bool operand = false;
+
+    if (is_space(c)) {
+      advance(lexer);
+      continue;
+    }
+    if (c == '\0' && eof(lexer)) break;
+
+    if (is_identifier_char(c) && c != '\'') {
+      switch (scan_word(lexer)) {
+        case WORD_IDENTIFIER:
+          operand = true;
+          break;
+        case WORD_KEYWORD:
+          break;
+        case WORD_AND:
+          if (depth == 0 && lets == 0) return !empty;
+          break;
+        case WORD_IN:
+          if (depth == 0) {
+            if (lets == 0) return !empty;
+            lets--;
+          }
+          break;
+        case WORD_LET:
+          if (depth == 0) {
+            if (after_operand) return !empty;
+            lets++;
+          }
+          break;
+        case WORD_AMBIGUOUS_ITEM:
+          if (depth == 0 && after_operand) return !empty;
+          break;
+        case WORD_ITEM:
+          if (depth == 0) return !empty;
+          break;
+        case WORD_OPEN:
+          depth++;
+          break;
+        case WORD_CLOSE:
+          if (depth == 0) return !empty;
+          depth--;
+          operand = true;
+          break;
+        case WORD_FUN:
+          // The grammar takes a leading `fun` or `function` itself, so that
+          // the body is still a `fun_expression` or a `function_expression`.
+          if (empty) return false;
+          break;
+      }
+    } else {
+      advance(lexer);
+      switch (c) {
+        case '(':
+          if (next_is(lexer, '*')) {
+            advance(lexer);
+            if (empty) {
+              // A comment before the body is left to the grammar, as one
+              // after it.
+              lexer->result_symbol = COMMENT;
+              // One that is never closed takes the rest of the input, as
+              // in `scan_comment`.
+              scan_comment_body(scanner, lexer);
+              mark_end(lexer);
+              return true;
+            }
+            if (!scan_comment_body(scanner, lexer)) return !empty;
+            // Comments don't move the end of the token.
+            continue;
+          }
+          depth++;
+          break;
+        case '[':
+          if (depth == 0 && next_is(lexer, '@')) {
+            advance(lexer);
+            if (next_is(lexer, '@')) return !empty;
+          } else if (depth == 0 && next_is(lexer, '%')) {
+            advance(lexer);
+            if (next_is(lexer, '%')) return !empty;
+          }
+          depth++;
+          break;
+        case '{':
+          if (!skim_quoted_string(scanner, lexer, &operand)) depth++;
+          else operand = true;
+          break;
+        case ')':
+        case ']':
+        case '}':
+          if (depth == 0) return !empty;
+          depth--;
+          operand = true;
+          break;
+        case ';':
+          if (depth == 0 && next_is(lexer, ';')) return !empty;
+          break;
+        case '"':
+          scan_comment_string(lexer);
+          operand = true;
+          break;
+        case '\'':
+          // A character literal, or the quote of a type variable.
+          scan_comment_character(lexer);
+          while (is_identifier_char(lexer->lookahead)) advance(lexer);
+          operand = true;
+          break;
+      }
+    }
+
+    after_operand = operand;
+    empty = false;
+    mark_end(lexer);
+  }
+  return !empty;
+}
+
+// Entry points
+
+void *tree_sitter_ocaml_outline_external_scanner_create() {
+  for (size_t i = 1; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    assert(strcmp(keywords[i - 1].word, keywords[i].word) < 0);
+  }
+  return create(false);
+}
+
+void tree_sitter_ocaml_outline_external_scanner_destroy(void *payload) {
+  Scanner *scanner = (Scanner *)payload;
+  destroy(scanner);
+}
+
+unsigned tree_sitter_ocaml_outline_external_scanner_serialize(void *payload,
+                                                              char *buffer) {
+  Scanner *scanner = (Scanner *)payload;
+  return serialize(scanner, buffer);
+}
+
+void tree_sitter_ocaml_outline_external_scanner_deserialize(
+    void *payload, const char *buffer, unsigned length) {
+  Scanner *scanner = (Scanner *)payload;
+  deserialize(scanner, buffer, length);
+}
+
+bool tree_sitter_ocaml_outline_external_scanner_scan(
+    void *payload, TSLexer *lexer, const bool *valid_symbols) {
+  Scanner *scanner = (Scanner *)payload;
+  if (valid_symbols[SKIMMED_EXPRESSION] && !valid_symbols[ERROR_SENTINEL]) {
+    while (is_space(lexer->lookahead)) skip(lexer);
+    return scan_skimmed_expression(scanner, lexer);
+  }
+  return scan(scanner, lexer, valid_symbols);
+}
@@ -14,3 +14,17 @@
 ; we set the priority low so our interpolation can shine through
 (#set! "priority" 95)
 )
+
+(
+  [
+    (quoted_extension
+      (attribute_id) @ppx_name
+      (quoted_string_content) @injection.content)
+    (quoted_item_extension
+      (attribute_id) @ppx_name
+      (quoted_string_content) @injection.content)
+  ]
+  (#eq? @ppx_name "html")
+  (#set! injection.language "html")
+  (#set! "priority" 95)
+)
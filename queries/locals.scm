@@ -18,6 +18,27 @@
 
 (value_pattern) @local.definition
 
+(let_binding pattern: (value_name) @local.definition)
+
+[
+  (alias_pattern (value_name) @local.definition)
+  (array_pattern (value_name) @local.definition)
+  (cons_pattern (value_name) @local.definition)
+  (constructor_pattern (value_name) @local.definition)
+  (field_pattern (value_name) @local.definition)
+  (lazy_pattern (value_name) @local.definition)
+  (list_pattern (value_name) @local.definition)
+  (local_open_pattern (value_name) @local.definition)
+  (or_pattern (value_name) @local.definition)
+  (parenthesized_pattern (value_name) @local.definition)
+  (tag_pattern (value_name) @local.definition)
+  (tuple_pattern (value_name) @local.definition)
+  (typed_pattern (value_name) @local.definition)
+]
+
+; A punned field, like `x` in `{ x; _ }`.
+(field_pattern . (field_path (field_name) @local.definition) .)
+
 ; References
 ;-----------
 
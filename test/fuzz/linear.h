@@ -0,0 +1,95 @@
+#ifndef TREE_SITTER_OCAML_FUZZ_LINEAR_H_
+#define TREE_SITTER_OCAML_FUZZ_LINEAR_H_
+
+// Checks that the work done on an input grows linearly with its length.
+//
+// The input is repeated until it is at least `base` bytes long, and then
+// eight times as long again. The work per byte, whatever the harness counts,
+// should stay the same between the two; a quadratic input does eight times as
+// much. An input is reported as superlinear when the work per byte grows by
+// more than LINEAR_MAX_GROWTH.
+//
+// Repeating whole copies of the input doesn't make any construct in it longer,
+// so work that is quadratic in the length of a single token grows by the same
+// factor as the copies and goes unnoticed. Harnesses whose work doesn't depend
+// on the machine also give a fixed bound on the work per byte, which such an
+// input exceeds once the token is long enough.
+//
+// Reported inputs abort, so that the fuzzer keeps them as crashes. With
+// FUZZ_VERBOSE set, the result for every input is printed to stderr.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINEAR_SCALE 8
+#define LINEAR_MAX_GROWTH 4.0
+
+typedef double (*LinearWork)(const char *input, uint32_t length);
+
+typedef struct {
+  uint32_t small_length;
+  uint32_t large_length;
+  double small_per_byte;
+  double large_per_byte;
+  double growth;
+} LinearResult;
+
+// Returns `data` repeated until it is at least `length` bytes long, in a
+// buffer that the caller frees.
+static char *repeat_input(const uint8_t *data, size_t size, uint32_t length,
+                          uint32_t *result_length) {
+  uint32_t count = (uint32_t)((length + size - 1) / size);
+  uint32_t total = (uint32_t)(count * size);
+  char *input = malloc(total ? total : 1);
+  if (input == NULL) abort();
+  for (uint32_t i = 0; i < count; i++) memcpy(input + i * size, data, size);
+  *result_length = total;
+  return input;
+}
+
+static LinearResult measure_linearity(const uint8_t *data, size_t size,
+                                      uint32_t base, LinearWork work) {
+  LinearResult result = {0};
+  if (size == 0) return result;
+
+  char *small = repeat_input(data, size, base, &result.small_length);
+  char *large = repeat_input(data, size, base * LINEAR_SCALE,
+                             &result.large_length);
+  result.small_per_byte = work(small, result.small_length) /
+                          result.small_length;
+  result.large_per_byte = work(large, result.large_length) /
+                          result.large_length;
+  result.growth = result.small_per_byte > 0
+                      ? result.large_per_byte / result.small_per_byte
+                      : 1.0;
+  free(small);
+  free(large);
+  return result;
+}
+
+// Measures the input and reports it if it is superlinear. `what` names the
+// harness and `unit` what the work is counted in. `max_per_byte` bounds the
+// work per byte, or is 0 for no bound.
+static void check_linearity(const char *what, const char *unit,
+                            const uint8_t *data, size_t size, uint32_t base,
+                            double max_per_byte, LinearWork work) {
+  LinearResult result = measure_linearity(data, size, base, work);
+  bool superlinear =
+      result.growth > LINEAR_MAX_GROWTH ||
+      (max_per_byte > 0 && (result.small_per_byte > max_per_byte ||
+                            result.large_per_byte > max_per_byte));
+  if (getenv("FUZZ_VERBOSE") || superlinear) {
+    fprintf(stderr,
+            "%s: %u bytes: %.2f %s/byte, %u bytes: %.2f %s/byte, growth "
+            "%.2f%s\n",
+            what, result.small_length, result.small_per_byte, unit,
+            result.large_length, result.large_per_byte, unit, result.growth,
+            superlinear ? " (superlinear)" : "");
+  }
+  if (superlinear) abort();
+}
+
+#endif  // TREE_SITTER_OCAML_FUZZ_LINEAR_H_
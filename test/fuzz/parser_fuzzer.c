@@ -0,0 +1,73 @@
+// Fuzz target for the parser, with both languages.
+//
+// Besides what the sanitizers catch, the target checks that the tree covers no
+// more than the input and that the parse time grows linearly with the input,
+// see linear.h. The time is the best of a few parses, to keep the check from
+// tripping over noise.
+//
+// Built with -fsanitize=fuzzer by `script/fuzz parser`, or with standalone.c
+// to replay inputs. Either way it needs the tree-sitter runtime.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <assert.h>
+#include <time.h>
+#include <tree_sitter/api.h>
+
+#include "linear.h"
+
+const TSLanguage *tree_sitter_ocaml(void);
+const TSLanguage *tree_sitter_ocaml_interface(void);
+
+// The shortest input the linearity check repeats the fuzzer input to. Parses
+// of a few kilobytes take long enough to be timed.
+#define PARSER_LINEAR_BASE 4096
+#define PARSER_LINEAR_RUNS 3
+
+static TSParser *parsers[2];
+
+static TSParser *parser_for(int interface) {
+  if (parsers[interface] == NULL) {
+    parsers[interface] = ts_parser_new();
+    ts_parser_set_language(parsers[interface],
+                           interface ? tree_sitter_ocaml_interface()
+                                     : tree_sitter_ocaml());
+  }
+  return parsers[interface];
+}
+
+static void parse(int interface, const char *input, uint32_t length) {
+  TSTree *tree = ts_parser_parse_string(parser_for(interface), NULL, input,
+                                        length);
+  assert(tree != NULL);
+  TSNode root = ts_tree_root_node(tree);
+  assert(ts_node_end_byte(root) <= length);
+  ts_tree_delete(tree);
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static double parser_work(const char *input, uint32_t length) {
+  double best = 0;
+  for (int i = 0; i < PARSER_LINEAR_RUNS; i++) {
+    double start = now();
+    parse(0, input, length);
+    parse(1, input, length);
+    double elapsed = now() - start;
+    if (i == 0 || elapsed < best) best = elapsed;
+  }
+  return best;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size > UINT32_MAX / (LINEAR_SCALE * 2)) return 0;
+  parse(0, (const char *)data, (uint32_t)size);
+  parse(1, (const char *)data, (uint32_t)size);
+  check_linearity("parser", "ns", data, size, PARSER_LINEAR_BASE, 0,
+                  parser_work);
+  return 0;
+}
@@ -0,0 +1,212 @@
+// Fuzz target for the external scanner in `common/scanner.h`.
+//
+// The scanner is driven through a mock lexer the way the parser drives it: it
+// is asked for a token at every position, with the state deserialized before
+// every call and serialized after every token. The target checks that
+//
+// - tokens end within the input,
+// - the state fits into the serialization buffer and survives a round trip,
+// - the quoted strings whose ids a truncated state dropped aren't closed,
+// - any bytes can be deserialized as a state,
+// - the characters the scanner reads grow linearly with the input, see
+//   linear.h, and stay under SCANNER_MAX_CHARS_PER_BYTE.
+//
+// Built with -fsanitize=fuzzer by `script/fuzz scanner`, or with standalone.c
+// to replay inputs.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scanner.h"
+#include "linear.h"
+
+// The shortest input the linearity check repeats the fuzzer input to.
+#define SCANNER_LINEAR_BASE 1024
+// The most characters the scanner may read per byte of input, over the normal
+// and the recovery run. A character is read about once by each run, and a
+// quoted string id at most RECOVERY_QUOTED_STRING_ID_MAX times in recovery.
+#define SCANNER_MAX_CHARS_PER_BYTE 32
+
+typedef struct {
+  TSLexer lexer;
+  const char *input;
+  uint32_t length;
+  uint32_t position;
+  uint32_t token_end;
+  bool marked;
+  uint32_t column;
+  uint64_t advances;
+} MockLexer;
+
+static void mock_advance(TSLexer *lexer, bool skip) {
+  MockLexer *mock = (MockLexer *)lexer;
+  mock->advances++;
+  if (mock->position >= mock->length) return;
+  if (mock->input[mock->position] == '\n') {
+    mock->column = 0;
+  } else {
+    mock->column++;
+  }
+  mock->position++;
+  lexer->lookahead =
+      mock->position < mock->length ? (uint8_t)mock->input[mock->position] : 0;
+}
+
+static void mock_mark_end(TSLexer *lexer) {
+  MockLexer *mock = (MockLexer *)lexer;
+  mock->token_end = mock->position;
+  mock->marked = true;
+}
+
+static uint32_t mock_get_column(TSLexer *lexer) {
+  return ((MockLexer *)lexer)->column;
+}
+
+static bool mock_is_at_included_range_start(const TSLexer *lexer) {
+  (void)lexer;
+  return false;
+}
+
+static bool mock_eof(const TSLexer *lexer) {
+  const MockLexer *mock = (const MockLexer *)lexer;
+  return mock->position >= mock->length;
+}
+
+static void mock_reset(MockLexer *mock, uint32_t position, uint32_t column) {
+  mock->position = position;
+  mock->token_end = position;
+  mock->marked = false;
+  mock->column = column;
+  mock->lexer.lookahead =
+      position < mock->length ? (uint8_t)mock->input[position] : 0;
+}
+
+// Serializes the scanner, and checks that deserializing the state into a
+// fresh scanner gives it back. A truncated state comes back with the frames it
+// dropped lost, which are left out again.
+static unsigned serialize_checked(Scanner *scanner, char *state) {
+  unsigned length = serialize(scanner, state);
+  assert(length <= TREE_SITTER_SERIALIZATION_BUFFER_SIZE);
+
+  char again[TREE_SITTER_SERIALIZATION_BUFFER_SIZE];
+  Scanner *copy = create(scanner->interface);
+  deserialize(copy, state, length);
+  assert(copy->depth == scanner->depth);
+  assert(copy->lost >= scanner->lost);
+  unsigned again_length = serialize(copy, again);
+  assert(again_length == length && memcmp(again, state, length) == 0);
+  destroy(copy);
+  return length;
+}
+
+// Runs the scanner over the input and returns the number of characters it
+// read. In recovery every token is valid.
+static uint64_t run(const char *input, uint32_t length, bool interface,
+                    bool recovery) {
+  MockLexer mock = {
+      .lexer =
+          {
+              .advance = mock_advance,
+              .mark_end = mock_mark_end,
+              .get_column = mock_get_column,
+              .is_at_included_range_start = mock_is_at_included_range_start,
+              .eof = mock_eof,
+          },
+      .input = input,
+      .length = length,
+  };
+  Scanner *scanner = create(interface);
+  char state[TREE_SITTER_SERIALIZATION_BUFFER_SIZE];
+  unsigned state_length = 0;
+  bool valid_symbols[ERROR_SENTINEL + 1] = {false};
+
+  uint32_t position = 0;
+  uint32_t line_start = 0;
+  bool in_string = false;
+  while (position <= length) {
+    deserialize(scanner, state, state_length);
+    bool in_quoted_string = scanner->depth > 0;
+    if (recovery) {
+      memset(valid_symbols, true, sizeof(valid_symbols));
+    } else {
+      valid_symbols[IMPLEMENTATION_START] = position == 0;
+      valid_symbols[INTERFACE_START] = position == 0;
+      valid_symbols[LEFT_QUOTED_STRING_DELIM] =
+          position > 0 && input[position - 1] == '{';
+      valid_symbols[RIGHT_QUOTED_STRING_DELIM] = in_quoted_string;
+      valid_symbols[START_INTERPOLATION] = in_quoted_string;
+      valid_symbols[LINE_NUMBER_DIRECTIVE] = true;
+      valid_symbols[NULL_CHARACTER] = in_quoted_string;
+      valid_symbols[COMMENT] = true;
+      valid_symbols[STRING_FRAGMENT] = in_string && !in_quoted_string;
+      valid_symbols[QUOTED_STRING_FRAGMENT] = in_quoted_string;
+    }
+
+    mock_reset(&mock, position, position - line_start);
+    uint32_t next = position + 1;
+    bool token = false;
+    uint32_t known_depth = scanner->depth - scanner->lost;
+    if (scan(scanner, &mock.lexer, valid_symbols)) {
+      // Only frames with a known id are closed.
+      assert(mock.lexer.result_symbol != RIGHT_QUOTED_STRING_DELIM ||
+             known_depth > 0);
+      uint32_t token_end = mock.marked ? mock.token_end : mock.position;
+      assert(token_end <= length);
+      if (token_end > position) {
+        next = token_end;
+        token = true;
+      }
+      state_length = serialize_checked(scanner, state);
+    }
+    // A character without a token is left to the grammar. Follow the strings
+    // it opens and closes, skipping their escape sequences, to know when the
+    // string fragments are valid.
+    if (!token && position < length && !in_quoted_string) {
+      if (input[position] == '"') {
+        in_string = !in_string;
+      } else if (in_string && input[position] == '\\' && next < length) {
+        next++;
+      }
+    }
+    for (uint32_t i = position; i < next && i < length; i++) {
+      if (input[i] == '\n') line_start = i + 1;
+    }
+    position = next;
+  }
+  destroy(scanner);
+  return mock.advances;
+}
+
+static double scanner_work(const char *input, uint32_t length) {
+  return (double)(run(input, length, false, false) +
+                  run(input, length, false, true));
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // Deserialize the input as a state. A scanner only ever gets back what it
+  // serialized, so skip depths that no input of this size could reach, whose
+  // empty frames would only exhaust the memory.
+  unsigned state_length = size < TREE_SITTER_SERIALIZATION_BUFFER_SIZE
+                              ? (unsigned)size
+                              : TREE_SITTER_SERIALIZATION_BUFFER_SIZE;
+  uint32_t header;
+  if (read_varint((const char *)data, state_length, &header) &&
+      (header >> 1) <= size) {
+    Scanner *scanner = create(false);
+    deserialize(scanner, (const char *)data, state_length);
+    char state[TREE_SITTER_SERIALIZATION_BUFFER_SIZE];
+    serialize_checked(scanner, state);
+    destroy(scanner);
+  }
+
+  if (size > UINT32_MAX / (LINEAR_SCALE * 2)) return 0;
+  for (int interface = 0; interface < 2; interface++) {
+    run((const char *)data, (uint32_t)size, interface, false);
+    run((const char *)data, (uint32_t)size, interface, true);
+  }
+  check_linearity("scanner", "chars", data, size, SCANNER_LINEAR_BASE,
+                  SCANNER_MAX_CHARS_PER_BYTE, scanner_work);
+  return 0;
+}
@@ -0,0 +1 @@
+(* ' '' '\\' '\n' "*)" {|*)|} {%%a.b |*)|} a'b'c 'x *)
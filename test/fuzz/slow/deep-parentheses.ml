@@ -0,0 +1 @@
+let x = (((((((((((((((([|[|{a = 
\ No newline at end of file
@@ -0,0 +1 @@
+let s = {%string a|${ {%string aa|${ {%string aaa|${ {%string aaaa|${ {%string aaaaa|${ {%string aaaaaa|${ {%string aaaaaaa|${ {%string aaaaaaaa|${ {%string aaaaaaaaa|${ {%string aaaaaaaaaa|${ {%string aaaaaaaaaaa|${ {%string aaaaaaaaaaaa|${ {%string aaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {%string aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ x }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaaa} }|aaaaaaaaaaaaaa} }|aaaaaaaaaaaaa} }|aaaaaaaaaaaa} }|aaaaaaaaaaa} }|aaaaaaaaaa} }|aaaaaaaaa} }|aaaaaaaa} }|aaaaaaa} }|aaaaaa} }|aaaaa} }|aaaa} }|aaa} }|aa} }|a}
@@ -0,0 +1 @@
+let s = {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ {%string|${ x }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|} }|}
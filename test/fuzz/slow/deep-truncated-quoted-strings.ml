@@ -0,0 +1 @@
+let s = {aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|${ {bbbbbbbbbbbbbbbbbbbbbbbbbbbbbb|${ {cccccccccccccccccccccccccccccc|${ {dddddddddddddddddddddddddddddd|${ {eeeeeeeeeeeeeeeeeeeeeeeeeeeeee|${ {ffffffffffffffffffffffffffffff|${ {gggggggggggggggggggggggggggggg|${ {hhhhhhhhhhhhhhhhhhhhhhhhhhhhhh|${ {iiiiiiiiiiiiiiiiiiiiiiiiiiiiii|${ {jjjjjjjjjjjjjjjjjjjjjjjjjjjjjj|${ {kkkkkkkkkkkkkkkkkkkkkkkkkkkkkk|${ {llllllllllllllllllllllllllllll|${ {mmmmmmmmmmmmmmmmmmmmmmmmmmmmmm|${ {nnnnnnnnnnnnnnnnnnnnnnnnnnnnnn|${ {oooooooooooooooooooooooooooooo|${ {pppppppppppppppppppppppppppppp|${ {qqqqqqqqqqqqqqqqqqqqqqqqqqqqqq|${ {rrrrrrrrrrrrrrrrrrrrrrrrrrrrrr|${ {ssssssssssssssssssssssssssssss|${ {tttttttttttttttttttttttttttttt|${ {uuuuuuuuuuuuuuuuuuuuuuuuuuuuuu|${ {vvvvvvvvvvvvvvvvvvvvvvvvvvvvvv|${ {wwwwwwwwwwwwwwwwwwwwwwwwwwwwww|${ {xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx|${ {yyyyyyyyyyyyyyyyyyyyyyyyyyyyyy|${ {zzzzzzzzzzzzzzzzzzzzzzzzzzzzzz|${ {aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa_|${ {bbbbbbbbbbbbbbbbbbbbbbbbbbbbbb_|${ {cccccccccccccccccccccccccccccc_|${ {dddddddddddddddddddddddddddddd_|${ {eeeeeeeeeeeeeeeeeeeeeeeeeeeeee_|${ {ffffffffffffffffffffffffffffff_|${ {gggggggggggggggggggggggggggggg_|${ {hhhhhhhhhhhhhhhhhhhhhhhhhhhhhh_|${ {iiiiiiiiiiiiiiiiiiiiiiiiiiiiii_|${ {jjjjjjjjjjjjjjjjjjjjjjjjjjjjjj_|${ {kkkkkkkkkkkkkkkkkkkkkkkkkkkkkk_|${ {llllllllllllllllllllllllllllll_|${ {mmmmmmmmmmmmmmmmmmmmmmmmmmmmmm_|${ {nnnnnnnnnnnnnnnnnnnnnnnnnnnnnn_|${ x |} |} }|nnnnnnnnnnnnnnnnnnnnnnnnnnnnnn_} }|mmmmmmmmmmmmmmmmmmmmmmmmmmmmmm_} }|llllllllllllllllllllllllllllll_} }|kkkkkkkkkkkkkkkkkkkkkkkkkkkkkk_} }|jjjjjjjjjjjjjjjjjjjjjjjjjjjjjj_} }|iiiiiiiiiiiiiiiiiiiiiiiiiiiiii_} }|hhhhhhhhhhhhhhhhhhhhhhhhhhhhhh_} }|gggggggggggggggggggggggggggggg_} }|ffffffffffffffffffffffffffffff_} }|eeeeeeeeeeeeeeeeeeeeeeeeeeeeee_} }|dddddddddddddddddddddddddddddd_} }|cccccccccccccccccccccccccccccc_} }|bbbbbbbbbbbbbbbbbbbbbbbbbbbbbb_} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa_} }|zzzzzzzzzzzzzzzzzzzzzzzzzzzzzz} }|yyyyyyyyyyyyyyyyyyyyyyyyyyyyyy} }|xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx} }|wwwwwwwwwwwwwwwwwwwwwwwwwwwwww} }|vvvvvvvvvvvvvvvvvvvvvvvvvvvvvv} }|uuuuuuuuuuuuuuuuuuuuuuuuuuuuuu} }|tttttttttttttttttttttttttttttt} }|ssssssssssssssssssssssssssssss} }|rrrrrrrrrrrrrrrrrrrrrrrrrrrrrr} }|qqqqqqqqqqqqqqqqqqqqqqqqqqqqqq} }|pppppppppppppppppppppppppppppp} }|oooooooooooooooooooooooooooooo} }|nnnnnnnnnnnnnnnnnnnnnnnnnnnnnn} }|mmmmmmmmmmmmmmmmmmmmmmmmmmmmmm} }|llllllllllllllllllllllllllllll} }|kkkkkkkkkkkkkkkkkkkkkkkkkkkkkk} }|jjjjjjjjjjjjjjjjjjjjjjjjjjjjjj} }|iiiiiiiiiiiiiiiiiiiiiiiiiiiiii} }|hhhhhhhhhhhhhhhhhhhhhhhhhhhhhh} }|gggggggggggggggggggggggggggggg} }|ffffffffffffffffffffffffffffff} }|eeeeeeeeeeeeeeeeeeeeeeeeeeeeee} }|dddddddddddddddddddddddddddddd} }|cccccccccccccccccccccccccccccc} }|bbbbbbbbbbbbbbbbbbbbbbbbbbbbbb} }|aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa}
@@ -0,0 +1 @@
+let let = = in in struct sig 
\ No newline at end of file
@@ -0,0 +1 @@
+let s = "%%%@<1%.*d@@@[@\n%-08.3f@<@ %"
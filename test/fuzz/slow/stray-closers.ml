@@ -0,0 +1 @@
+) ] } end done |] >} ;; in
\ No newline at end of file
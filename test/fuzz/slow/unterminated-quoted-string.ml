@@ -0,0 +1 @@
+let s = {a|$
\ No newline at end of file
@@ -0,0 +1,44 @@
+// Runs a fuzz target on files, for builds without libFuzzer: replaying the
+// corpus in `script/fuzz check`, and fuzzing with AFL (`afl-fuzz ... -- target
+// @@`).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+  size_t capacity = 4096, size = 0;
+  uint8_t *data = malloc(capacity);
+  for (;;) {
+    if (data == NULL) abort();
+    size += fread(data + size, 1, capacity - size, file);
+    if (size < capacity) break;
+    capacity *= 2;
+    data = realloc(data, capacity);
+  }
+  int failed = ferror(file);
+  fclose(file);
+  if (failed) {
+    perror(path);
+  } else {
+    LLVMFuzzerTestOneInput(data, size);
+  }
+  free(data);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    if (getenv("FUZZ_VERBOSE")) fprintf(stderr, "%s\n", argv[i]);
+    status |= run_file(argv[i]);
+  }
+  return status;
+}
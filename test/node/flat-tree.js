@@ -0,0 +1,112 @@
+#!/usr/bin/env node
+
+// Checks the trees that `parseAsync`, `parseBatch` and `parseFile` encode
+// against the trees node-tree-sitter parses from the same inputs, which are the
+// examples of ocaml/corpus and interface/corpus. Needs the Node binding to be
+// built, and exits with status 1 if a tree differs.
+
+const assert = require("assert");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+const Parser = require("tree-sitter");
+const {ocaml, interface: iface, parseAsync, parseBatch, parseFile} = require("../../bindings/node");
+
+const root = path.join(__dirname, "..", "..");
+
+const HEADER = /^=+\r?\n.*\r?\n=+\r?\n/m;
+const DIVIDER = /\r?\n-{3,}\r?\n/;
+
+// The inputs of the examples in the corpus files of `dir`.
+function corpusInputs(dir) {
+  const inputs = [];
+  for (const file of fs.readdirSync(dir).sort()) {
+    const text = fs.readFileSync(path.join(dir, file), "utf8");
+    for (const body of text.split(HEADER).slice(1)) {
+      inputs.push(body.slice(0, DIVIDER.exec(body).index));
+    }
+  }
+  return inputs;
+}
+
+// The UTF-8 offset of each UTF-16 offset of `input`: node-tree-sitter parses
+// strings as UTF-16, and the binding parses their UTF-8 encoding.
+function utf8Offsets(input) {
+  const offsets = [0];
+  for (const char of input) {
+    const offset = offsets[offsets.length - 1] + Buffer.byteLength(char);
+    // A surrogate pair is one character, and no node ends inside it.
+    if (char.length === 2) offsets.push(offset);
+    offsets.push(offset);
+  }
+  return offsets;
+}
+
+// The encoding of a node-tree-sitter tree, as the binding encodes its trees.
+function encode(tree, language, offsets) {
+  const kinds = [];
+  const startBytes = [];
+  const endBytes = [];
+  const parents = [];
+  const cursor = tree.walk();
+  const ancestors = [];
+  let parent = -1;
+  for (;;) {
+    const index = kinds.length;
+    kinds.push(language.nodeKinds[cursor.currentNode.typeId]);
+    startBytes.push(offsets[cursor.startIndex]);
+    endBytes.push(offsets[cursor.endIndex]);
+    parents.push(parent);
+    if (cursor.gotoFirstChild()) {
+      ancestors.push(parent);
+      parent = index;
+      continue;
+    }
+    while (!cursor.gotoNextSibling()) {
+      if (!cursor.gotoParent()) {
+        return {kinds, startBytes, endBytes, parents, hasError: tree.rootNode.hasError()};
+      }
+      parent = ancestors.pop();
+    }
+  }
+}
+
+function decode(result, language) {
+  return {
+    kinds: Array.from(result.kinds, (kind) => language.nodeKinds[kind]),
+    startBytes: Array.from(result.startBytes),
+    endBytes: Array.from(result.endBytes),
+    parents: Array.from(result.parents),
+    hasError: result.hasError,
+  };
+}
+
+async function check(language, dir) {
+  const parser = new Parser();
+  parser.setLanguage(language);
+  const inputs = corpusInputs(dir);
+  const expected = inputs.map((input) => encode(parser.parse(input), language, utf8Offsets(input)));
+
+  const batch = await parseBatch(language, inputs);
+  const tmp = fs.mkdtempSync(path.join(os.tmpdir(), "tree-sitter-ocaml-"));
+  try {
+    for (let i = 0; i < inputs.length; i++) {
+      assert.deepStrictEqual(decode(await parseAsync(language, inputs[i]), language), expected[i]);
+      assert.deepStrictEqual(decode(batch[i], language), expected[i]);
+      const file = path.join(tmp, "input");
+      fs.writeFileSync(file, inputs[i]);
+      assert.deepStrictEqual(decode(await parseFile(language, file), language), expected[i]);
+    }
+  } finally {
+    fs.rmSync(tmp, {recursive: true, force: true});
+  }
+  console.log(`  ${language.name}: ${inputs.length} trees`);
+}
+
+(async () => {
+  await check(ocaml, path.join(root, "ocaml", "corpus"));
+  await check(iface, path.join(root, "interface", "corpus"));
+})().catch((error) => {
+  console.error(error);
+  process.exit(1);
+});